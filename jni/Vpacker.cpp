@@ -74,6 +74,94 @@ JNIEXPORT jlong JNICALL Java_Vpacker_uncompress64
   return (rsize > std::numeric_limits<int64_t>::max())? 0 : rsize;
 }
 
+JNIEXPORT jlong JNICALL Java_Vpacker_compress32_1signed
+    (JNIEnv *env, jobject obj, jintArray src, jbyteArray dst, jlong n) {
+  jint  *jsrc = env->GetIntArrayElements(src, NULL);
+  jbyte *jdst = env->GetByteArrayElements(dst, NULL);
+
+  uint64_t wsize =
+      vpacker32::Compress((int32_t *)jsrc, (char *)jdst, n);
+
+  env->ReleaseIntArrayElements(src, jsrc, 0);
+  env->ReleaseByteArrayElements(dst, jdst, 0);
+
+  return (wsize > std::numeric_limits<int64_t>::max())? 0 : wsize;
+}
+
+JNIEXPORT jlong JNICALL Java_Vpacker_compress64_1signed
+    (JNIEnv *env, jobject obj, jlongArray src, jbyteArray dst, jlong n) {
+  jlong *jsrc = env->GetLongArrayElements(src, NULL);
+  jbyte *jdst = env->GetByteArrayElements(dst, NULL);
+
+  uint64_t wsize =
+      vpacker64::Compress((int64_t *)jsrc, (char *)jdst, n);
+
+  env->ReleaseLongArrayElements(src, jsrc, 0);
+  env->ReleaseByteArrayElements(dst, jdst, 0);
+
+  return (wsize > std::numeric_limits<int64_t>::max())? 0 : wsize;
+}
+
+JNIEXPORT jlong JNICALL Java_Vpacker_uncompress32_1signed
+    (JNIEnv *env, jobject obj, jbyteArray src, jintArray dst, jlong n) {
+  jbyte *jsrc = env->GetByteArrayElements(src, NULL);
+  jint  *jdst = env->GetIntArrayElements(dst, NULL);
+
+  uint64_t rsize = vpacker32::Uncompress(
+      (char *)jsrc, (int32_t *)jdst, n);
+
+  env->ReleaseByteArrayElements(src, jsrc, 0);
+  env->ReleaseIntArrayElements(dst, jdst, 0);
+
+  return (rsize > std::numeric_limits<int64_t>::max())? 0 : rsize;
+}
+
+JNIEXPORT jlong JNICALL Java_Vpacker_uncompress64_1signed
+    (JNIEnv *env, jobject obj, jbyteArray src, jlongArray dst, jlong n) {
+  jbyte *jsrc = env->GetByteArrayElements(src, NULL);
+  jlong *jdst = env->GetLongArrayElements(dst, NULL);
+
+  uint64_t rsize = vpacker64::Uncompress(
+      (char *)jsrc, (int64_t *)jdst, n);
+
+  env->ReleaseByteArrayElements(src, jsrc, 0);
+  env->ReleaseLongArrayElements(dst, jdst, 0);
+
+  return (rsize > std::numeric_limits<int64_t>::max())? 0 : rsize;
+}
+
+JNIEXPORT jlong JNICALL Java_Vpacker_compress32_1level
+    (JNIEnv *env, jobject obj, jintArray src, jbyteArray dst, jlong n,
+     jint level) {
+  jint  *jsrc = env->GetIntArrayElements(src, NULL);
+  jbyte *jdst = env->GetByteArrayElements(dst, NULL);
+
+  vpacker32::Compressor c;
+  c.set_level(level);
+  uint64_t wsize = c.Compress((uint32_t *)jsrc, (char *)jdst, n);
+
+  env->ReleaseIntArrayElements(src, jsrc, 0);
+  env->ReleaseByteArrayElements(dst, jdst, 0);
+
+  return (wsize > std::numeric_limits<int64_t>::max())? 0 : wsize;
+}
+
+JNIEXPORT jlong JNICALL Java_Vpacker_compress64_1level
+    (JNIEnv *env, jobject obj, jlongArray src, jbyteArray dst, jlong n,
+     jint level) {
+  jlong *jsrc = env->GetLongArrayElements(src, NULL);
+  jbyte *jdst = env->GetByteArrayElements(dst, NULL);
+
+  vpacker64::Compressor c;
+  c.set_level(level);
+  uint64_t wsize = c.Compress((uint64_t *)jsrc, (char *)jdst, n);
+
+  env->ReleaseLongArrayElements(src, jsrc, 0);
+  env->ReleaseByteArrayElements(dst, jdst, 0);
+
+  return (wsize > std::numeric_limits<int64_t>::max())? 0 : wsize;
+}
+
 JNIEXPORT jlong JNICALL Java_Vpacker_compress32_1bound
     (JNIEnv *env, jobject obj, jlong n) {
   uint64_t rs = vpacker32::CompressBound(n);
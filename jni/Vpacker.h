@@ -39,6 +39,54 @@ JNIEXPORT jlong JNICALL Java_Vpacker_uncompress32
 JNIEXPORT jlong JNICALL Java_Vpacker_uncompress64
   (JNIEnv *, jclass, jbyteArray, jlongArray, jlong);
 
+/*
+ * Class:     Vpacker
+ * Method:    compress32_signed
+ * Signature: ([I[BJ)J
+ */
+JNIEXPORT jlong JNICALL Java_Vpacker_compress32_1signed
+  (JNIEnv *, jclass, jintArray, jbyteArray, jlong);
+
+/*
+ * Class:     Vpacker
+ * Method:    compress64_signed
+ * Signature: ([J[BJ)J
+ */
+JNIEXPORT jlong JNICALL Java_Vpacker_compress64_1signed
+  (JNIEnv *, jclass, jlongArray, jbyteArray, jlong);
+
+/*
+ * Class:     Vpacker
+ * Method:    uncompress32_signed
+ * Signature: ([B[IJ)J
+ */
+JNIEXPORT jlong JNICALL Java_Vpacker_uncompress32_1signed
+  (JNIEnv *, jclass, jbyteArray, jintArray, jlong);
+
+/*
+ * Class:     Vpacker
+ * Method:    uncompress64_signed
+ * Signature: ([B[JJ)J
+ */
+JNIEXPORT jlong JNICALL Java_Vpacker_uncompress64_1signed
+  (JNIEnv *, jclass, jbyteArray, jlongArray, jlong);
+
+/*
+ * Class:     Vpacker
+ * Method:    compress32_level
+ * Signature: ([I[BJI)J
+ */
+JNIEXPORT jlong JNICALL Java_Vpacker_compress32_1level
+  (JNIEnv *, jclass, jintArray, jbyteArray, jlong, jint);
+
+/*
+ * Class:     Vpacker
+ * Method:    compress64_level
+ * Signature: ([J[BJI)J
+ */
+JNIEXPORT jlong JNICALL Java_Vpacker_compress64_1level
+  (JNIEnv *, jclass, jlongArray, jbyteArray, jlong, jint);
+
 /*
  * Class:     Vpacker
  * Method:    compress32_bound
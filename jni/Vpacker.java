@@ -16,7 +16,8 @@ public class Vpacker {
    * compress functions is assumed to encode a
    * sequence of 'positive' integers with high
    * skewness. Therefore, negative integers could
-   * deteriorate compression ratios.
+   * deteriorate compression ratios; use the signed
+   * functions below for such integers.
    *
    * src    : input buffer
    * dst    : output buffer
@@ -48,6 +49,40 @@ public class Vpacker {
       uncompress64(final byte[] src, long[] dst, long n);
 
 
+  /*-------------------------------------------------
+   * Interfaces for signed integers; they are the
+   * same as the above except that integers are
+   * zigzag-encoded during compression, so small
+   * negative ones are compressed into a few bits.
+   *-------------------------------------------------
+   */
+  public native static long
+      compress32_signed(final int[] src, byte[] dst, long n);
+  public native static long
+      compress64_signed(final long[] src, byte[] dst, long n);
+  public native static long
+      uncompress32_signed(final byte[] src, int[] dst, long n);
+  public native static long
+      uncompress64_signed(final byte[] src, long[] dst, long n);
+
+
+  /*-------------------------------------------------
+   * Interfaces with compression levels; they are
+   * the same as compress32/64() except that level
+   * 1 computes partitions in linear time, and
+   * level 2 (the maximum) is the same as
+   * compress32/64(). uncompress32/64() decompresses
+   * them.
+   *
+   * level  : compression level (1 or 2)
+   *-------------------------------------------------
+   */
+  public native static long
+      compress32_level(final int[] src, byte[] dst, long n, int level);
+  public native static long
+      compress64_level(final long[] src, byte[] dst, long n, int level);
+
+
   /*-------------------------------------------------
    * The function provides the maximumx size that
    * vpacker32/64_compress() may output. It is useful
@@ -24,6 +24,16 @@ size_t vpacker64_compress(
   return vpacker64::Compress(src, dst, n);
 }
 
+size_t vpacker32_compress_parallel(
+    const uint32_t *src, char *dst, size_t n, int nthreads) {
+  return vpacker32::Compress(src, dst, n, nthreads);
+}
+
+size_t vpacker64_compress_parallel(
+    const uint64_t *src, char *dst, size_t n, int nthreads) {
+  return vpacker64::Compress(src, dst, n, nthreads);
+}
+
 
 /* Decompression for a 32/64-bit array */
 size_t vpacker32_uncompress(
@@ -36,6 +46,105 @@ size_t vpacker64_uncompress(
   return vpacker64::Uncompress(src, dst, n);
 }
 
+size_t vpacker32_uncompress_parallel(
+    const char *src, uint32_t *dst, size_t n, int nthreads) {
+  return vpacker32::Uncompress(src, dst, n, nthreads);
+}
+
+size_t vpacker64_uncompress_parallel(
+    const char *src, uint64_t *dst, size_t n, int nthreads) {
+  return vpacker64::Uncompress(src, dst, n, nthreads);
+}
+
+
+/* Compression for a signed 32/64-bit array */
+size_t vpacker32_compress_signed(
+    const int32_t *src, char *dst, size_t n) {
+  return vpacker32::Compress(src, dst, n);
+}
+
+size_t vpacker64_compress_signed(
+    const int64_t *src, char *dst, size_t n) {
+  return vpacker64::Compress(src, dst, n);
+}
+
+size_t vpacker32_uncompress_signed(
+    const char *src, int32_t *dst, size_t n) {
+  return vpacker32::Uncompress(src, dst, n);
+}
+
+size_t vpacker64_uncompress_signed(
+    const char *src, int64_t *dst, size_t n) {
+  return vpacker64::Uncompress(src, dst, n);
+}
+
+
+/* Compression with transforms chosen for blocks */
+size_t vpacker32_compress_auto(
+    const uint32_t *src, char *dst, size_t n) {
+  vpacker32::Compressor c;
+  c.set_auto(true);
+  return c.Compress(src, dst, n);
+}
+
+size_t vpacker64_compress_auto(
+    const uint64_t *src, char *dst, size_t n) {
+  vpacker64::Compressor c;
+  c.set_auto(true);
+  return c.Compress(src, dst, n);
+}
+
+
+/* Compression with a given level */
+size_t vpacker32_compress_level(
+    const uint32_t *src, char *dst, size_t n, int level) {
+  vpacker32::Compressor c;
+  c.set_level(level);
+  return c.Compress(src, dst, n);
+}
+
+size_t vpacker64_compress_level(
+    const uint64_t *src, char *dst, size_t n, int level) {
+  vpacker64::Compressor c;
+  c.set_level(level);
+  return c.Compress(src, dst, n);
+}
+
+
+/* Compression with a given partition penalty */
+size_t vpacker32_compress_penalty(
+    const uint32_t *src, char *dst, size_t n, int penalty) {
+  vpacker32::Compressor c;
+  c.set_penalty(penalty);
+  return c.Compress(src, dst, n);
+}
+
+size_t vpacker64_compress_penalty(
+    const uint64_t *src, char *dst, size_t n, int penalty) {
+  vpacker64::Compressor c;
+  c.set_penalty(penalty);
+  return c.Compress(src, dst, n);
+}
+
+
+/* Compression for 64-bit time series */
+size_t vpacker64_compress_timestamps(
+    const uint64_t *src, char *dst, size_t n) {
+  vpacker64::Compressor c;
+  c.set_delta_of_delta(true);
+  return c.Compress(src, dst, n);
+}
+
+size_t vpacker64_compress_double(
+    const double *src, char *dst, size_t n) {
+  return vpacker64::Compress(src, dst, n);
+}
+
+size_t vpacker64_uncompress_double(
+    const char *src, double *dst, size_t n) {
+  return vpacker64::Uncompress(src, dst, n);
+}
+
 
 /* helper functions for compression */
 size_t vpacker32_compress_bound(size_t n) {
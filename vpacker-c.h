@@ -37,6 +37,24 @@ extern size_t vpacker64_compress(const uint64_t *src,
                                  char *dst,
                                  size_t n);
 
+/*-------------------------------------------------
+ * The same as the above except that blocks of
+ * integers are compressed with nthreads threads.
+ * The output is the same with a single thread.
+ *
+ * nthreads : # of threads for compression
+ *-------------------------------------------------
+ */
+extern size_t vpacker32_compress_parallel(const uint32_t *src,
+                                          char *dst,
+                                          size_t n,
+                                          int nthreads);
+
+extern size_t vpacker64_compress_parallel(const uint64_t *src,
+                                          char *dst,
+                                          size_t n,
+                                          int nthreads);
+
 
 /*-------------------------------------------------
  * A interface for decompression, a input byte
@@ -60,6 +78,133 @@ extern size_t vpacker64_uncompress(const char *src,
                                    uint64_t *dst,
                                    size_t n);
 
+/*-------------------------------------------------
+ * The same as the above except that blocks are
+ * decompressed with nthreads threads.
+ *
+ * nthreads : # of threads for decompression
+ *-------------------------------------------------
+ */
+extern size_t vpacker32_uncompress_parallel(const char *src,
+                                            uint32_t *dst,
+                                            size_t n,
+                                            int nthreads);
+
+extern size_t vpacker64_uncompress_parallel(const char *src,
+                                            uint64_t *dst,
+                                            size_t n,
+                                            int nthreads);
+
+
+/*-------------------------------------------------
+ * Interfaces for signed integers; they are the
+ * same as the above except that integers are
+ * zigzag-encoded in blocks, so small negative
+ * ones are compressed into a few bits.
+ *-------------------------------------------------
+ */
+extern size_t vpacker32_compress_signed(const int32_t *src,
+                                        char *dst,
+                                        size_t n);
+
+extern size_t vpacker64_compress_signed(const int64_t *src,
+                                        char *dst,
+                                        size_t n);
+
+extern size_t vpacker32_uncompress_signed(const char *src,
+                                          int32_t *dst,
+                                          size_t n);
+
+extern size_t vpacker64_uncompress_signed(const char *src,
+                                          int64_t *dst,
+                                          size_t n);
+
+
+/*-------------------------------------------------
+ * Interfaces to choose transforms for each block;
+ * they are the same as vpacker32/64_compress()
+ * except that gaps between adjacent integers or
+ * zigzag encoding are used in blocks where they
+ * are estimated smaller by sampling.
+ * vpacker32/64_uncompress() decompresses them.
+ *-------------------------------------------------
+ */
+extern size_t vpacker32_compress_auto(const uint32_t *src,
+                                      char *dst,
+                                      size_t n);
+
+extern size_t vpacker64_compress_auto(const uint64_t *src,
+                                      char *dst,
+                                      size_t n);
+
+
+/*-------------------------------------------------
+ * Interfaces with compression levels; they are
+ * the same as vpacker32/64_compress() except
+ * that level 1 computes partitions in linear
+ * time, and level 2 (the maximum) computes
+ * optimal ones as vpacker32/64_compress() does.
+ * Out-of-range levels are clamped, and
+ * vpacker32/64_uncompress() decompresses them.
+ *
+ *  level  : compression level (1 or 2)
+ *-------------------------------------------------
+ */
+extern size_t vpacker32_compress_level(const uint32_t *src,
+                                       char *dst,
+                                       size_t n,
+                                       int level);
+
+extern size_t vpacker64_compress_level(const uint64_t *src,
+                                       char *dst,
+                                       size_t n,
+                                       int level);
+
+
+/*-------------------------------------------------
+ * Interfaces with partition penalties; they are
+ * the same as vpacker32/64_compress() except
+ * that each partition is charged given bytes,
+ * which gives less and longer partitions that
+ * are faster to decode. Penalties are clamped
+ * to [0, 256], and vpacker32/64_uncompress()
+ * decompresses them.
+ *
+ *  penalty : bytes charged for each partition
+ *-------------------------------------------------
+ */
+extern size_t vpacker32_compress_penalty(const uint32_t *src,
+                                         char *dst,
+                                         size_t n,
+                                         int penalty);
+
+extern size_t vpacker64_compress_penalty(const uint64_t *src,
+                                         char *dst,
+                                         size_t n,
+                                         int penalty);
+
+
+/*-------------------------------------------------
+ * Interfaces for 64-bit time series; timestamps
+ * sampled at regular intervals are packed as the
+ * gaps of the gaps, and doubles are packed as
+ * XORs of adjacent bit patterns, which are
+ * restored bit-exactly. vpacker64_uncompress()
+ * decompresses the timestamps.
+ *-------------------------------------------------
+ */
+extern size_t vpacker64_compress_timestamps(const uint64_t *src,
+                                            char *dst,
+                                            size_t n);
+
+extern size_t vpacker64_compress_double(const double *src,
+                                        char *dst,
+                                        size_t n);
+
+extern size_t vpacker64_uncompress_double(const char *src,
+                                          double *dst,
+                                          size_t n);
+
 
 /*-------------------------------------------------
  * The function provides the maximumx size that
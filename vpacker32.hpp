@@ -14,10 +14,40 @@
 #define __INCLUDE_VPACKER32_HPP__
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
 
+#include <new>
+#include <algorithm>
+
+/*
+ * SIMD unpackers are compiled with target
+ * attributes on x86 processors, so they do not
+ * depend on compiler options such as -march.
+ * One of them is selected at runtime in
+ * SelectUnpackers() by using cpuid.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) &&  \
+    (defined(__clang__) || __GNUC__ > 4 ||         \
+        (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# include <immintrin.h>
+# define VP32_HAVE_SSE41
+# define VP32_HAVE_AVX2
+# define VP32_TARGET_SSE41  __attribute__((target("sse4.1")))
+# define VP32_TARGET_AVX2   __attribute__((target("avx2")))
+#endif
+
+/*
+ * Compressor uses POSIX threads to compress
+ * blocks concurrently if they are available.
+ */
+#if defined(__GNUC__) && (defined(__unix__) || defined(__APPLE__))
+# include <pthread.h>
+# define VP32_HAVE_PTHREAD
+#endif
+
 /* A C99 standard option */
 #if __STDC_VERSION__ < 199901L
 # define restrict
@@ -41,6 +71,18 @@
 # define VP32_ASSERT(__x__)
 #endif
 
+/*
+ * Byte-order detection; multi-byte values are
+ * loaded at once if it is known.
+ */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+# if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define VP32_LITTLE_ENDIAN
+# elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#  define VP32_BIG_ENDIAN
+# endif
+#endif
+
 /* Hardware bit-count detection */
 #if defined(__GNUC__)
 # define VP32_MSB32(__x__)  \
@@ -79,11 +121,30 @@ namespace vpacker32 {
  */
 static const uint64_t VP32_MAGICNUM = 0x4c84a4599e2845dbULL;
 
+/*
+ * VP32_MAGICNUM_V2 marks the second format, in
+ * which block headers, raw integers, and 32-bit
+ * partitions are stored in little-endian. It was
+ * picked in the same way as the above, and
+ * Uncompress() accepts both formats.
+ */
+static const uint64_t VP32_MAGICNUM_V2 = 0x021f2743cf78a33bULL;
+
+/*
+ * VP32_MAGICNUM_V2_DIR marks v2 streams that have
+ * a block directory just after the magic number.
+ * The directory has little-endian 64-bit byte
+ * offsets of all the blocks from the head of
+ * a stream, so they can be decoded in parallel.
+ */
+static const uint64_t VP32_MAGICNUM_V2_DIR = 0x8c673ee37eeaf218ULL;
+
 namespace backend {
 
 /*
  * Integers in each partition are packed with
- * pre-defined lengths below.
+ * pre-defined lengths below, or any exact length
+ * with an extended control byte (See ctrl_ext).
  */
 static const int bits_length[] = {
   0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
@@ -167,6 +228,40 @@ static const char ctrl_partition[] = {
   0xf0
 };
 
+/*
+ * If lower 4-bits in a control byte are ctrl_ext,
+ * an extended control byte follows, and it has
+ * an exact bit length of the partition. It is
+ * used for bit lengths not in bits_length[] when
+ * the extra byte is cheaper than rounding up.
+ *
+ * The bit length is in the lower 6 bits of the
+ * extended byte, and upper bits have a kind of
+ * the partition. An ext_for partition has
+ * a 32-bit base (frame of reference) before packed
+ * integers, and the base is added to them.
+ *
+ * An ext_patch partition packs lower bits of
+ * integers, and a few integers with more bits
+ * (exceptions) are patched by a list after them;
+ * the list has # of exceptions and a bit length
+ * of their upper bits in two bytes, their
+ * positions in bytes, and the packed upper bits.
+ *
+ * An ext_run partition is a run of an integer
+ * longer than any partition_length[]; 32-bit
+ * little-endian # of integers and the integer
+ * follow, and a control byte has no partition
+ * length.
+ */
+static const char ctrl_ext = 0x0f;
+
+static const int ext_bits_mask = 0x3f;
+static const int ext_plain = 0x00;
+static const int ext_for = 0x40;
+static const int ext_patch = 0x80;
+static const int ext_run = 0xc0;
+
 /*
  * A input sequence of integers is split into
  * block_num ones, and the integers are compressed
@@ -174,6 +269,61 @@ static const char ctrl_partition[] = {
  */
 static const size_t block_num = 65536;
 
+/* Format versions marked by the magic numbers */
+static const int format_v1 = 1;
+static const int format_v2 = 2;
+
+/*
+ * Flags of a block in the v2 format, which are
+ * stored in the top byte of the offset in a block
+ * header. A block with block_delta has the gaps
+ * between adjacent integers, and a 32-bit base
+ * value follows the header. block_zigzag maps
+ * signed integers (or signed gaps with
+ * block_delta) to unsigned ones by zigzag
+ * encoding, so small negative ones are packed
+ * into a few bits.
+ *
+ * A block with block_dict has a dictionary of
+ * up to dict_max distinct integers after the
+ * header; 32-bit # of entries and the sorted
+ * entries in little-endian follow, and packed
+ * integers are indices of the entries. It is
+ * not used with the other flags.
+ */
+static const uint32_t block_delta = 0x01;
+static const uint32_t block_zigzag = 0x02;
+static const uint32_t block_dict = 0x04;
+static const uint32_t block_known_flags =
+    block_delta | block_zigzag | block_dict;
+
+static const size_t dict_max = 256;
+
+/*
+ * block_auto is not stored in blocks; it makes
+ * CompressBlock() choose block_delta and
+ * block_zigzag for each block by sampling.
+ */
+static const uint32_t block_auto = 0x80;
+
+/*
+ * Compression levels; level_fast computes
+ * partitions in linear time, and level_max
+ * computes optimal ones by DP. Both of them
+ * output the same format.
+ */
+static const int level_fast = 1;
+static const int level_max = 2;
+
+/*
+ * Partitioning charges each partition its control
+ * byte and a penalty in bytes up to penalty_max;
+ * a larger penalty gives less and longer
+ * partitions, which are faster to decode, for
+ * a little larger output.
+ */
+static const int penalty_max = 256;
+
 
 /*-------------------------------------------------
  * A writer/reader for a given unsigned value
@@ -190,16 +340,34 @@ static const size_t block_num = 65536;
  *  return : 16/32/64-bit value to read
  *-------------------------------------------------
  */
+/*
+ * If byte-ordering is known, the writers below
+ * use a unaligned store with memcpy() as
+ * the readers do.
+ */
 inline void SetUint32(char *restrict out,
                       uint32_t v) {
+#if defined(VP32_LITTLE_ENDIAN)
+  v = __builtin_bswap32(v);
+  memcpy(out, &v, sizeof(v));
+#elif defined(VP32_BIG_ENDIAN)
+  memcpy(out, &v, sizeof(v));
+#else
   out[0] = (v >> 24) & 0xff;
   out[1] = (v >> 16) & 0xff;
   out[2] = (v >> 8) & 0xff;
   out[3] = v & 0xff;
+#endif
 }
 
 inline void SetUint64(char *restrict out,
                       uint64_t v) {
+#if defined(VP32_LITTLE_ENDIAN)
+  v = __builtin_bswap64(v);
+  memcpy(out, &v, sizeof(v));
+#elif defined(VP32_BIG_ENDIAN)
+  memcpy(out, &v, sizeof(v));
+#else
   out[0] = (v >> 56) & 0xff;
   out[1] = (v >> 48) & 0xff;
   out[2] = (v >> 40) & 0xff;
@@ -208,6 +376,7 @@ inline void SetUint64(char *restrict out,
   out[5] = (v >> 16) & 0xff;
   out[6] = (v >> 8) & 0xff;
   out[7] = v & 0xff;
+#endif
 }
 
 inline uint16_t
@@ -217,20 +386,223 @@ inline uint16_t
   return v;
 }
 
+/*
+ * If byte-ordering is known, the readers below
+ * use a unaligned load with memcpy(), which
+ * compilers translate into a single instruction.
+ */
 inline uint32_t
     DecodeUint32(const char *restrict in) {
+#if defined(VP32_LITTLE_ENDIAN)
+  uint32_t v;
+  memcpy(&v, in, sizeof(v));
+  return __builtin_bswap32(v);
+#elif defined(VP32_BIG_ENDIAN)
+  uint32_t v;
+  memcpy(&v, in, sizeof(v));
+  return v;
+#else
   uint32_t v = in[0] & 0xff;
   for (int i = 1; i < 4; i++)
     v = (v << 8) | (in[i] & 0xff);
   return v;
+#endif
 }
 
 inline uint64_t
     DecodeUint64(const char *restrict in) {
+#if defined(VP32_LITTLE_ENDIAN)
+  uint64_t v;
+  memcpy(&v, in, sizeof(v));
+  return __builtin_bswap64(v);
+#elif defined(VP32_BIG_ENDIAN)
+  uint64_t v;
+  memcpy(&v, in, sizeof(v));
+  return v;
+#else
   uint64_t v = in[0] & 0xff;
   for (int i = 1; i < 8; i++)
     v = (v << 8) | (in[i] & 0xff);
   return v;
+#endif
+}
+
+/*
+ * Little-endian writers/readers for the v2
+ * format. The ones for arrays below switch byte
+ * ordering by a format version, and the arrays
+ * are just copied with memcpy() in v2 if
+ * a running processor is little-endian.
+ */
+inline void SetUint32LE(char *restrict out,
+                        uint32_t v) {
+#if defined(VP32_LITTLE_ENDIAN)
+  memcpy(out, &v, sizeof(v));
+#elif defined(VP32_BIG_ENDIAN)
+  v = __builtin_bswap32(v);
+  memcpy(out, &v, sizeof(v));
+#else
+  for (int i = 0; i < 4; i++)
+    out[i] = (v >> (8 * i)) & 0xff;
+#endif
+}
+
+inline uint32_t
+    DecodeUint32LE(const char *restrict in) {
+  uint32_t v;
+#if defined(VP32_LITTLE_ENDIAN)
+  memcpy(&v, in, sizeof(v));
+#elif defined(VP32_BIG_ENDIAN)
+  memcpy(&v, in, sizeof(v));
+  v = __builtin_bswap32(v);
+#else
+  v = 0;
+  for (int i = 4 - 1; i >= 0; i--)
+    v = (v << 8) | (in[i] & 0xff);
+#endif
+  return v;
+}
+
+inline void SetUint64LE(char *restrict out,
+                        uint64_t v) {
+#if defined(VP32_LITTLE_ENDIAN)
+  memcpy(out, &v, sizeof(v));
+#elif defined(VP32_BIG_ENDIAN)
+  v = __builtin_bswap64(v);
+  memcpy(out, &v, sizeof(v));
+#else
+  for (int i = 0; i < 8; i++)
+    out[i] = (v >> (8 * i)) & 0xff;
+#endif
+}
+
+inline uint64_t
+    DecodeUint64LE(const char *restrict in) {
+  uint64_t v;
+#if defined(VP32_LITTLE_ENDIAN)
+  memcpy(&v, in, sizeof(v));
+#elif defined(VP32_BIG_ENDIAN)
+  memcpy(&v, in, sizeof(v));
+  v = __builtin_bswap64(v);
+#else
+  v = 0;
+  for (int i = 8 - 1; i >= 0; i--)
+    v = (v << 8) | (in[i] & 0xff);
+#endif
+  return v;
+}
+
+inline void SetUint32s(char *restrict out,
+                       const uint32_t *restrict v,
+                       size_t n, int version) {
+  if (version == format_v1) {
+    for (size_t i = 0; i < n; i++)
+      SetUint32(out + 4 * i, v[i]);
+    return;
+  }
+
+#if defined(VP32_LITTLE_ENDIAN)
+  memcpy(out, v, n * sizeof(uint32_t));
+#else
+  for (size_t i = 0; i < n; i++)
+    SetUint32LE(out + 4 * i, v[i]);
+#endif
+}
+
+inline void DecodeUint32s(const char *restrict in,
+                          uint32_t *restrict v,
+                          size_t n, int version) {
+  if (version == format_v1) {
+    for (size_t i = 0; i < n; i++)
+      v[i] = DecodeUint32(in + 4 * i);
+    return;
+  }
+
+#if defined(VP32_LITTLE_ENDIAN)
+  memcpy(v, in, n * sizeof(uint32_t));
+#else
+  for (size_t i = 0; i < n; i++)
+    v[i] = DecodeUint32LE(in + 4 * i);
+#endif
+}
+
+/*
+ * A writer/reader for a block header, which has
+ * the size of a block, the offset of packed
+ * data in the block, and block flags in v2.
+ * BlockHeaderSize() includes values following
+ * the header for the flags.
+ */
+inline void SetBlockHeader(char *restrict out,
+                           uint32_t block_size,
+                           uint32_t offset,
+                           uint32_t flags,
+                           int version) {
+  VP32_ASSERT(offset < (1U << 24));
+  VP32_ASSERT(flags == 0 || version != format_v1);
+
+  if (version == format_v1) {
+    SetUint32(out, block_size);
+    SetUint32(out + 4, offset);
+  } else {
+    SetUint32LE(out, block_size);
+    SetUint32LE(out + 4, offset | (flags << 24));
+  }
+}
+
+inline void DecodeBlockHeader(const char *restrict in,
+                              uint32_t *block_size,
+                              uint32_t *offset,
+                              uint32_t *flags,
+                              int version) {
+  if (version == format_v1) {
+    *block_size = DecodeUint32(in);
+    *offset = DecodeUint32(in + 4);
+    *flags = 0;
+  } else {
+    *block_size = DecodeUint32LE(in);
+    *offset = DecodeUint32LE(in + 4) & 0xffffff;
+    *flags = DecodeUint32LE(in + 4) >> 24;
+  }
+}
+
+inline uint32_t BlockHeaderSize(uint32_t flags) {
+  return (flags & block_delta)? 12 : 8;
+}
+
+/*
+ * A reader for a dictionary of a block_dict
+ * block; dict[] gets the entries padded with 0,
+ * and *ctrl_offset gets the head of control
+ * bytes for any flags. It returns false if the
+ * dictionary is broken.
+ */
+inline bool DecodeBlockDict(const char *restrict in,
+                            uint32_t flags,
+                            uint32_t offset,
+                            uint32_t *ctrl_offset,
+                            uint32_t *restrict dict) {
+  *ctrl_offset = BlockHeaderSize(flags);
+
+  if ((flags & block_dict) == 0)
+    return offset >= *ctrl_offset;
+
+  if (flags != block_dict || offset < *ctrl_offset + 4)
+    return false;
+
+  uint32_t ndict = DecodeUint32LE(in + *ctrl_offset);
+
+  if (ndict == 0 || ndict > dict_max ||
+        offset < *ctrl_offset + 4 + 4 * ndict)
+    return false;
+
+  for (uint32_t i = 0; i < dict_max; i++) {
+    dict[i] = (i < ndict)?
+        DecodeUint32LE(in + *ctrl_offset + 4 + 4 * i) : 0;
+  }
+
+  *ctrl_offset += 4 + 4 * ndict;
+  return true;
 }
 
 
@@ -313,560 +685,3071 @@ inline int WriteBits(const uint32_t *src,
 
 
 /*-------------------------------------------------
- * A function computes optimal partitions to
- * pack integers by Dynamic Programming.
+ * Packers specialized on a bit length B, which
+ * write the same bytes as WriteBits(). Each group
+ * of 32 integers, or 4 * B bytes, is packed into
+ * 64-bit words with shifts fixed in compile time,
+ * and a full word is stored at once; an integer
+ * over the word is split into the two. Left
+ * groups of 8 integers, or B bytes, are packed
+ * in the same way, and the others are written
+ * by WriteBits().
  *
- *  src    : integer array to partition with DP
- *  n      : # of input integers
- *  parts  : result partitions
- *  return : # of partitions
+ * The interface is the same as WriteBits().
  *-------------------------------------------------
  */
-inline int ComputePartition(const uint32_t *src,
-                            size_t n,
-                            size_t *parts) {
-  VP32_ASSERT(src != NULL);
-  VP32_ASSERT(parts != NULL);
-
-  const size_t max_partition =
-      partition_length[ARRAYSIZE(partition_length) - 1];
-
-  VP32_ASSERT(n >= max_partition);
+typedef int (*vwrite32_t)(const uint32_t *src,
+                          size_t n,
+                          char *dst,
+                          const char *restrict dlimit);
 
+template <int B, int N, int K, int NUSED>
+struct WordPacker {
   /*
-   * refs[] stores backward references to partition
-   * *src. refs[i] - refs[i-1] is a length of calculated
-   * partitions, and costs[i] stores cost values
-   * corresponding to the partitoin. Initially, refs[]
-   * and costs[] are set to -1 and 0.
+   * NUSED is # of bits in a current word, and the
+   * word is stored if the K-th integer fills it;
+   * the upper kFill bits of the integer go to the
+   * word, and the rest start a next one.
    */
-  int64_t   refs[n + 1];
-  uint64_t  costs[n + 1];
+  static const bool kStore = (NUSED + B >= 64);
+  static const int  kFill = kStore? 64 - NUSED : B;
+  static const int  kNused = kStore? NUSED + B - 64 : NUSED + B;
+
+  static inline void Run(const uint32_t *restrict src,
+                         char *restrict dst,
+                         uint64_t *w) {
+    uint64_t v = src[K] & ((uint64_t(1) << B) - 1);
+
+    if (kStore) {
+      SetUint64(dst + (((K + 1) * B - kNused) >> 3) - 8,
+                (*w << kFill) | (v >> (B - kFill)));
+      *w = v;
+    } else {
+      *w = (*w << B) | v;
+    }
 
-  for (size_t i = 0; i <= n; i++) {
-    refs[i] = -1;
-    costs[i] = 0;
+    WordPacker<B, N, K + 1, kNused>::Run(src, dst, w);
   }
+};
 
+template <int B, int N, int NUSED>
+struct WordPacker<B, N, N, NUSED> {
   /*
-   * Initialize costs in costs[0...max_partition-1]
-   * Leading max_partition-elements in refs[] must
-   * reference to the previous one there.
+   * Left bits are in bytes because N * B is,
+   * and they are 0 or 32 bits if N == 32.
    */
-  costs[0] = VP32_DIV_ROUNDUP(
-      32 - VP32_MSB32(src[0]), 8);
-  for (size_t i = 1;
-        i < max_partition; i++) {
-    refs[i] = i - 1;
-    costs[i] = costs[i - 1] +
-        VP32_DIV_ROUNDUP(32 - VP32_MSB32(src[i]), 8);
-  }
+  static inline void Run(const uint32_t *restrict,
+                         char *restrict dst,
+                         uint64_t *w) {
+    if (NUSED == 32) {
+      SetUint32(dst + (N * B - NUSED) / 8, *w);
+      return;
+    }
 
-  for (size_t i = max_partition; i <= n; i++) {
-    int     maxb = 0;
+    for (int i = 0; i < (NUSED >> 3); i++) {
+      dst[(N * B - NUSED) / 8 + i] =
+          (*w >> (NUSED - 8 - 8 * i)) & 0xff;
+    }
+  }
+};
 
-    for (size_t j = 0;
-          j < ARRAYSIZE(partition_length); j++) {
-      size_t bp = i - partition_length[j];
+template <int B, int N>
+inline void PackWordFast(const uint32_t *restrict src,
+                         char *restrict dst,
+                         size_t n) {
+  for (size_t i = 0; i < n; i += N) {
+    uint64_t w = 0;
+    WordPacker<B, N, 0, 0>::Run(src, dst, &w);
 
-      /*
-       * Update a maximum bit length in
-       * a given array.
-       */
-      int b = roundup_bits[
-          32 - VP32_MSB32(src[bp])];
-      if (maxb < b)
-        maxb = b;
+    src += N;
+    dst += (N * B) / 8;
+  }
+}
 
-      uint64_t c = costs[bp] +
-          VP32_DIV_ROUNDUP((i - bp) * maxb, 8);
+template <int B>
+inline int PackWord(const uint32_t *src,
+                    size_t n,
+                    char *dst,
+                    const char *restrict dlimit) {
+  VP32_ASSERT(n <= 128);
 
-      if (refs[i] == -1 || c <= costs[i]) {
-        costs[i] = c;
-        refs[i] = bp;
-      }
-    }
-  }
+  int nwritten = VP32_DIV_ROUNDUP(B * n, 8);
+  if (dst + nwritten > dlimit)
+    return -1;
 
-  /* Compute the number of partitions */
-  int     pnum = 0;
-  size_t  next = n;
+  size_t i = n & ~size_t(31);
+  PackWordFast<B, 32>(src, dst, i);
 
-  while (next != 0) {next = refs[next]; pnum++;}
+  size_t j = n & ~size_t(7);
+  PackWordFast<B, 8>(src + i, dst + (i / 8) * B, j - i);
 
-  /* Give back optimal partitons to a caller */
-  int     pidx = pnum;
+  /* Write left integers */
+  if (j < n)
+    WriteBits(src + j, B, n - j, dst + (j / 8) * B, dlimit);
 
-  while (n != 0) {parts[pidx--] = n; n = refs[n];}
-  parts[0] = 0;
+  return nwritten;
+}
 
-  return pnum;
+inline int PackWord0(const uint32_t *,
+                     size_t n,
+                     char *dst,
+                     const char *restrict dlimit) {
+  VP32_ASSERT(n <= 128);
+  (void)n;
+  return (dst > dlimit)? -1 : 0;
 }
 
+/*
+ * A table of the packers above, which is indexed
+ * by a bit length.
+ */
+static const vwrite32_t word_packers[33] = {
+  PackWord0, PackWord<1>, PackWord<2>, PackWord<3>,
+  PackWord<4>, PackWord<5>, PackWord<6>, PackWord<7>,
+  PackWord<8>, PackWord<9>, PackWord<10>, PackWord<11>,
+  PackWord<12>, PackWord<13>, PackWord<14>, PackWord<15>,
+  PackWord<16>, PackWord<17>, PackWord<18>, PackWord<19>,
+  PackWord<20>, PackWord<21>, PackWord<22>, PackWord<23>,
+  PackWord<24>, PackWord<25>, PackWord<26>, PackWord<27>,
+  PackWord<28>, PackWord<29>, PackWord<30>, PackWord<31>,
+  PackWord<32>
+};
+
 
 /*-------------------------------------------------
- * Unpack fixed-bit integers by a given length.
- * NOTE: The following functions overrun a given
- * buffer to some extent in view of unpacking
- * performance. Therefore, a caller must use the
- * functions while taking into accounts the
- * overruns during unpacking.
- *
- *  src    : integer array to pack
- *  slimit : terminal address of *src
- *  dst    : output buffer
- *  dlimit : terminal address of *dst
- *  n      : # of decompressed integers
- *  return : # of read bytes, or -1 if it fails
+ * A writer function for an ext_patch partition.
+ * It packs lower nbits of integers, and then
+ * a patch list of the others with the packers
+ * above.
  *
- * XXX: Unpacking integers byte-by-byte eats many
- * processor time, so it is better to exploit
- * 32-bit or 64-bit registers; load consecutive
- * bytes in *src into the registers, and scatter
- * into a output buffer in *dst, while taking into
- * accounts byte-ordering and unaligned loads.
+ *  src    : integer array to write
+ *  nbits  : # of lower bits to pack
+ *  n      : # of input integers
+ *  out    : output bffuer
+ *  limit  : terminal address of *out
+ *  return : # of written bytes, or -1 if it fails
  *-------------------------------------------------
  */
+inline int WritePatched(const uint32_t *src,
+                        int nbits,
+                        size_t n,
+                        char *dst,
+                        const char *restrict dlimit) {
+  VP32_ASSERT(src != NULL);
+  VP32_ASSERT(nbits >= 0 && nbits < 32);
+  VP32_ASSERT(n <= 128);
 
-/*
- * Currently, Unpack9 overruns *dst by 128 bytes.
- * So, last thirty-two 32-bit integers are left as
- * it is during compression, that is, just copied
- * to a output buffer.
- */
-const size_t MAX_UNPACK_OVERRUN_NUM = 32;
+  uint32_t  highs[128];
+  char      pos[128];
+  size_t    k = 0;
+  int       hb = 0;
 
-inline int Unpack0(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  /* Needed to suppress some warnings */
-  VP32_ASSERT(src != NULL);
-  VP32_ASSERT(slimit != NULL);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t h = src[i] >> nbits;
 
-  if (dst + n > dlimit)
-    return -1;
+    if (h != 0) {
+      int b = 32 - VP32_MSB32(h);
+      if (hb < b)
+        hb = b;
 
-  memset(dst, 0x00, n * 8);
-  return 0;
-}
+      highs[k] = h;
+      pos[k++] = i;
+    }
+  }
 
-inline int Unpack1(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 8);
-  if (src + nloop > slimit ||
-        dst + 8 * nloop > dlimit)
+  VP32_ASSERT(k != 0);
+
+  int lsz = VP32_DIV_ROUNDUP(n * nbits, 8);
+  int sz = 2 + lsz + k + VP32_DIV_ROUNDUP(k * hb, 8);
+
+  if (dst + sz > dlimit)
     return -1;
 
-  for (int i = 0; i < nloop ; i++) {
-    for (int j = 0; j < 8; j++)
-      dst[j] = (src[0] >> (7 - j)) & 0x01;
+  dst[0] = k;
+  dst[1] = hb;
 
-    src += 1;
-    dst += 8;
-  }
+  word_packers[nbits](src, n, dst + 2, dlimit);
+  memcpy(dst + 2 + lsz, pos, k);
+  word_packers[hb](highs, k, dst + 2 + lsz + k, dlimit);
 
-  return nloop;
+  return sz;
 }
 
-inline int Unpack2(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 4);
-  if (src + nloop > slimit ||
-        dst + 4 * nloop > dlimit)
-    return -1;
 
-  for (int i = 0; i < nloop; i++) {
-    for (int j = 0; j < 4; j++)
-      dst[j] = (src[0] >> (6 - 2 * j)) & 0x03;
+/*-------------------------------------------------
+ * Functions to decide how a partition is packed.
+ *
+ * PackedBits
+ *  n      : # of integers in a partition
+ *  nbits  : actual maximum bit length in it
+ *  return : bit length to pack the partition
+ *
+ * PackedSize
+ *  n      : # of integers in a partition
+ *  nbits  : bit length from PackedBits()
+ *  return : # of bytes to pack the partition,
+ *           including an extended control byte
+ *
+ * PartitionBits
+ *  src    : integer array in a partition
+ *  n      : # of integers in the partition
+ *  return : bit length to pack the partition
+ *-------------------------------------------------
+ */
+inline int PackedBits(size_t n, int nbits) {
+  VP32_ASSERT(nbits >= 0 && nbits <= 32);
 
-    src += 1;
-    dst += 4;
+  int rb = roundup_bits[nbits];
+
+  /* Use an exact one if it is cheaper */
+  if (rb != nbits &&
+        VP32_DIV_ROUNDUP(n * nbits, 8) + 1 <
+          VP32_DIV_ROUNDUP(n * rb, 8))
+    return nbits;
+
+  return rb;
+}
+
+inline size_t PackedSize(size_t n, int nbits) {
+  size_t sz = VP32_DIV_ROUNDUP(n * nbits, 8);
+  return (ctrl_bit[nbits] == char(0xff))? sz + 1 : sz;
+}
+
+inline int PartitionBits(const uint32_t *src,
+                         size_t n) {
+  int maxb = 0;
+  for (size_t i = 0; i < n; i++) {
+    int b = 32 - VP32_MSB32(src[i]);
+    if (maxb < b)
+      maxb = b;
   }
 
-  return nloop;
+  return PackedBits(n, maxb);
 }
 
-inline int Unpack3(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 8);
-  if (src + 3 * nloop > slimit ||
-        dst + 8 * nloop > dlimit)
-    return -1;
 
-  for (int i = 0; i < nloop; i++) {
-    dst[0] = (src[0] >> 5) & 0x07;
-    dst[1] = (src[0] >> 2) & 0x07;
-    dst[2] = (src[0] << 1) & 0x07;
-    /*
-     * A '0x01' mask must be needed because
-     * of arithmetic shifts for singed
-     * types, or *src, in gcc and other
-     * typical compilers.
-     */
-    dst[2] |= (src[1] >> 7) & 0x01;
-    dst[3] = (src[1] >> 4) & 0x07;
-    dst[4] = (src[1] >> 1) & 0x07;
-    dst[5] = (src[1] << 2) & 0x07;
-    dst[5] |= (src[2] >> 6) & 0x03;
-    dst[6] = (src[2] >> 3) & 0x07;
-    dst[7] = src[2] & 0x07;
+/*-------------------------------------------------
+ * Functions compute bit lengths of integers in
+ * one pass before partitioning, and then the DP
+ * and the packer read them instead of counting
+ * leading zeros for each candidate. SSE and
+ * AVX2 have no lzcnt for packed integers, so
+ * each 16-bit half is converted into a float,
+ * whose exponent is the bit length plus 126.
+ *
+ *  src    : integer array in a block
+ *  n      : # of the integers
+ *  widths : result bit lengths (0...32)
+ *-------------------------------------------------
+ */
+typedef void (*vwidths32_t)(const uint32_t *restrict src,
+                            size_t n,
+                            uint8_t *restrict widths);
 
-    src += 3;
-    dst += 8;
+inline void BitWidths(const uint32_t *restrict src,
+                      size_t n,
+                      uint8_t *restrict widths) {
+  for (size_t i = 0; i < n; i++)
+    widths[i] = 32 - VP32_MSB32(src[i]);
+}
+
+#ifdef VP32_HAVE_SSE41
+VP32_TARGET_SSE41 inline void BitWidthsSSE(
+    const uint32_t *restrict src, size_t n,
+    uint8_t *restrict widths) {
+  const __m128i mask = _mm_set1_epi32(0xffff);
+  const __m128i bias = _mm_set1_epi32(126);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i high = _mm_set1_epi32(16);
+  const __m128i gather = _mm_setr_epi8(
+      0, 4, 8, 12, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(src + i));
+    __m128i h = _mm_srli_epi32(x, 16);
+    __m128i l = _mm_and_si128(x, mask);
+
+    __m128i hb = _mm_srli_epi32(
+        _mm_castps_si128(_mm_cvtepi32_ps(h)), 23);
+    __m128i lb = _mm_srli_epi32(
+        _mm_castps_si128(_mm_cvtepi32_ps(l)), 23);
+
+    /* A zero has a zero exponent */
+    hb = _mm_max_epi32(_mm_sub_epi32(hb, bias), zero);
+    lb = _mm_max_epi32(_mm_sub_epi32(lb, bias), zero);
+
+    __m128i b = _mm_blendv_epi8(
+        _mm_add_epi32(hb, high), lb,
+        _mm_cmpeq_epi32(h, zero));
+
+    uint32_t w = _mm_cvtsi128_si32(
+        _mm_shuffle_epi8(b, gather));
+    memcpy(widths + i, &w, 4);
   }
 
-  return VP32_DIV_ROUNDUP(3 * n, 8);
+  BitWidths(src + i, n - i, widths + i);
 }
 
-inline int Unpack4(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 2);
-  if (src + nloop > slimit ||
-        dst + 2 * nloop > dlimit)
-    return -1;
+/* Bit lengths of 32-bit lanes in AVX2 */
+VP32_TARGET_AVX2 inline __m256i BitLengthsAVX2(__m256i x) {
+  const __m256i mask = _mm256_set1_epi32(0xffff);
+  const __m256i bias = _mm256_set1_epi32(126);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i high = _mm256_set1_epi32(16);
 
-  for (int i = 0; i < nloop; i++) {
-    for (int j = 0; j < 2; j++)
-      dst[j] = (src[0] >> (4 - 4 * j)) & 0x0f;
+  __m256i h = _mm256_srli_epi32(x, 16);
+  __m256i l = _mm256_and_si256(x, mask);
 
-    src += 1;
-    dst += 2;
+  __m256i hb = _mm256_srli_epi32(
+      _mm256_castps_si256(_mm256_cvtepi32_ps(h)), 23);
+  __m256i lb = _mm256_srli_epi32(
+      _mm256_castps_si256(_mm256_cvtepi32_ps(l)), 23);
+
+  /* A zero has a zero exponent */
+  hb = _mm256_max_epi32(_mm256_sub_epi32(hb, bias), zero);
+  lb = _mm256_max_epi32(_mm256_sub_epi32(lb, bias), zero);
+
+  return _mm256_blendv_epi8(
+      _mm256_add_epi32(hb, high), lb,
+      _mm256_cmpeq_epi32(h, zero));
+}
+
+VP32_TARGET_AVX2 inline void BitWidthsAVX2(
+    const uint32_t *restrict src, size_t n,
+    uint8_t *restrict widths) {
+  const __m256i gather = _mm256_setr_epi8(
+      0, 4, 8, 12, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1,
+      0, 4, 8, 12, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i lanes = _mm256_setr_epi32(
+      0, 4, 0, 0, 0, 0, 0, 0);
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i b = BitLengthsAVX2(_mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(src + i)));
+
+    b = _mm256_permutevar8x32_epi32(
+        _mm256_shuffle_epi8(b, gather), lanes);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(widths + i),
+                     _mm256_castsi256_si128(b));
   }
 
-  return nloop;
+  BitWidthsSSE(src + i, n - i, widths + i);
 }
+#endif /* VP32_HAVE_SSE41 */
 
-inline int Unpack5(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 8);
-  if (src + 5 * nloop > slimit ||
-        dst + 8 * nloop > dlimit)
-    return -1;
+inline vwidths32_t SelectBitWidths() {
+#ifdef VP32_HAVE_SSE41
+  __builtin_cpu_init();
+#endif
 
-  for (int i = 0; i < nloop; i++) {
-    dst[0] = (src[0] >> 3) & 0x1f;
-    dst[1] = (src[0] << 2) & 0x1f;
-    dst[1] |= (src[1] >> 6) & 0x03;
-    dst[2] = (src[1] >> 1) & 0x1f;
-    dst[3] = (src[1] << 4) & 0x1f;
-    dst[3] |= (src[2] >> 4) & 0x0f;
-    dst[4] = (src[2] << 1) & 0x1f;
-    dst[4] |= (src[3] >> 7) & 0x01;
-    dst[5] = (src[3] >> 2) & 0x1f;
-    dst[6] = (src[3] << 3) & 0x1f;
-    dst[6] |= (src[4] >> 5) & 0x07;
-    dst[7] = src[4] & 0x1f;
+#ifdef VP32_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return BitWidthsAVX2;
+#endif
 
-    src += 5;
-    dst += 8;
-  }
+#ifdef VP32_HAVE_SSE41
+  if (__builtin_cpu_supports("sse4.1"))
+    return BitWidthsSSE;
+#endif
 
-  return VP32_DIV_ROUNDUP(5 * n, 8);
+  return BitWidths;
 }
 
-inline int Unpack6(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 4);
-  if (src + 3 * nloop > slimit ||
-        dst + 4 * nloop > dlimit)
-    return -1;
 
-  for (int i = 0; i < nloop; i++) {
-    dst[0] = (src[0] >> 2) & 0x3f;
-    dst[1] = (src[0] << 4) & 0x3f;
-    dst[1] |= (src[1] >> 4) & 0x0f;
-    dst[2] = (src[1] << 2) & 0x3f;
-    dst[2] |= (src[2] >> 6) & 0x03;
-    dst[3] = src[2] & 0x3f;
+/*-------------------------------------------------
+ * Functions to choose a kind of a partition, and
+ * ComputePartition() uses the same choice for its
+ * costs. A frame of reference is used if the base
+ * and an extended control byte cost less than
+ * the bits saved by subtracting the base.
+ * Exceptions are patched if the list costs less
+ * than the bits saved in the other integers.
+ * Partitions longer than partition_length[] are
+ * runs, which ComputePartition() only gives.
+ *
+ * ChoosePacking
+ *  src    : integer array in a partition
+ *  widths : bit lengths of the integers
+ *  n      : # of integers in the partition
+ *  maxv   : maximum integer in the partition
+ *  minv   : minimum integer in the partition
+ *  p      : result packing of the partition
+ *
+ * PatchedSize
+ *  hist   : # of integers for each bit length
+ *           (0...32) in a partition
+ *  maxb   : maximum bit length in the partition
+ *  n      : # of integers in the partition
+ *  limit  : # of bytes to beat
+ *  nbits  : result bit length of lower bits
+ *  return : # of bytes of an ext_patch
+ *           partition, or limit if not cheaper
+ *-------------------------------------------------
+ */
+struct Packing {
+  int       kind;   /* ext_plain, ext_for, ... */
+  int       nbits;  /* bit length of packed ones */
+  uint32_t  base;   /* base for ext_for or ext_run */
+  size_t    size;   /* # of bytes with an ext byte */
+};
 
-    src += 3;
-    dst += 4;
+inline size_t PatchedSize(const uint32_t *hist,
+                          int maxb,
+                          size_t n,
+                          size_t limit,
+                          int *nbits) {
+  size_t best = limit;
+  size_t k = 0;
+
+  for (int b = maxb - 1; b >= 0; b--) {
+    k += hist[b + 1];
+
+    /*
+     * The patch list only grows for less bits, so
+     * it is a lower bound of following sizes.
+     */
+    size_t lsz = 3 + k +
+        VP32_DIV_ROUNDUP(k * (maxb - b), 8);
+    if (lsz >= best)
+      break;
+
+    size_t sz = lsz + VP32_DIV_ROUNDUP(n * b, 8);
+
+    if (sz < best) {
+      best = sz;
+      *nbits = b;
+    }
   }
 
-  return VP32_DIV_ROUNDUP(3 * n, 4);
+  return best;
 }
 
-inline int Unpack7(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 8);
-  if (src + 7 * nloop > slimit ||
-        dst + 8 * nloop > dlimit)
-    return -1;
+inline void ChoosePacking(size_t n,
+                          uint32_t maxv,
+                          uint32_t minv,
+                          Packing *p) {
+  int nb = 32 - VP32_MSB32(maxv);
+  int fb = 32 - VP32_MSB32(maxv - minv);
+
+  p->kind = ext_plain;
+  p->nbits = PackedBits(n, nb);
+  p->base = 0;
+  p->size = PackedSize(n, p->nbits);
+
+  /* A base does not pay if no bit is saved */
+  if (fb < nb) {
+    size_t fsz = 5 + VP32_DIV_ROUNDUP(n * fb, 8);
+
+    if (fsz < p->size) {
+      p->kind = ext_for;
+      p->nbits = fb;
+      p->base = minv;
+      p->size = fsz;
+    }
+  }
+}
 
-  for (int i = 0; i < nloop; i++) {
-    dst[0] = (src[0] >> 1) & 0x7f;
-    dst[1] = (src[0] << 6) & 0x7f;
-    dst[1] |= (src[1] >> 2) & 0x3f;
-    dst[2] = (src[1] << 5) & 0x7f;
-    dst[2] |= (src[2] >> 3) & 0x1f;
-    dst[3] = (src[2] << 4) & 0x7f;
-    dst[3] |= (src[3] >> 4) & 0x0f;
-    dst[4] = (src[3] << 3) & 0x7f;
-    dst[4] |= (src[4] >> 5) & 0x07;
-    dst[5] = (src[4] << 2) & 0x7f;
-    dst[5] |= (src[5] >> 6) & 0x03;
-    dst[6] = (src[5] << 1) & 0x7f;
-    dst[6] |= (src[6] >> 7) & 0x01;
-    dst[7] = src[6] & 0x7f;
+/* The size of a packing ChoosePacking() chooses */
+inline size_t PackingSize(size_t n,
+                          uint32_t maxv,
+                          uint32_t minv) {
+  size_t psz = PackedSize(n,
+      PackedBits(n, 32 - VP32_MSB32(maxv)));
+  size_t fsz = 5 + VP32_DIV_ROUNDUP(
+      n * (32 - VP32_MSB32(maxv - minv)), 8);
+  return (fsz < psz)? fsz : psz;
+}
 
-    src += 7;
-    dst += 8;
+inline void ChoosePacking(const uint32_t *src,
+                          const uint8_t *widths,
+                          size_t n,
+                          Packing *p) {
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  if (n > max_partition) {
+    p->kind = ext_run;
+    p->nbits = 0;
+    p->base = src[0];
+    p->size = 9;
+    return;
   }
 
-  return VP32_DIV_ROUNDUP(7 * n, 8);
-}
+  uint32_t maxv = 0;
+  uint32_t minv = 0xffffffff;
+  uint32_t hist[33] = {0};
 
-inline int Unpack8(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  if (src + n > slimit || dst + n > dlimit)
-    return -1;
+  for (size_t i = 0; i < n; i++) {
+    if (maxv < src[i])
+      maxv = src[i];
+    if (minv > src[i])
+      minv = src[i];
 
-  for (int i = 0; i < n; i++) {
-    dst[0] = src[0] & 0xff;
+    hist[widths[i]]++;
+  }
 
-    src += 1;
-    dst += 1;
+  ChoosePacking(n, maxv, minv, p);
+
+  int     nbits = 0;
+  size_t  sz = PatchedSize(hist, 32 - VP32_MSB32(maxv),
+                           n, p->size, &nbits);
+
+  if (sz < p->size) {
+    p->kind = ext_patch;
+    p->nbits = nbits;
+    p->base = 0;
+    p->size = sz;
   }
+}
 
-  return n;
+inline void ChoosePacking(const uint32_t *src,
+                          size_t n,
+                          Packing *p) {
+  uint8_t widths[128];
+
+  BitWidths(src, (n < 128)? n : 128, widths);
+  ChoosePacking(src, widths, n, p);
 }
 
-inline int Unpack9(const char *restrict src,
-                   const char *restrict slimit,
-                   uint32_t *restrict dst,
-                   const uint32_t *restrict dlimit,
-                   int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 16);
-  if (src + 18 * nloop > slimit ||
-        dst + 16 * nloop > dlimit)
-    return -1;
 
-  for (int i = 0; i < nloop; i++) {
+/*-------------------------------------------------
+ * Working space for ComputePartition() and
+ * CompressBlock(); each array needs (n + 1)
+ * entries for n integers, values() keeps
+ * integers transformed for block flags, widths()
+ * keeps their bit lengths, and packs() keeps
+ * packings of partitions.
+ * Compressor keeps the space, so it is reused
+ * among blocks and calls instead of taking stack
+ * space.
+ *-------------------------------------------------
+ */
+class Workspace {
+ public:
+  Workspace()
+      : refs_(NULL), costs_(NULL), parts_(NULL),
+        values_(NULL), widths_(NULL), packs_(NULL),
+        capacity_(0) {}
+  ~Workspace() {Release();}
+
+  /* Make room for n integers, or return false */
+  bool Reserve(size_t n) {
+    if (n <= capacity_ && refs_ != NULL)
+      return true;
+
+    Release();
+
+    refs_ = new(std::nothrow) int64_t[n + 1];
+    costs_ = new(std::nothrow) uint64_t[n + 1];
+    parts_ = new(std::nothrow) size_t[n + 1];
+    values_ = new(std::nothrow) uint32_t[n + 1];
+    widths_ = new(std::nothrow) uint8_t[n + 1];
+    packs_ = new(std::nothrow) Packing[n + 1];
+
+    if (refs_ == NULL || costs_ == NULL ||
+          parts_ == NULL || values_ == NULL ||
+          widths_ == NULL || packs_ == NULL) {
+      Release();
+      return false;
+    }
+
+    capacity_ = n;
+    return true;
+  }
+
+  int64_t *refs() const {return refs_;}
+  uint64_t *costs() const {return costs_;}
+  size_t *parts() const {return parts_;}
+  uint32_t *values() const {return values_;}
+  uint8_t *widths() const {return widths_;}
+  Packing *packs() const {return packs_;}
+
+ private:
+  void Release() {
+    delete[] refs_;
+    delete[] costs_;
+    delete[] parts_;
+    delete[] values_;
+    delete[] widths_;
+    delete[] packs_;
+
+    refs_ = NULL;
+    costs_ = NULL;
+    parts_ = NULL;
+    values_ = NULL;
+    widths_ = NULL;
+    packs_ = NULL;
+    capacity_ = 0;
+  }
+
+  int64_t   *refs_;
+  uint64_t  *costs_;
+  size_t    *parts_;
+  uint32_t  *values_;
+  uint8_t   *widths_;
+  Packing   *packs_;
+  size_t    capacity_;
+
+  /* Not copyable */
+  Workspace(const Workspace &);
+  void operator=(const Workspace &);
+};
+
+
+/*-------------------------------------------------
+ * Functions evaluate partition_length[] candidates
+ * of a partition ending at a given position for
+ * ComputePartition(), and return the cheapest one,
+ * or the longest one among the cheapest ones.
+ * Maximum and minimum integers are updated at
+ * the start of each candidate. AVX2 evaluates
+ * the 16 candidates at once with prefix maximums
+ * and minimums, so both give the same partitions.
+ * Sizes are not computed after a range of 32
+ * bits because they are 4 bytes for each integer.
+ *
+ *  src    : integer array to partition
+ *  costs  : costs of partitions before each position
+ *  i      : end of the candidates
+ *  cost   : result cost of the chosen one
+ *  return : start of the chosen one
+ *-------------------------------------------------
+ */
+typedef size_t (*vcandidate32_t)(const uint32_t *src,
+                                 const uint64_t *costs,
+                                 size_t i,
+                                 uint64_t *cost);
+
+inline size_t BestCandidate(const uint32_t *src,
+                            const uint64_t *costs,
+                            size_t i,
+                            uint64_t *cost) {
+  uint32_t  maxv = 0;
+  uint32_t  minv = 0xffffffff;
+  size_t    best = 0;
+
+  for (size_t j = 0;
+        j < ARRAYSIZE(partition_length); j++) {
+    size_t bp = i - partition_length[j];
+
     /*
-     * At first, Merge a input sequence
-     * into 2-byte chunks.
+     * Update maximum and minimum integers in
+     * a given array.
      */
-    uint16_t v[9];
+    if (maxv < src[bp])
+      maxv = src[bp];
+    if (minv > src[bp])
+      minv = src[bp];
 
-    for (int j = 0; j < 9; j++) {
-      v[j] = DecodeUint16(src);
-      src += 2;
+    uint64_t c = costs[bp] +
+        PackingSize(i - bp, maxv, minv);
+
+    if (j == 0 || c <= *cost) {
+      *cost = c;
+      best = bp;
     }
 
-    /* Then, scatter into a output */
-    dst[0] = (v[0] >> 7) & 0x01ff;
-    dst[1] = (v[0] << 2) & 0x01ff;
-    dst[1] |= v[1] >> 14;
-    dst[2] = (v[1] >> 5) & 0x01ff;
-    dst[3] = (v[1] << 4) & 0x01ff;
-    dst[3] |= v[2] >> 12;
-    dst[4] = (v[2] >> 3) & 0x01ff;
-    dst[5] = (v[2] << 6) & 0x01ff;
-    dst[5] |= v[3] >> 10;
-    dst[6] = (v[3] >> 1) & 0x01ff;
-    dst[7] = (v[3] << 8) & 0x01ff;
-    dst[7] |= v[4] >> 8;
-    dst[8] = (v[4] << 1) & 0x01ff;
-    dst[8] |= v[5] >> 15;
-    dst[9] = (v[5] >> 6) & 0x01ff;
-    dst[10] = (v[5] << 3) & 0x01ff;
-    dst[10] |= v[6] >> 13;
-    dst[11] = (v[6] >> 4) & 0x01ff;
-    dst[12] = (v[6] << 5) & 0x01ff;
-    dst[12] |= v[7] >> 11;
-    dst[13] = (v[7] >> 2) & 0x01ff;
-    dst[14] = (v[7] << 7) & 0x01ff;
-    dst[14] |= v[8] >> 9;
-    dst[15] = v[8] & 0x01ff;
+    /*
+     * No base saves a bit over a range of 32 bits,
+     * so longer candidates cost 4 bytes for each
+     * integer without updating the range.
+     */
+    if (maxv - minv >= 0x80000000U) {
+      for (j++; j < ARRAYSIZE(partition_length); j++) {
+        bp = i - partition_length[j];
+        c = costs[bp] + 4 * (i - bp);
+
+        if (c <= *cost) {
+          *cost = c;
+          best = bp;
+        }
+      }
+
+      break;
+    }
+  }
+
+  return best;
+}
+
+#ifdef VP32_HAVE_SSE41
+/* PackingSize() of 32-bit lanes in AVX2 */
+VP32_TARGET_AVX2 inline __m256i PackingSizesAVX2(
+    __m256i len, __m256i maxv, __m256i minv) {
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i five = _mm256_set1_epi32(5);
+  const __m256i seven = _mm256_set1_epi32(7);
+
+  /* The i-th bit is set if ctrl_bit[i] == 0xff */
+  const __m256i exts = _mm256_set1_epi32(int(0xfffee000));
+
+  __m256i nb = BitLengthsAVX2(maxv);
+  __m256i fb = BitLengthsAVX2(_mm256_sub_epi32(maxv, minv));
+  __m256i rb = _mm256_i32gather_epi32(roundup_bits, nb, 4);
+
+  __m256i nsz = _mm256_srli_epi32(_mm256_add_epi32(
+      _mm256_mullo_epi32(len, nb), seven), 3);
+  __m256i rsz = _mm256_srli_epi32(_mm256_add_epi32(
+      _mm256_mullo_epi32(len, rb), seven), 3);
+  __m256i fsz = _mm256_srli_epi32(_mm256_add_epi32(
+      _mm256_mullo_epi32(len, fb), seven), 3);
+
+  /* An exact bit length as PackedBits() */
+  __m256i exact = _mm256_cmpgt_epi32(
+      rsz, _mm256_add_epi32(nsz, one));
+  __m256i pb = _mm256_blendv_epi8(rb, nb, exact);
+  __m256i psz = _mm256_blendv_epi8(rsz, nsz, exact);
+
+  psz = _mm256_add_epi32(psz, _mm256_and_si256(
+      _mm256_srlv_epi32(exts, pb), one));
+
+  return _mm256_min_epu32(
+      psz, _mm256_add_epi32(fsz, five));
+}
+
+VP32_TARGET_AVX2 inline size_t BestCandidateAVX2(
+    const uint32_t *src, const uint64_t *costs,
+    size_t i, uint64_t *cost) {
+  VP32_ASSERT(ARRAYSIZE(partition_length) == 16);
+  VP32_ASSERT(partition_length[15] == 128);
+  VP32_ASSERT(costs[i - 1] < (uint64_t(1) << 31));
+
+  /* partition_length[] in two vectors */
+  const __m256i len0 = _mm256_setr_epi32(
+      1, 2, 3, 4, 5, 6, 7, 8);
+  const __m256i len1 = _mm256_setr_epi32(
+      9, 10, 11, 12, 16, 32, 64, 128);
+  const __m256i off0 = _mm256_sub_epi32(
+      _mm256_setzero_si256(), len0);
+  const __m256i off1 = _mm256_sub_epi32(
+      _mm256_setzero_si256(), len1);
+
+  const __m256i shift1 = _mm256_setr_epi32(
+      0, 0, 1, 2, 3, 4, 5, 6);
+  const __m256i shift2 = _mm256_setr_epi32(
+      0, 1, 0, 1, 2, 3, 4, 5);
+  const __m256i shift4 = _mm256_setr_epi32(
+      0, 1, 2, 3, 0, 1, 2, 3);
+  const __m256i last = _mm256_set1_epi32(7);
+
+  const int *s = reinterpret_cast<const int *>(src + i);
+
+  /* Lower halves of costs[] on little-endian */
+  const int *c = reinterpret_cast<const int *>(costs + i);
+
+  /* Prefix maximums and minimums over candidates */
+  __m256i max0 = _mm256_i32gather_epi32(s, off0, 4);
+  __m256i min0 = max0;
+
+  max0 = _mm256_max_epu32(
+      max0, _mm256_permutevar8x32_epi32(max0, shift1));
+  min0 = _mm256_min_epu32(
+      min0, _mm256_permutevar8x32_epi32(min0, shift1));
+  max0 = _mm256_max_epu32(
+      max0, _mm256_permutevar8x32_epi32(max0, shift2));
+  min0 = _mm256_min_epu32(
+      min0, _mm256_permutevar8x32_epi32(min0, shift2));
+  max0 = _mm256_max_epu32(
+      max0, _mm256_permutevar8x32_epi32(max0, shift4));
+  min0 = _mm256_min_epu32(
+      min0, _mm256_permutevar8x32_epi32(min0, shift4));
+
+  __m256i c0 = _mm256_add_epi32(
+      _mm256_i32gather_epi32(c, _mm256_add_epi32(off0, off0), 4),
+      PackingSizesAVX2(len0, max0, min0));
+  __m256i c1 = _mm256_i32gather_epi32(
+      c, _mm256_add_epi32(off1, off1), 4);
+
+  /*
+   * The second half costs 4 bytes for each integer
+   * after a range of 32 bits as BestCandidate().
+   */
+  if (_mm256_movemask_ps(_mm256_castsi256_ps(
+          _mm256_sub_epi32(max0, min0))) != 0) {
+    c1 = _mm256_add_epi32(c1, _mm256_slli_epi32(len1, 2));
+  } else {
+    __m256i max1 = _mm256_i32gather_epi32(s, off1, 4);
+    __m256i min1 = max1;
+
+    max1 = _mm256_max_epu32(
+        max1, _mm256_permutevar8x32_epi32(max1, shift1));
+    min1 = _mm256_min_epu32(
+        min1, _mm256_permutevar8x32_epi32(min1, shift1));
+    max1 = _mm256_max_epu32(
+        max1, _mm256_permutevar8x32_epi32(max1, shift2));
+    min1 = _mm256_min_epu32(
+        min1, _mm256_permutevar8x32_epi32(min1, shift2));
+    max1 = _mm256_max_epu32(
+        max1, _mm256_permutevar8x32_epi32(max1, shift4));
+    min1 = _mm256_min_epu32(
+        min1, _mm256_permutevar8x32_epi32(min1, shift4));
+
+    max1 = _mm256_max_epu32(
+        max1, _mm256_permutevar8x32_epi32(max0, last));
+    min1 = _mm256_min_epu32(
+        min1, _mm256_permutevar8x32_epi32(min0, last));
+
+    c1 = _mm256_add_epi32(
+        c1, PackingSizesAVX2(len1, max1, min1));
+  }
+
+  /* A minimum cost in all the lanes */
+  __m256i m = _mm256_min_epu32(c0, c1);
+  m = _mm256_min_epu32(
+      m, _mm256_permute2x128_si256(m, m, 1));
+  m = _mm256_min_epu32(
+      m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+  m = _mm256_min_epu32(
+      m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+
+  /* The last candidate of the minimum cost */
+  uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(c0, m)));
+  mask |= _mm256_movemask_ps(_mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(c1, m))) << 8;
+
+  *cost = uint32_t(_mm_cvtsi128_si32(
+      _mm256_castsi256_si128(m)));
+  return i - partition_length[31 - VP32_MSB32(mask)];
+}
+#endif /* VP32_HAVE_SSE41 */
+
+inline vcandidate32_t SelectBestCandidate() {
+#ifdef VP32_HAVE_AVX2
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return BestCandidateAVX2;
+#endif
+
+  return BestCandidate;
+}
+
+
+/*-------------------------------------------------
+ * A function computes optimal partitions to
+ * pack integers by Dynamic Programming.
+ *
+ *  src     : integer array to partition with DP
+ *  n       : # of input integers
+ *  parts   : result partitions
+ *  ws      : working space for (n + 1) entries,
+ *            and widths() has bit lengths of *src
+ *  penalty : bytes charged for each partition
+ *            besides its control byte
+ *  return  : # of partitions
+ *-------------------------------------------------
+ */
+inline int ComputePartition(const uint32_t *src,
+                            size_t n,
+                            size_t *parts,
+                            const Workspace &ws,
+                            int penalty = 0) {
+  VP32_ASSERT(src != NULL);
+  VP32_ASSERT(parts != NULL);
+
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  VP32_ASSERT(n >= max_partition);
+
+  VP32_ASSERT(penalty >= 0 && penalty <= penalty_max);
+
+  /*
+   * refs[] stores backward references to partition
+   * *src. refs[i] - refs[i-1] is a length of calculated
+   * partitions, and costs[i] stores cost values
+   * corresponding to the partitoin. Initially, refs[]
+   * and costs[] are set to -1 and 0.
+   */
+  int64_t       *refs = ws.refs();
+  uint64_t      *costs = ws.costs();
+  const uint8_t *widths = ws.widths();
+
+  for (size_t i = 0; i <= n; i++) {
+    refs[i] = -1;
+    costs[i] = 0;
+  }
+
+  /* A control byte and a penalty for each partition */
+  const uint64_t overhead = 1 + penalty;
+
+  /*
+   * Initialize costs in costs[0...max_partition-1]
+   * Leading max_partition-elements in refs[] must
+   * reference to the previous one there.
+   */
+  for (size_t i = 1;
+        i < max_partition; i++) {
+    refs[i] = i - 1;
+    costs[i] = costs[i - 1] + overhead +
+        PackingSize(1, src[i - 1], src[i - 1]);
+  }
+
+  /*
+   * hist[] counts bit lengths of the last
+   * max_partition integers to estimate patched
+   * exceptions in the longest partitions, and
+   * the i-th bit of blens is set if hist[i] != 0
+   * for i < 32.
+   */
+  uint32_t hist[33] = {0};
+  uint64_t blens = 0;
+
+  for (size_t i = 0; i < max_partition; i++) {
+    int b = widths[i];
+    hist[b]++;
+    blens |= uint64_t(1) << b;
+  }
+
+  /* A run of the same integers ends at i */
+  size_t rstart = 0;
+
+  for (size_t i = 1; i < max_partition; i++) {
+    if (src[i] != src[i - 1])
+      rstart = i;
+  }
+
+  static const vcandidate32_t best_candidate =
+      SelectBestCandidate();
+
+  for (size_t i = max_partition; i <= n; i++) {
+    if (i > max_partition) {
+      int b = widths[i - 1];
+      hist[b]++;
+      blens |= uint64_t(1) << b;
+
+      b = widths[i - 1 - max_partition];
+      if (--hist[b] == 0)
+        blens &= ~(uint64_t(1) << b);
+
+      if (src[i - 1] != src[i - 2])
+        rstart = i - 1;
+    }
+
+    refs[i] = best_candidate(src, costs, i, &costs[i]);
+    costs[i] += overhead;
+
+    size_t bp = i - max_partition;
+
+    if (costs[i] > costs[bp] + overhead) {
+      int     maxb = (hist[32] != 0)?
+          32 : 31 - VP32_MSB32(uint32_t(blens));
+      int     nbits;
+      size_t  limit = costs[i] - costs[bp] - overhead;
+      size_t  sz = PatchedSize(
+          hist, maxb, max_partition, limit, &nbits);
+
+      if (sz < limit) {
+        costs[i] = costs[bp] + overhead + sz;
+        refs[i] = bp;
+      }
+    }
+
+    /* A run longer than any partitions */
+    if (i - rstart > max_partition &&
+          costs[rstart] + overhead + 9 < costs[i]) {
+      costs[i] = costs[rstart] + overhead + 9;
+      refs[i] = rstart;
+    }
+  }
+
+  /* Compute the number of partitions */
+  int     pnum = 0;
+  size_t  next = n;
+
+  while (next != 0) {next = refs[next]; pnum++;}
+
+  /* Give back optimal partitons to a caller */
+  int     pidx = pnum;
+
+  while (n != 0) {parts[pidx--] = n; n = refs[n];}
+  parts[0] = 0;
+
+  return pnum;
+}
+
+/* It allocates working space in every call */
+inline int ComputePartition(const uint32_t *src,
+                            size_t n,
+                            size_t *parts) {
+  Workspace ws;
+  if (!ws.Reserve(n))
+    return 0;
+
+  BitWidths(src, n, ws.widths());
+  return ComputePartition(src, n, parts, ws);
+}
+
+/*-------------------------------------------------
+ * A function computes partitions in linear time
+ * for level_fast. Each max_partition integers
+ * are halved recursively only if the halves are
+ * smaller in total with a control byte and
+ * a penalty for each, and a partition of the same
+ * integer is merged into a previous one as a run.
+ * Left integers are split into the longest
+ * partitions.
+ *
+ *  src     : integer array to partition
+ *  n       : # of input integers
+ *  parts   : result partitions
+ *  ws      : working space for (n + 1) entries,
+ *            and widths() has bit lengths of *src
+ *  penalty : bytes charged for each partition
+ *            besides its control byte
+ *  return  : # of partitions
+ *-------------------------------------------------
+ */
+inline int ComputeFastPartition(const uint32_t *src,
+                                size_t n,
+                                size_t *parts,
+                                const Workspace &ws,
+                                int penalty = 0) {
+  VP32_ASSERT(src != NULL);
+  VP32_ASSERT(parts != NULL);
+  VP32_ASSERT(penalty >= 0 && penalty <= penalty_max);
+
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  VP32_ASSERT(max_partition == 128);
+
+  const uint8_t *widths = ws.widths();
+  const size_t  overhead = 1 + penalty;
+
+  int     pnum = 0;
+  size_t  pos = 0;
+  bool    run = false;
+
+  parts[0] = 0;
+
+  for (; pos + max_partition <= n; pos += max_partition) {
+    /*
+     * Nodes of a binary tree are in heap order;
+     * the k-th node has 128 >> depth(k) integers,
+     * and the leaves (128...255) have one each.
+     */
+    uint32_t  maxv[256];
+    uint32_t  minv[256];
+    size_t    costs[256];
+    bool      split[256];
+    uint32_t  hist[33] = {0};
+
+    for (int k = 128; k < 256; k++) {
+      uint32_t v = src[pos + k - 128];
+
+      maxv[k] = minv[k] = v;
+      costs[k] = overhead + PackingSize(1, v, v);
+      split[k] = false;
+
+      hist[widths[pos + k - 128]]++;
+    }
+
+    for (int k = 127; k >= 1; k--) {
+      size_t len = max_partition >> (31 - VP32_MSB32(k));
+
+      maxv[k] = (maxv[2 * k] > maxv[2 * k + 1])?
+          maxv[2 * k] : maxv[2 * k + 1];
+      minv[k] = (minv[2 * k] < minv[2 * k + 1])?
+          minv[2 * k] : minv[2 * k + 1];
+
+      size_t whole = overhead +
+          PackingSize(len, maxv[k], minv[k]);
+      size_t halves = costs[2 * k] + costs[2 * k + 1];
+
+      split[k] = (halves < whole);
+      costs[k] = split[k]? halves : whole;
+    }
+
+    /* Patched exceptions in the whole partition */
+    if (split[1]) {
+      int nbits;
+      if (overhead + PatchedSize(hist, 32 - VP32_MSB32(maxv[1]),
+                                 max_partition, costs[1],
+                                 &nbits) < costs[1])
+        split[1] = false;
+    }
+
+    /* Merge the same integers into a run */
+    bool same = (maxv[1] == minv[1]);
+
+    if (same && run && src[pos - 1] == maxv[1]) {
+      parts[pnum] += max_partition;
+      continue;
+    }
+
+    run = same;
+
+    /* Emit the nodes that are not split in order */
+    int stack[16];
+    int sp = 0;
+
+    stack[sp++] = 1;
+
+    size_t start = pos;
+
+    while (sp > 0) {
+      int k = stack[--sp];
+
+      if (split[k]) {
+        stack[sp++] = 2 * k + 1;
+        stack[sp++] = 2 * k;
+        continue;
+      }
+
+      start += max_partition >> (31 - VP32_MSB32(k));
+      parts[++pnum] = start;
+    }
+  }
+
+  /* Split left integers */
+  while (pos < n) {
+    size_t j = ARRAYSIZE(partition_length) - 1;
+    while (partition_length[j] > n - pos)
+      j--;
+
+    pos += partition_length[j];
+    parts[++pnum] = pos;
+  }
+
+  return pnum;
+}
+
+/* It allocates working space in every call */
+inline int ComputeFastPartition(const uint32_t *src,
+                                size_t n,
+                                size_t *parts) {
+  Workspace ws;
+  if (!ws.Reserve(n))
+    return 0;
+
+  BitWidths(src, n, ws.widths());
+  return ComputeFastPartition(src, n, parts, ws);
+}
+
+
+/*-------------------------------------------------
+ * Unpack fixed-bit integers by a given length.
+ * NOTE: The following functions overrun a given
+ * buffer to some extent in view of unpacking
+ * performance. Therefore, a caller must use the
+ * functions while taking into accounts the
+ * overruns during unpacking.
+ *
+ *  src    : integer array to pack
+ *  slimit : terminal address of *src
+ *  dst    : output buffer
+ *  dlimit : terminal address of *dst
+ *  n      : # of decompressed integers
+ *  return : # of read bytes, or -1 if it fails
+ *
+ * XXX: Unpacking integers byte-by-byte eats many
+ * processor time, so it is better to exploit
+ * 32-bit or 64-bit registers; load consecutive
+ * bytes in *src into the registers, and scatter
+ * into a output buffer in *dst, while taking into
+ * accounts byte-ordering and unaligned loads.
+ *-------------------------------------------------
+ */
+
+/*
+ * Currently, Unpack9 overruns *dst by 128 bytes.
+ * So, last thirty-two 32-bit integers are left as
+ * it is during compression, that is, just copied
+ * to a output buffer.
+ */
+const size_t MAX_UNPACK_OVERRUN_NUM = 32;
+
+inline int Unpack0(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  /* Needed to suppress some warnings */
+  VP32_ASSERT(src != NULL);
+  VP32_ASSERT(slimit != NULL);
+
+  if (dst + n > dlimit)
+    return -1;
+
+  memset(dst, 0x00, n * sizeof(uint32_t));
+  return 0;
+}
+
+inline int Unpack1(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 8);
+  if (src + nloop > slimit ||
+        dst + 8 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop ; i++) {
+    for (int j = 0; j < 8; j++)
+      dst[j] = (src[0] >> (7 - j)) & 0x01;
+
+    src += 1;
+    dst += 8;
+  }
+
+  return nloop;
+}
+
+inline int Unpack2(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 4);
+  if (src + nloop > slimit ||
+        dst + 4 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    for (int j = 0; j < 4; j++)
+      dst[j] = (src[0] >> (6 - 2 * j)) & 0x03;
+
+    src += 1;
+    dst += 4;
+  }
+
+  return nloop;
+}
+
+inline int Unpack3(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 8);
+  if (src + 3 * nloop > slimit ||
+        dst + 8 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    dst[0] = (src[0] >> 5) & 0x07;
+    dst[1] = (src[0] >> 2) & 0x07;
+    dst[2] = (src[0] << 1) & 0x07;
+    /*
+     * A '0x01' mask must be needed because
+     * of arithmetic shifts for singed
+     * types, or *src, in gcc and other
+     * typical compilers.
+     */
+    dst[2] |= (src[1] >> 7) & 0x01;
+    dst[3] = (src[1] >> 4) & 0x07;
+    dst[4] = (src[1] >> 1) & 0x07;
+    dst[5] = (src[1] << 2) & 0x07;
+    dst[5] |= (src[2] >> 6) & 0x03;
+    dst[6] = (src[2] >> 3) & 0x07;
+    dst[7] = src[2] & 0x07;
+
+    src += 3;
+    dst += 8;
+  }
+
+  return VP32_DIV_ROUNDUP(3 * n, 8);
+}
+
+inline int Unpack4(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 2);
+  if (src + nloop > slimit ||
+        dst + 2 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    for (int j = 0; j < 2; j++)
+      dst[j] = (src[0] >> (4 - 4 * j)) & 0x0f;
+
+    src += 1;
+    dst += 2;
+  }
+
+  return nloop;
+}
+
+inline int Unpack5(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 8);
+  if (src + 5 * nloop > slimit ||
+        dst + 8 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    dst[0] = (src[0] >> 3) & 0x1f;
+    dst[1] = (src[0] << 2) & 0x1f;
+    dst[1] |= (src[1] >> 6) & 0x03;
+    dst[2] = (src[1] >> 1) & 0x1f;
+    dst[3] = (src[1] << 4) & 0x1f;
+    dst[3] |= (src[2] >> 4) & 0x0f;
+    dst[4] = (src[2] << 1) & 0x1f;
+    dst[4] |= (src[3] >> 7) & 0x01;
+    dst[5] = (src[3] >> 2) & 0x1f;
+    dst[6] = (src[3] << 3) & 0x1f;
+    dst[6] |= (src[4] >> 5) & 0x07;
+    dst[7] = src[4] & 0x1f;
+
+    src += 5;
+    dst += 8;
+  }
+
+  return VP32_DIV_ROUNDUP(5 * n, 8);
+}
+
+inline int Unpack6(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 4);
+  if (src + 3 * nloop > slimit ||
+        dst + 4 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    dst[0] = (src[0] >> 2) & 0x3f;
+    dst[1] = (src[0] << 4) & 0x3f;
+    dst[1] |= (src[1] >> 4) & 0x0f;
+    dst[2] = (src[1] << 2) & 0x3f;
+    dst[2] |= (src[2] >> 6) & 0x03;
+    dst[3] = src[2] & 0x3f;
+
+    src += 3;
+    dst += 4;
+  }
+
+  return VP32_DIV_ROUNDUP(3 * n, 4);
+}
+
+inline int Unpack7(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 8);
+  if (src + 7 * nloop > slimit ||
+        dst + 8 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    dst[0] = (src[0] >> 1) & 0x7f;
+    dst[1] = (src[0] << 6) & 0x7f;
+    dst[1] |= (src[1] >> 2) & 0x3f;
+    dst[2] = (src[1] << 5) & 0x7f;
+    dst[2] |= (src[2] >> 3) & 0x1f;
+    dst[3] = (src[2] << 4) & 0x7f;
+    dst[3] |= (src[3] >> 4) & 0x0f;
+    dst[4] = (src[3] << 3) & 0x7f;
+    dst[4] |= (src[4] >> 5) & 0x07;
+    dst[5] = (src[4] << 2) & 0x7f;
+    dst[5] |= (src[5] >> 6) & 0x03;
+    dst[6] = (src[5] << 1) & 0x7f;
+    dst[6] |= (src[6] >> 7) & 0x01;
+    dst[7] = src[6] & 0x7f;
+
+    src += 7;
+    dst += 8;
+  }
+
+  return VP32_DIV_ROUNDUP(7 * n, 8);
+}
+
+inline int Unpack8(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  if (src + n > slimit || dst + n > dlimit)
+    return -1;
+
+  for (int i = 0; i < n; i++) {
+    dst[0] = src[0] & 0xff;
+
+    src += 1;
+    dst += 1;
+  }
+
+  return n;
+}
+
+inline int Unpack9(const char *restrict src,
+                   const char *restrict slimit,
+                   uint32_t *restrict dst,
+                   const uint32_t *restrict dlimit,
+                   int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 16);
+  if (src + 18 * nloop > slimit ||
+        dst + 16 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    /*
+     * At first, Merge a input sequence
+     * into 2-byte chunks.
+     */
+    uint16_t v[9];
+
+    for (int j = 0; j < 9; j++) {
+      v[j] = DecodeUint16(src);
+      src += 2;
+    }
+
+    /* Then, scatter into a output */
+    dst[0] = (v[0] >> 7) & 0x01ff;
+    dst[1] = (v[0] << 2) & 0x01ff;
+    dst[1] |= v[1] >> 14;
+    dst[2] = (v[1] >> 5) & 0x01ff;
+    dst[3] = (v[1] << 4) & 0x01ff;
+    dst[3] |= v[2] >> 12;
+    dst[4] = (v[2] >> 3) & 0x01ff;
+    dst[5] = (v[2] << 6) & 0x01ff;
+    dst[5] |= v[3] >> 10;
+    dst[6] = (v[3] >> 1) & 0x01ff;
+    dst[7] = (v[3] << 8) & 0x01ff;
+    dst[7] |= v[4] >> 8;
+    dst[8] = (v[4] << 1) & 0x01ff;
+    dst[8] |= v[5] >> 15;
+    dst[9] = (v[5] >> 6) & 0x01ff;
+    dst[10] = (v[5] << 3) & 0x01ff;
+    dst[10] |= v[6] >> 13;
+    dst[11] = (v[6] >> 4) & 0x01ff;
+    dst[12] = (v[6] << 5) & 0x01ff;
+    dst[12] |= v[7] >> 11;
+    dst[13] = (v[7] >> 2) & 0x01ff;
+    dst[14] = (v[7] << 7) & 0x01ff;
+    dst[14] |= v[8] >> 9;
+    dst[15] = v[8] & 0x01ff;
+
+    dst += 16;
+  }
+
+  return VP32_DIV_ROUNDUP(9 * n, 8);
+}
+
+inline int Unpack10(const char *restrict src,
+                    const char *restrict slimit,
+                    uint32_t *restrict dst,
+                    const uint32_t *restrict dlimit,
+                    int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 8);
+  if (src + 10 * nloop > slimit ||
+        dst + 8 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    uint16_t v[5];
+
+    for (int j = 0; j < 5; j++) {
+      v[j] = DecodeUint16(src);
+      src += 2;
+    }
+
+    /* Then, scatter into a output */
+    dst[0] = (v[0] >> 6) & 0x03ff;
+    dst[1] = (v[0] << 4) & 0x03ff;
+    dst[1] |= v[1] >> 12;
+    dst[2] = (v[1] >> 2) & 0x03ff;
+    dst[3] = (v[1] << 8) & 0x03ff;
+    dst[3] |= v[2] >> 8;
+    dst[4] = (v[2] << 2) & 0x03ff;
+    dst[4] |= v[3] >> 14;
+    dst[5] = (v[3] >> 4) & 0x03ff;
+    dst[6] = (v[3] << 6) & 0x03ff;
+    dst[6] |= v[4] >> 10;
+    dst[7] = v[4] & 0x03ff;
+
+    dst += 8;
+  }
+
+  return VP32_DIV_ROUNDUP(5 * n, 4);
+}
+
+inline int Unpack11(const char *restrict src,
+                    const char *restrict slimit,
+                    uint32_t *restrict dst,
+                    const uint32_t *restrict dlimit,
+                    int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 16);
+  if (src + 22 * nloop > slimit ||
+        dst + 16 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    uint16_t v[11];
+
+    for (int j = 0; j < 11; j++) {
+      v[j] = DecodeUint16(src);
+      src += 2;
+    }
+
+    /* Then, scatter into a output */
+    dst[0] = (v[0] >> 5) & 0x07ff;
+    dst[1] = (v[0] << 6) & 0x07ff;
+    dst[1] |= v[1] >> 10;
+    dst[2] = (v[1] << 1) & 0x07ff;
+    dst[2] |= v[2] >> 15;
+    dst[3] = (v[2] >> 4) & 0x07ff;
+    dst[4] = (v[2] << 7) & 0x07ff;
+    dst[4] |= v[3] >> 9;
+    dst[5] = (v[3] << 2) & 0x07ff;
+    dst[5] |= v[4] >> 14;
+    dst[6] = (v[4] >> 3) & 0x07ff;
+    dst[7] = (v[4] << 8) & 0x07ff;
+    dst[7] |= v[5] >> 8;
+    dst[8] = (v[5] << 3) & 0x07ff;
+    dst[8] |= v[6] >> 13;
+    dst[9] = (v[6] >> 2) & 0x07ff;
+    dst[10] = (v[6] << 9) & 0x07ff;
+    dst[10] |= v[7] >> 7;
+    dst[11] = (v[7] << 4) & 0x07ff;
+    dst[11] |= v[8] >> 12;
+    dst[12] = (v[8] >> 1) & 0x07ff;
+    dst[13] = (v[8] << 10) & 0x07ff;
+    dst[13] |= v[9] >> 6;
+    dst[14] = (v[9] << 5) & 0x07ff;
+    dst[14] |= v[10] >> 11;
+    dst[15] = v[10] & 0x07ff;
+
+    dst += 16;
+  }
+
+  return VP32_DIV_ROUNDUP(11 * n, 8);
+}
+
+inline int Unpack12(const char *restrict src,
+                    const char *restrict slimit,
+                    uint32_t *restrict dst,
+                    const uint32_t *restrict dlimit,
+                    int n) {
+  int nloop = VP32_DIV_ROUNDUP(n, 4);
+  if (src + 6 * nloop > slimit ||
+        dst + 4 * nloop > dlimit)
+    return -1;
+
+  for (int i = 0; i < nloop; i++) {
+    uint16_t v[3];
+
+    for (int j = 0; j < 3; j++) {
+      v[j] = DecodeUint16(src);
+      src += 2;
+    }
+
+    /* Then, scatter into a output */
+    dst[0] = (v[0] >> 4) & 0x0fff;
+    dst[1] = (v[0] << 8) & 0x0fff;
+    dst[1] |= v[1] >> 8;
+    dst[2] = (v[1] << 4) & 0x0fff;
+    dst[2] |= v[2] >> 12;
+    dst[3] = v[2] & 0x0fff;
+
+    dst += 4;
+  }
+
+  return VP32_DIV_ROUNDUP(3 * n, 2);
+}
+
+inline int Unpack16(const char *restrict src,
+                    const char *restrict slimit,
+                    uint32_t *restrict dst,
+                    const uint32_t *restrict dlimit,
+                    int n) {
+  if (src + 2 * n > slimit || dst + n > dlimit)
+    return -1;
+
+  for (int i = 0; i < n; i++) {
+    dst[0] = DecodeUint16(src);
+
+    src += 2;
+    dst += 1;
+  }
+
+  return 2 * n;
+}
+
+inline int Unpack32(const char *restrict src,
+                    const char *restrict slimit,
+                    uint32_t *restrict dst,
+                    const uint32_t *restrict dlimit,
+                    int n) {
+  if (src + 4 * n > slimit || dst + n > dlimit)
+    return -1;
+
+  for (int i = 0; i < n; i++) {
+    dst[0] = DecodeUint32(src);
+
+    src += 4;
+    dst += 1;
+  }
+
+  return 4 * n;
+}
+
+/*
+ * A functional pointer type for the unpackers
+ * above, and the ones below have the same
+ * interface.
+ */
+typedef int (*vpack32_t)(
+    const char *restrict src,
+    const char *restrict slimit,
+    uint32_t *restrict dst,
+    const uint32_t *restrict dlimit, int n);
+
+
+/*-------------------------------------------------
+ * A reader for a nbits-bit integer that begins at
+ * the bpos-th bit in *src. It only touches bytes
+ * that cover the integer, so it is used to unpack
+ * trailing integers that SIMD unpackers cannot
+ * load safely.
+ *
+ *  src    : packed bytes
+ *  bpos   : bit position of the integer
+ *  nbits  : # of bits of the integer
+ *  return : unpacked value
+ *-------------------------------------------------
+ */
+inline uint32_t ReadBits(const char *restrict src,
+                         size_t bpos,
+                         int nbits) {
+  VP32_ASSERT(nbits > 0 && nbits <= 32);
+
+  const char *p = src + (bpos >> 3);
+  int nb = (bpos & 0x07) + nbits;
+  int nc = VP32_DIV_ROUNDUP(nb, 8);
+
+  uint64_t v = 0;
+  for (int i = 0; i < nc; i++)
+    v = (v << 8) | (p[i] & 0xff);
+
+  return (v >> (8 * nc - nb)) &
+      ((uint64_t(1) << nbits) - 1);
+}
+
+/*
+ * A functional pointer type for the unchecked
+ * unpackers below; they decode n integers in
+ * groups of 8 without bounds checks, so they might
+ * write up to 7 integers over n in *dst and read
+ * up to 40 bytes over the packed bytes in *src.
+ * UncompressBlock() validates a whole block in
+ * advance and uses them because the overruns
+ * always fall into the trailing raw integers of
+ * the block.
+ */
+typedef void (*vpack32_fast_t)(
+    const char *restrict src,
+    uint32_t *restrict dst, size_t n);
+
+/*
+ * # of groups of 8 integers in n that checked
+ * unpackers can decode with the unchecked ones;
+ * the loads of a group reach up to nload bytes
+ * from the head of the group, and the group heads
+ * are aligned to B bytes.
+ */
+inline int LoadableGroups(const char *src,
+                          const char *slimit,
+                          int n, int B, int nload) {
+  if (slimit - src < nload)
+    return 0;
+
+  ptrdiff_t ng = (slimit - src - nload) / B + 1;
+  return (ng < n / 8)? static_cast<int>(ng) : n / 8;
+}
+
+inline void UnpackFast0(const char *restrict,
+                        uint32_t *restrict dst,
+                        size_t n) {
+  memset(dst, 0x00, n * sizeof(uint32_t));
+}
+
+/* 32-bit partitions in the v2 format */
+inline void UnpackFast32LE(const char *restrict src,
+                           uint32_t *restrict dst,
+                           size_t n) {
+  DecodeUint32s(src, dst, n, format_v2);
+}
+
+
+/*-------------------------------------------------
+ * Portable unpackers that exploit 64-bit registers
+ * as mentioned in the XXX note above. Each group
+ * of 8 integers, or B bytes, is decoded from
+ * unaligned big-endian 64-bit loads; a new word
+ * is loaded only if a next integer does not fit
+ * in the current one, so the loop loads a word
+ * per 8 integers for B <= 7. The integers are
+ * extracted with shifts.
+ *
+ * The interface is the same as the SIMD ones
+ * below, and they only write n integers in *dst.
+ *-------------------------------------------------
+ */
+template <int B, int K, int WPOS>
+struct WordUnpacker {
+  /*
+   * WPOS is the bit position of a current word in
+   * a group, and a next word is loaded if the K-th
+   * integer does not fit in the word. All the
+   * positions are fixed in compile time.
+   */
+  static const bool kLoad = (K * B + B - WPOS > 64);
+  static const int  kWpos = kLoad? ((K * B) & ~0x07) : WPOS;
+
+  static inline void Run(const char *restrict src,
+                         uint32_t *restrict dst,
+                         uint64_t *w) {
+    if (kLoad)
+      *w = DecodeUint64(src + (kWpos >> 3));
+
+    dst[K] = (*w << (K * B - kWpos)) >> (64 - B);
+
+    WordUnpacker<B, K + 1, kWpos>::Run(src, dst, w);
+  }
+};
+
+template <int B, int WPOS>
+struct WordUnpacker<B, 8, WPOS> {
+  static inline void Run(const char *restrict,
+                         uint32_t *restrict,
+                         uint64_t *) {}
+};
+
+template <int B>
+inline void UnpackWordFast(const char *restrict src,
+                           uint32_t *restrict dst,
+                           size_t n) {
+  for (size_t i = 0; i < n; i += 8) {
+    uint64_t w;
+    WordUnpacker<B, 0, -64>::Run(src, dst, &w);
+
+    src += B;
+    dst += 8;
+  }
+}
+
+template <int B>
+inline int UnpackWord(const char *restrict src,
+                      const char *restrict slimit,
+                      uint32_t *restrict dst,
+                      const uint32_t *restrict dlimit,
+                      int n) {
+  int nread = VP32_DIV_ROUNDUP(B * n, 8);
+  if (src + nread > slimit || dst + n > dlimit)
+    return -1;
+
+  /*
+   * The loads in a group do not exceed (B + 8)
+   * bytes from the head of the group.
+   */
+  int i = 8 * LoadableGroups(src, slimit, n, B, B + 8);
+  UnpackWordFast<B>(src, dst, i);
+
+  /* Unpack left integers one by one */
+  src += (i / 8) * B;
+  dst += i;
+
+  for (int j = 0; i < n; i++, j++)
+    dst[j] = ReadBits(src, j * B, B);
+
+  return nread;
+}
+
+
+#ifdef VP32_HAVE_SSE41
+/*-------------------------------------------------
+ * SIMD unpackers with SSE4.1 and AVX2; each
+ * iteration decodes a group of 8 integers, or B
+ * bytes, with two sets of 4 lanes. For the k-th
+ * integer in the group, pshufb gathers the 4 bytes
+ * covering the integer into a 32-bit lane in
+ * big-endian, and leading bits of the lane are
+ * shifted out in a variable way; pmulld is used
+ * for SSE4.1 and vpsllvd for AVX2. Finally, the
+ * lane is shifted right by (32 - B) bits.
+ * NOTE: The approach works if the integer fits in
+ * the 4 bytes, that is, B <= 25 or B == 32.
+ *
+ * The interface is the same as the unpackers
+ * above, except that the functions only write
+ * n integers in *dst.
+ *-------------------------------------------------
+ */
+
+/*
+ * A byte offset of the k-th integer in the s-th
+ * lane set, and the index of the p-th byte in
+ * the 32-bit lane that is loaded from the offset.
+ * The bytes beyond the 16-byte register are
+ * zeroed by 0x80 in pshufb, but they are always
+ * shifted out.
+ */
+#define VP32_SIMD_OFFSET(__b__, __s__)   \
+    ((4 * (__s__) * (__b__)) >> 3)
+
+#define VP32_SIMD_BYTE(__b__, __s__, __k__, __p__)   \
+    ((((4 * (__s__) + (__k__)) * (__b__)) >> 3) -    \
+        VP32_SIMD_OFFSET(__b__, __s__) + 3 - (__p__))
+
+#define VP32_SIMD_INDEX(__b__, __s__, __k__, __p__)  \
+    static_cast<char>(                               \
+        (VP32_SIMD_BYTE(__b__, __s__, __k__, __p__) > 15)? \
+            0x80 : VP32_SIMD_BYTE(__b__, __s__, __k__, __p__))
+
+#define VP32_SIMD_SHIFT(__b__, __s__, __k__)   \
+    (((4 * (__s__) + (__k__)) * (__b__)) & 0x07)
+
+template <int B, int S>
+VP32_TARGET_SSE41 inline __m128i SSEShuffleMask() {
+  return _mm_setr_epi8(
+      VP32_SIMD_INDEX(B, S, 0, 0), VP32_SIMD_INDEX(B, S, 0, 1),
+      VP32_SIMD_INDEX(B, S, 0, 2), VP32_SIMD_INDEX(B, S, 0, 3),
+      VP32_SIMD_INDEX(B, S, 1, 0), VP32_SIMD_INDEX(B, S, 1, 1),
+      VP32_SIMD_INDEX(B, S, 1, 2), VP32_SIMD_INDEX(B, S, 1, 3),
+      VP32_SIMD_INDEX(B, S, 2, 0), VP32_SIMD_INDEX(B, S, 2, 1),
+      VP32_SIMD_INDEX(B, S, 2, 2), VP32_SIMD_INDEX(B, S, 2, 3),
+      VP32_SIMD_INDEX(B, S, 3, 0), VP32_SIMD_INDEX(B, S, 3, 1),
+      VP32_SIMD_INDEX(B, S, 3, 2), VP32_SIMD_INDEX(B, S, 3, 3));
+}
+
+template <int B, int S>
+VP32_TARGET_SSE41 inline __m128i SSEShiftMultiplier() {
+  return _mm_setr_epi32(
+      1 << VP32_SIMD_SHIFT(B, S, 0), 1 << VP32_SIMD_SHIFT(B, S, 1),
+      1 << VP32_SIMD_SHIFT(B, S, 2), 1 << VP32_SIMD_SHIFT(B, S, 3));
+}
+
+template <int B, int S>
+VP32_TARGET_SSE41 inline void UnpackSSELanes(
+    const char *restrict src,
+    uint32_t *restrict dst,
+    __m128i shuf, __m128i mul) {
+  __m128i v = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(
+          src + VP32_SIMD_OFFSET(B, S)));
+
+  v = _mm_shuffle_epi8(v, shuf);
+
+  /* No shift needed if B is a multiple of 8 */
+  if (B & 0x07)
+    v = _mm_mullo_epi32(v, mul);
+
+  v = _mm_srli_epi32(v, 32 - B);
+
+  _mm_storeu_si128(
+      reinterpret_cast<__m128i *>(dst + 4 * S), v);
+}
+
+template <int B>
+VP32_TARGET_SSE41 inline void UnpackSSEFast(
+    const char *restrict src,
+    uint32_t *restrict dst,
+    size_t n) {
+  const __m128i shuf0 = SSEShuffleMask<B, 0>();
+  const __m128i shuf1 = SSEShuffleMask<B, 1>();
+  const __m128i mul0 = SSEShiftMultiplier<B, 0>();
+  const __m128i mul1 = SSEShiftMultiplier<B, 1>();
+
+  for (size_t i = 0; i < n; i += 8) {
+    UnpackSSELanes<B, 0>(src, dst, shuf0, mul0);
+    UnpackSSELanes<B, 1>(src, dst, shuf1, mul1);
+
+    src += B;
+    dst += 8;
+  }
+}
+
+template <int B>
+VP32_TARGET_SSE41 inline int UnpackSSE(
+    const char *restrict src,
+    const char *restrict slimit,
+    uint32_t *restrict dst,
+    const uint32_t *restrict dlimit,
+    int n) {
+  int nread = VP32_DIV_ROUNDUP(B * n, 8);
+  if (src + nread > slimit || dst + n > dlimit)
+    return -1;
+
+  /*
+   * The second lane set loads 16 bytes from
+   * VP32_SIMD_OFFSET(B, 1), so it is checked
+   * if the load does not exceed *slimit.
+   */
+  int i = 8 * LoadableGroups(
+      src, slimit, n, B, VP32_SIMD_OFFSET(B, 1) + 16);
+  UnpackSSEFast<B>(src, dst, i);
+
+  /* Unpack left integers one by one */
+  src += (i / 8) * B;
+  dst += i;
+
+  for (int j = 0; i < n; i++, j++)
+    dst[j] = ReadBits(src, j * B, B);
+
+  return nread;
+}
+
+/*
+ * AVX2 ones load the two lane sets into a 256-bit
+ * register, and decode 8 integers at once.
+ */
+template <int B>
+VP32_TARGET_AVX2 inline __m256i AVX2ShuffleMask() {
+  /* Intrinsics may be macros without optimization */
+  const __m128i lo = SSEShuffleMask<B, 0>();
+  const __m128i hi = SSEShuffleMask<B, 1>();
+
+  return _mm256_inserti128_si256(
+      _mm256_castsi128_si256(lo), hi, 1);
+}
+
+template <int B>
+VP32_TARGET_AVX2 inline __m256i AVX2ShiftCount() {
+  return _mm256_setr_epi32(
+      VP32_SIMD_SHIFT(B, 0, 0), VP32_SIMD_SHIFT(B, 0, 1),
+      VP32_SIMD_SHIFT(B, 0, 2), VP32_SIMD_SHIFT(B, 0, 3),
+      VP32_SIMD_SHIFT(B, 1, 0), VP32_SIMD_SHIFT(B, 1, 1),
+      VP32_SIMD_SHIFT(B, 1, 2), VP32_SIMD_SHIFT(B, 1, 3));
+}
+
+template <int B>
+VP32_TARGET_AVX2 inline void UnpackAVX2Fast(
+    const char *restrict src,
+    uint32_t *restrict dst,
+    size_t n) {
+  const __m256i shuf = AVX2ShuffleMask<B>();
+  const __m256i shift = AVX2ShiftCount<B>();
+
+  for (size_t i = 0; i < n; i += 8) {
+    __m256i v = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(src))),
+        _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(
+                src + VP32_SIMD_OFFSET(B, 1))), 1);
+
+    v = _mm256_shuffle_epi8(v, shuf);
+
+    if (B & 0x07)
+      v = _mm256_sllv_epi32(v, shift);
+
+    v = _mm256_srli_epi32(v, 32 - B);
+
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(dst), v);
+
+    src += B;
+    dst += 8;
+  }
+}
+
+template <int B>
+VP32_TARGET_AVX2 inline int UnpackAVX2(
+    const char *restrict src,
+    const char *restrict slimit,
+    uint32_t *restrict dst,
+    const uint32_t *restrict dlimit,
+    int n) {
+  int nread = VP32_DIV_ROUNDUP(B * n, 8);
+  if (src + nread > slimit || dst + n > dlimit)
+    return -1;
+
+  int i = 8 * LoadableGroups(
+      src, slimit, n, B, VP32_SIMD_OFFSET(B, 1) + 16);
+  UnpackAVX2Fast<B>(src, dst, i);
+
+  /* Unpack left integers one by one */
+  src += (i / 8) * B;
+  dst += i;
+
+  for (int j = 0; i < n; i++, j++)
+    dst[j] = ReadBits(src, j * B, B);
+
+  return nread;
+}
+
+#undef VP32_SIMD_SHIFT
+#undef VP32_SIMD_INDEX
+#undef VP32_SIMD_BYTE
+#undef VP32_SIMD_OFFSET
+#endif /* VP32_HAVE_SSE41 */
+
+/*
+ * A table of the hand-written unpackers above,
+ * which is indexed by lower 4-bits in a control
+ * byte.
+ */
+static const vpack32_t scalar_unpackers[15] = {
+  Unpack0, Unpack1, Unpack2, Unpack3,
+  Unpack4, Unpack5, Unpack6, Unpack7,
+  Unpack8, Unpack9, Unpack10, Unpack11,
+  Unpack12, Unpack16, Unpack32
+};
+
+/*
+ * Tables of the unpackers generated from the
+ * templates above, which are indexed by an
+ * actual bit length. SIMD ones fall back to
+ * UnpackWord() for 26 to 31 bits because the
+ * integers do not fit in 32-bit lanes.
+ */
+static const vpack32_t word_unpackers[33] = {
+  Unpack0, UnpackWord<1>, UnpackWord<2>, UnpackWord<3>,
+  UnpackWord<4>, UnpackWord<5>, UnpackWord<6>, UnpackWord<7>,
+  UnpackWord<8>, UnpackWord<9>, UnpackWord<10>, UnpackWord<11>,
+  UnpackWord<12>, UnpackWord<13>, UnpackWord<14>, UnpackWord<15>,
+  UnpackWord<16>, UnpackWord<17>, UnpackWord<18>, UnpackWord<19>,
+  UnpackWord<20>, UnpackWord<21>, UnpackWord<22>, UnpackWord<23>,
+  UnpackWord<24>, UnpackWord<25>, UnpackWord<26>, UnpackWord<27>,
+  UnpackWord<28>, UnpackWord<29>, UnpackWord<30>, UnpackWord<31>,
+  UnpackWord<32>
+};
+
+#ifdef VP32_HAVE_SSE41
+static const vpack32_t sse41_unpackers[33] = {
+  Unpack0, UnpackSSE<1>, UnpackSSE<2>, UnpackSSE<3>,
+  UnpackSSE<4>, UnpackSSE<5>, UnpackSSE<6>, UnpackSSE<7>,
+  UnpackSSE<8>, UnpackSSE<9>, UnpackSSE<10>, UnpackSSE<11>,
+  UnpackSSE<12>, UnpackSSE<13>, UnpackSSE<14>, UnpackSSE<15>,
+  UnpackSSE<16>, UnpackSSE<17>, UnpackSSE<18>, UnpackSSE<19>,
+  UnpackSSE<20>, UnpackSSE<21>, UnpackSSE<22>, UnpackSSE<23>,
+  UnpackSSE<24>, UnpackSSE<25>, UnpackWord<26>, UnpackWord<27>,
+  UnpackWord<28>, UnpackWord<29>, UnpackWord<30>, UnpackWord<31>,
+  UnpackSSE<32>
+};
+#endif
+
+#ifdef VP32_HAVE_AVX2
+static const vpack32_t avx2_unpackers[33] = {
+  Unpack0, UnpackAVX2<1>, UnpackAVX2<2>, UnpackAVX2<3>,
+  UnpackAVX2<4>, UnpackAVX2<5>, UnpackAVX2<6>, UnpackAVX2<7>,
+  UnpackAVX2<8>, UnpackAVX2<9>, UnpackAVX2<10>, UnpackAVX2<11>,
+  UnpackAVX2<12>, UnpackAVX2<13>, UnpackAVX2<14>, UnpackAVX2<15>,
+  UnpackAVX2<16>, UnpackAVX2<17>, UnpackAVX2<18>, UnpackAVX2<19>,
+  UnpackAVX2<20>, UnpackAVX2<21>, UnpackAVX2<22>, UnpackAVX2<23>,
+  UnpackAVX2<24>, UnpackAVX2<25>, UnpackWord<26>, UnpackWord<27>,
+  UnpackWord<28>, UnpackWord<29>, UnpackWord<30>, UnpackWord<31>,
+  UnpackAVX2<32>
+};
+#endif
+
+/*
+ * Tables of the unchecked unpackers, which are
+ * indexed in the same way as the above.
+ */
+static const vpack32_fast_t word_fast_unpackers[33] = {
+  UnpackFast0, UnpackWordFast<1>, UnpackWordFast<2>,
+  UnpackWordFast<3>, UnpackWordFast<4>, UnpackWordFast<5>,
+  UnpackWordFast<6>, UnpackWordFast<7>, UnpackWordFast<8>,
+  UnpackWordFast<9>, UnpackWordFast<10>, UnpackWordFast<11>,
+  UnpackWordFast<12>, UnpackWordFast<13>, UnpackWordFast<14>,
+  UnpackWordFast<15>, UnpackWordFast<16>, UnpackWordFast<17>,
+  UnpackWordFast<18>, UnpackWordFast<19>, UnpackWordFast<20>,
+  UnpackWordFast<21>, UnpackWordFast<22>, UnpackWordFast<23>,
+  UnpackWordFast<24>, UnpackWordFast<25>, UnpackWordFast<26>,
+  UnpackWordFast<27>, UnpackWordFast<28>, UnpackWordFast<29>,
+  UnpackWordFast<30>, UnpackWordFast<31>, UnpackWordFast<32>
+};
+
+#ifdef VP32_HAVE_SSE41
+static const vpack32_fast_t sse41_fast_unpackers[33] = {
+  UnpackFast0, UnpackSSEFast<1>, UnpackSSEFast<2>,
+  UnpackSSEFast<3>, UnpackSSEFast<4>, UnpackSSEFast<5>,
+  UnpackSSEFast<6>, UnpackSSEFast<7>, UnpackSSEFast<8>,
+  UnpackSSEFast<9>, UnpackSSEFast<10>, UnpackSSEFast<11>,
+  UnpackSSEFast<12>, UnpackSSEFast<13>, UnpackSSEFast<14>,
+  UnpackSSEFast<15>, UnpackSSEFast<16>, UnpackSSEFast<17>,
+  UnpackSSEFast<18>, UnpackSSEFast<19>, UnpackSSEFast<20>,
+  UnpackSSEFast<21>, UnpackSSEFast<22>, UnpackSSEFast<23>,
+  UnpackSSEFast<24>, UnpackSSEFast<25>, UnpackWordFast<26>,
+  UnpackWordFast<27>, UnpackWordFast<28>, UnpackWordFast<29>,
+  UnpackWordFast<30>, UnpackWordFast<31>, UnpackSSEFast<32>
+};
+#endif
+
+#ifdef VP32_HAVE_AVX2
+static const vpack32_fast_t avx2_fast_unpackers[33] = {
+  UnpackFast0, UnpackAVX2Fast<1>, UnpackAVX2Fast<2>,
+  UnpackAVX2Fast<3>, UnpackAVX2Fast<4>, UnpackAVX2Fast<5>,
+  UnpackAVX2Fast<6>, UnpackAVX2Fast<7>, UnpackAVX2Fast<8>,
+  UnpackAVX2Fast<9>, UnpackAVX2Fast<10>, UnpackAVX2Fast<11>,
+  UnpackAVX2Fast<12>, UnpackAVX2Fast<13>, UnpackAVX2Fast<14>,
+  UnpackAVX2Fast<15>, UnpackAVX2Fast<16>, UnpackAVX2Fast<17>,
+  UnpackAVX2Fast<18>, UnpackAVX2Fast<19>, UnpackAVX2Fast<20>,
+  UnpackAVX2Fast<21>, UnpackAVX2Fast<22>, UnpackAVX2Fast<23>,
+  UnpackAVX2Fast<24>, UnpackAVX2Fast<25>, UnpackWordFast<26>,
+  UnpackWordFast<27>, UnpackWordFast<28>, UnpackWordFast<29>,
+  UnpackWordFast<30>, UnpackWordFast<31>, UnpackAVX2Fast<32>
+};
+#endif
+
+/*-------------------------------------------------
+ * A function selects the fastest unpackers that
+ * a running processor supports. The result does
+ * not change in a process, so a caller is assumed
+ * to call it once and keep the table.
+ *
+ *  return : a table of unpackers
+ *-------------------------------------------------
+ */
+inline const vpack32_t *SelectUnpackers() {
+#ifdef VP32_HAVE_SSE41
+  __builtin_cpu_init();
+#endif
+
+#ifdef VP32_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return avx2_unpackers;
+#endif
+
+#ifdef VP32_HAVE_SSE41
+  if (__builtin_cpu_supports("sse4.1"))
+    return sse41_unpackers;
+#endif
+
+  return word_unpackers;
+}
+
+inline const vpack32_fast_t *SelectFastUnpackers() {
+#ifdef VP32_HAVE_SSE41
+  __builtin_cpu_init();
+#endif
+
+#ifdef VP32_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return avx2_fast_unpackers;
+#endif
+
+#ifdef VP32_HAVE_SSE41
+  if (__builtin_cpu_supports("sse4.1"))
+    return sse41_fast_unpackers;
+#endif
+
+  return word_fast_unpackers;
+}
+
+/*-------------------------------------------------
+ * Functions restore integers in a delta block
+ * from their gaps in place. They run on every
+ * 256 or more integers unpacked, so the integers
+ * are still in L1 cache and no extra pass over
+ * *dst is needed. SIMD ones sum the lanes of a register
+ * by log2(# of lanes) shifts and adds, and add
+ * a running base broadcasted to all the lanes.
+ *
+ *  v      : gaps to restore in place
+ *  n      : # of the gaps
+ *  base   : an integer just before v[0]
+ *  return : the last restored integer
+ *-------------------------------------------------
+ */
+typedef uint32_t (*vprefix32_t)(uint32_t *restrict v,
+                                size_t n, uint32_t base);
+
+inline uint32_t PrefixSum(uint32_t *restrict v,
+                          size_t n, uint32_t base) {
+  for (size_t i = 0; i < n; i++)
+    v[i] = base += v[i];
+
+  return base;
+}
+
+#ifdef VP32_HAVE_SSE41
+VP32_TARGET_SSE41 inline uint32_t PrefixSumSSE(
+    uint32_t *restrict v, size_t n, uint32_t base) {
+  __m128i b = _mm_set1_epi32(base);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(v + i));
+
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, b);
+
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(v + i), x);
+
+    b = _mm_shuffle_epi32(x, 0xff);
+  }
+
+  return PrefixSum(v + i, n - i,
+                   static_cast<uint32_t>(_mm_cvtsi128_si32(b)));
+}
+
+/* The upper 4 lanes get the sum of lower ones */
+VP32_TARGET_AVX2 inline uint32_t PrefixSumAVX2(
+    uint32_t *restrict v, size_t n, uint32_t base) {
+  const __m256i last = _mm256_set1_epi32(7);
+  const __m256i mid = _mm256_setr_epi32(0, 0, 0, 0, 3, 3, 3, 3);
+
+  __m256i b = _mm256_set1_epi32(base);
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(v + i));
+
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+    x = _mm256_add_epi32(x, _mm256_blend_epi32(
+        _mm256_setzero_si256(),
+        _mm256_permutevar8x32_epi32(x, mid), 0xf0));
+    x = _mm256_add_epi32(x, b);
+
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(v + i), x);
+
+    b = _mm256_permutevar8x32_epi32(x, last);
+  }
+
+  return PrefixSumSSE(v + i, n - i,
+                      static_cast<uint32_t>(_mm256_extract_epi32(b, 0)));
+}
+#endif /* VP32_HAVE_SSE41 */
+
+inline vprefix32_t SelectPrefixSum() {
+#ifdef VP32_HAVE_SSE41
+  __builtin_cpu_init();
+#endif
+
+#ifdef VP32_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return PrefixSumAVX2;
+#endif
+
+#ifdef VP32_HAVE_SSE41
+  if (__builtin_cpu_supports("sse4.1"))
+    return PrefixSumSSE;
+#endif
+
+  return PrefixSum;
+}
+
+/*-------------------------------------------------
+ * Functions for zigzag encoding; 0, -1, 1, -2, ...
+ * are mapped to 0, 1, 2, 3, ... ZigzagDecode()
+ * and the SIMD ones below restore integers in
+ * place in the same way as PrefixSum().
+ *-------------------------------------------------
+ */
+typedef void (*vzigzag32_t)(uint32_t *restrict v, size_t n);
+
+inline uint32_t ZigzagEncode(uint32_t v) {
+  return (v << 1) ^ (0U - (v >> 31));
+}
+
+inline void ZigzagDecode(uint32_t *restrict v, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    v[i] = (v[i] >> 1) ^ (0U - (v[i] & 0x01));
+}
+
+#ifdef VP32_HAVE_SSE41
+VP32_TARGET_SSE41 inline void ZigzagDecodeSSE(
+    uint32_t *restrict v, size_t n) {
+  const __m128i one = _mm_set1_epi32(1);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(v + i));
+
+    x = _mm_xor_si128(_mm_srli_epi32(x, 1),
+        _mm_sub_epi32(_mm_setzero_si128(),
+                      _mm_and_si128(x, one)));
+
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(v + i), x);
+  }
+
+  ZigzagDecode(v + i, n - i);
+}
+
+VP32_TARGET_AVX2 inline void ZigzagDecodeAVX2(
+    uint32_t *restrict v, size_t n) {
+  const __m256i one = _mm256_set1_epi32(1);
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(v + i));
+
+    x = _mm256_xor_si256(_mm256_srli_epi32(x, 1),
+        _mm256_sub_epi32(_mm256_setzero_si256(),
+                         _mm256_and_si256(x, one)));
+
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(v + i), x);
+  }
+
+  ZigzagDecodeSSE(v + i, n - i);
+}
+#endif /* VP32_HAVE_SSE41 */
+
+inline vzigzag32_t SelectZigzagDecode() {
+#ifdef VP32_HAVE_SSE41
+  __builtin_cpu_init();
+#endif
+
+#ifdef VP32_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return ZigzagDecodeAVX2;
+#endif
+
+#ifdef VP32_HAVE_SSE41
+  if (__builtin_cpu_supports("sse4.1"))
+    return ZigzagDecodeSSE;
+#endif
+
+  return ZigzagDecode;
+}
+
+/*-------------------------------------------------
+ * Functions add a base to integers unpacked from
+ * an ext_for partition in place.
+ *
+ *  v      : integers to add the base to
+ *  n      : # of the integers
+ *  base   : a base of the partition
+ *-------------------------------------------------
+ */
+typedef void (*vaddbase32_t)(uint32_t *restrict v,
+                             size_t n, uint32_t base);
+
+inline void AddBase(uint32_t *restrict v,
+                    size_t n, uint32_t base) {
+  for (size_t i = 0; i < n; i++)
+    v[i] += base;
+}
+
+#ifdef VP32_HAVE_SSE41
+VP32_TARGET_SSE41 inline void AddBaseSSE(
+    uint32_t *restrict v, size_t n, uint32_t base) {
+  const __m128i b = _mm_set1_epi32(base);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(v + i));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(v + i),
+                     _mm_add_epi32(x, b));
+  }
+
+  AddBase(v + i, n - i, base);
+}
+
+VP32_TARGET_AVX2 inline void AddBaseAVX2(
+    uint32_t *restrict v, size_t n, uint32_t base) {
+  const __m256i b = _mm256_set1_epi32(base);
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(v + i));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(v + i),
+                        _mm256_add_epi32(x, b));
+  }
+
+  AddBaseSSE(v + i, n - i, base);
+}
+#endif /* VP32_HAVE_SSE41 */
+
+inline vaddbase32_t SelectAddBase() {
+#ifdef VP32_HAVE_SSE41
+  __builtin_cpu_init();
+#endif
+
+#ifdef VP32_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return AddBaseAVX2;
+#endif
+
+#ifdef VP32_HAVE_SSE41
+  if (__builtin_cpu_supports("sse4.1"))
+    return AddBaseSSE;
+#endif
+
+  return AddBase;
+}
+
+/*-------------------------------------------------
+ * Functions replace indices unpacked from
+ * a block_dict block with dictionary entries in
+ * place. The indices are masked, so broken ones
+ * never read over dict_max entries. AVX2 gathers
+ * 8 entries at once, and no gather is in SSE.
+ *
+ *  v      : indices to replace in place
+ *  n      : # of the indices
+ *  dict   : dict_max entries, padded with 0
+ *-------------------------------------------------
+ */
+typedef void (*vlookup32_t)(uint32_t *restrict v,
+                            size_t n,
+                            const uint32_t *restrict dict);
+
+inline void Lookup(uint32_t *restrict v, size_t n,
+                   const uint32_t *restrict dict) {
+  for (size_t i = 0; i < n; i++)
+    v[i] = dict[v[i] & (dict_max - 1)];
+}
+
+#ifdef VP32_HAVE_SSE41
+VP32_TARGET_AVX2 inline void LookupAVX2(
+    uint32_t *restrict v, size_t n,
+    const uint32_t *restrict dict) {
+  const __m256i mask = _mm256_set1_epi32(dict_max - 1);
+  const int *d = reinterpret_cast<const int *>(dict);
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(v + i));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(v + i),
+        _mm256_i32gather_epi32(
+            d, _mm256_and_si256(x, mask), 4));
+  }
+
+  Lookup(v + i, n - i, dict);
+}
+#endif /* VP32_HAVE_SSE41 */
+
+inline vlookup32_t SelectLookup() {
+#ifdef VP32_HAVE_AVX2
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return LookupAVX2;
+#endif
+
+  return Lookup;
+}
+
+/*-------------------------------------------------
+ * A decode table for control bytes, which maps
+ * each of 256 bytes to # of integers in a
+ * partition, # of packed bytes, and the unchecked
+ * unpacker. The extended control byte, ctrl_ext,
+ * has no unpacker in the table because a bit
+ * length is given by a next byte.
+ *
+ * The unpackers depend on a format version
+ * because 32-bit partitions are little-endian
+ * in v2. Restore() undoes block flags on unpacked
+ * integers, and returns the last one as a next
+ * base for block_delta; dict has entries for
+ * block_dict.
+ *
+ * Partitions with extended control bytes are
+ * unpacked by Unpack() with the byte, and
+ * ExtSize() gives # of their bytes, or -1 if
+ * the byte or a patch list in *src is invalid.
+ * Unpack() returns # of the bytes as well, and
+ * ExtNum() gives # of integers, which differs
+ * from a control byte for ext_run.
+ *-------------------------------------------------
+ */
+struct CtrlEntry {
+  uint32_t        num;
+  uint32_t        nbytes;
+  vpack32_fast_t  unpack;
+};
+
+struct CtrlTable {
+  vpack32_fast_t  unpackers[33];
+  CtrlEntry       entries[256];
+  vprefix32_t     prefix_sum;
+  vzigzag32_t     zigzag_decode;
+  vaddbase32_t    add_base;
+  vlookup32_t     lookup;
+
+  explicit CtrlTable(int version) {
+    memcpy(unpackers, SelectFastUnpackers(),
+           sizeof(unpackers));
+
+    prefix_sum = SelectPrefixSum();
+    zigzag_decode = SelectZigzagDecode();
+    add_base = SelectAddBase();
+    lookup = SelectLookup();
+
+    if (version != format_v1)
+      unpackers[32] = UnpackFast32LE;
+
+    for (int c = 0; c < 256; c++) {
+      CtrlEntry *e = &entries[c];
+
+      e->num = partition_length[c >> 4];
+      e->nbytes = 0;
+      e->unpack = NULL;
+
+      if ((c & 0x0f) != ctrl_ext) {
+        int b = bits_length[c & 0x0f];
+        e->nbytes = VP32_DIV_ROUNDUP(e->num * b, 8);
+        e->unpack = unpackers[b];
+      }
+    }
+  }
+
+  uint32_t Restore(uint32_t flags,
+                   uint32_t *restrict v,
+                   size_t n,
+                   uint32_t base,
+                   const uint32_t *dict) const {
+    if (flags & block_dict)
+      lookup(v, n, dict);
+    if (flags & block_zigzag)
+      zigzag_decode(v, n);
+    if (flags & block_delta)
+      base = prefix_sum(v, n, base);
+
+    return base;
+  }
+
+  static int ExtSize(int c, size_t n,
+                     const char *src,
+                     const char *slimit) {
+    int b = c & ext_bits_mask;
+    if (b > 32)
+      return -1;
+
+    switch (c & ~ext_bits_mask) {
+      case ext_plain:
+        return VP32_DIV_ROUNDUP(n * b, 8);
+      case ext_for:
+        return 4 + VP32_DIV_ROUNDUP(n * b, 8);
+      case ext_patch:
+        return PatchSize(b, n, src, slimit);
+      case ext_run:
+        if (b != 0 || slimit - src < 8 ||
+              DecodeUint32LE(src) == 0 ||
+              DecodeUint32LE(src) > block_num)
+          return -1;
+        return 8;
+    }
+
+    return -1;
+  }
+
+  static size_t ExtNum(const CtrlEntry &e, int c,
+                       const char *src) {
+    if ((c & ~ext_bits_mask) == ext_run)
+      return DecodeUint32LE(src);
+
+    return e.num;
+  }
+
+  /*
+   * Exceptions must be in a partition, and their
+   * positions are strictly increasing.
+   */
+  static int PatchSize(int b, size_t n,
+                       const char *src,
+                       const char *slimit) {
+    if (slimit - src < 2)
+      return -1;
+
+    size_t k = src[0] & 0xff;
+    int hb = src[1] & 0xff;
+
+    if (k == 0 || k > n || hb == 0 || b + hb > 32)
+      return -1;
+
+    size_t lsz = VP32_DIV_ROUNDUP(n * b, 8);
+    size_t sz = 2 + lsz + k +
+        VP32_DIV_ROUNDUP(k * hb, 8);
+
+    if (static_cast<size_t>(slimit - src) < sz)
+      return -1;
+
+    const char *pos = src + 2 + lsz;
+
+    for (size_t i = 0; i < k; i++) {
+      size_t p = pos[i] & 0xff;
+      if (p >= n || (i > 0 && p <= (pos[i - 1] & 0xffU)))
+        return -1;
+    }
+
+    return sz;
+  }
+
+  int Unpack(const CtrlEntry &e, int c,
+             const char *restrict src,
+             uint32_t *restrict dst) const {
+    int b = c & ext_bits_mask;
+
+    if (e.unpack != NULL) {
+      e.unpack(src, dst, e.num);
+      return e.nbytes;
+    }
+
+    switch (c & ~ext_bits_mask) {
+      case ext_for: {
+        unpackers[b](src + 4, dst, e.num);
+        add_base(dst, e.num, DecodeUint32LE(src));
+        return 4 + VP32_DIV_ROUNDUP(e.num * b, 8);
+      }
+      case ext_patch: {
+        size_t  k = src[0] & 0xff;
+        int     hb = src[1] & 0xff;
+        size_t  lsz = VP32_DIV_ROUNDUP(e.num * b, 8);
+
+        unpackers[b](src + 2, dst, e.num);
+
+        /* Upper bits are written by WriteBits() */
+        const char *pos = src + 2 + lsz;
+        uint32_t    highs[128 + 8];
+
+        if (hb == 32)
+          UnpackWordFast<32>(pos + k, highs, k);
+        else
+          unpackers[hb](pos + k, highs, k);
+
+        for (size_t i = 0; i < k; i++)
+          dst[pos[i] & 0xff] |= highs[i] << b;
+
+        return 2 + lsz + k + VP32_DIV_ROUNDUP(k * hb, 8);
+      }
+      case ext_run: {
+        std::fill(dst, dst + DecodeUint32LE(src),
+                  DecodeUint32LE(src + 4));
+        return 8;
+      }
+    }
+
+    unpackers[b](src, dst, e.num);
+    return VP32_DIV_ROUNDUP(e.num * b, 8);
+  }
+};
+
+/*
+ * Tables for each format version are built only
+ * once, and they have the unchecked unpackers for
+ * a running processor.
+ */
+inline const CtrlTable &GetCtrlTable(int version) {
+  static const CtrlTable v1_table(format_v1);
+  static const CtrlTable v2_table(format_v2);
+
+  return (version == format_v1)? v1_table : v2_table;
+}
+
+
+/*-------------------------------------------------
+ * A function builds a dictionary of integers for
+ * block_dict. Distinct integers are collected by
+ * an open-addressing hash table of 2 * dict_max
+ * slots, and it gives up once they are more than
+ * dict_max. The dictionary is used only if the
+ * indices and the entries are smaller than
+ * the integers packed with a frame of reference.
+ *
+ *  src    : integer array in a block
+ *  n      : # of the integers
+ *  dict   : result sorted entries
+ *  ndict  : result # of the entries
+ *  codes  : result indices of src[] in dict[]
+ *  return : false if no dictionary is used
+ *-------------------------------------------------
+ */
+inline bool BuildDict(const uint32_t *src,
+                      size_t n,
+                      uint32_t *dict,
+                      size_t *ndict,
+                      uint32_t *codes) {
+  VP32_ASSERT(src != NULL);
+  VP32_ASSERT(n != 0);
+
+  const uint32_t slot_mask = 2 * dict_max - 1;
+
+  uint32_t  keys[2 * dict_max];
+  int32_t   slots[2 * dict_max];
+  size_t    nd = 0;
+
+  for (size_t i = 0; i <= slot_mask; i++)
+    slots[i] = -1;
+
+  for (size_t i = 0; i < n; i++) {
+    uint32_t h = (src[i] * 0x9e3779b1U) >> 23;
+
+    while (slots[h] >= 0 && keys[h] != src[i])
+      h = (h + 1) & slot_mask;
+
+    if (slots[h] < 0) {
+      if (nd == dict_max)
+        return false;
+
+      keys[h] = src[i];
+      slots[h] = nd;
+      dict[nd++] = src[i];
+    }
+  }
+
+  std::sort(dict, dict + nd);
+
+  /* Bit lengths of indices and ones with a base */
+  uint64_t ib = 32 - VP32_MSB32(nd - 1);
+  uint64_t fb = 32 - VP32_MSB32(dict[nd - 1] - dict[0]);
+
+  if (4 * (nd + 1) > n ||
+        ib * n + 32 * (nd + 1) >= fb * n)
+    return false;
+
+  for (size_t i = 0; i <= slot_mask; i++) {
+    if (slots[i] >= 0)
+      slots[i] = std::lower_bound(
+          dict, dict + nd, keys[i]) - dict;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    uint32_t h = (src[i] * 0x9e3779b1U) >> 23;
+
+    while (keys[h] != src[i])
+      h = (h + 1) & slot_mask;
+
+    codes[i] = slots[h];
+  }
+
+  *ndict = nd;
+  return true;
+}
+
+
+/*-------------------------------------------------
+ * A function chooses block flags for block_auto.
+ * It samples 8 windows of up to 512 integers
+ * over a block, and sums up ChoosePacking() sizes
+ * of 128-integer partitions in the windows for
+ * each transform, that is, the cost that
+ * ComputePartition() uses. A transform is chosen
+ * only if it is estimated smaller than the ones
+ * with less flags.
+ *
+ *  src    : integer array in a block
+ *  n      : # of the integers
+ *  return : block flags for the block
+ *-------------------------------------------------
+ */
+inline uint32_t ChooseBlockFlags(const uint32_t *src,
+                                 size_t n) {
+  VP32_ASSERT(src != NULL);
+  VP32_ASSERT(n >= 128);
+
+  static const uint32_t candidates[] = {
+    0, block_zigzag, block_delta,
+    block_delta | block_zigzag
+  };
+
+  const size_t nwindow = 8;
+  const size_t window = ((n < 512)? n : 512) & ~size_t(127);
+
+  uint64_t  sizes[ARRAYSIZE(candidates)] = {0};
+  uint32_t  buf[128];
+
+  for (size_t w = 0; w < nwindow; w++) {
+    size_t start = (n - window) * w / (nwindow - 1);
+
+    for (size_t p = start; p < start + window; p += 128) {
+      for (size_t k = 0; k < ARRAYSIZE(candidates); k++) {
+        for (size_t i = 0; i < 128; i++) {
+          uint32_t v = src[p + i];
+
+          if (candidates[k] & block_delta)
+            v = (p + i > 0)? v - src[p + i - 1] : 0;
+          if (candidates[k] & block_zigzag)
+            v = ZigzagEncode(v);
+
+          buf[i] = v;
+        }
+
+        Packing pk;
+        ChoosePacking(buf, 128, &pk);
+        sizes[k] += pk.size;
+      }
+    }
+  }
+
+  size_t best = 0;
+
+  for (size_t k = 1; k < ARRAYSIZE(candidates); k++) {
+    if (sizes[k] < sizes[best])
+      best = k;
+  }
+
+  return candidates[best];
+}
+
+
+/*-------------------------------------------------
+ * Following functions are to help the
+ * implementations of Compress() and Uncompress().
+ *
+ * CompressBlock
+ *  src    : integer array to compress
+ *  n      : # of input integers
+ *  dst     : output buffer
+ *  dlimit  : terminal address of *dst
+ *  version : format version of the block
+ *  ws      : working space reserved if needed
+ *  flags   : block flags or block_auto, only for v2
+ *  level   : compression level
+ *  penalty : bytes charged for each partition
+ *  return  : # of written bytes, or 0 if it fails
+ *-------------------------------------------------
+ */
+inline uint32_t CompressBlock(const uint32_t *src,
+                              size_t n,
+                              char *dst,
+                              const char *restrict dlimit,
+                              int version,
+                              Workspace *ws,
+                              uint32_t flags = 0,
+                              int level = level_max,
+                              int penalty = 0) {
+  VP32_ASSERT(src != NULL);
+  VP32_ASSERT(dst != NULL);
+  VP32_ASSERT(n != 0);
+
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  if (max_partition +
+        MAX_UNPACK_OVERRUN_NUM > n) {
+    SetUint32s(dst, src, n, version);
+    return n * 4;
+  }
+
+  /*
+   * Last MAX_UNPACK_OVERRUN_NUM 32-bit integers
+   * are not compressed and just copied to a output
+   * buffer because of the overrun issue during
+   * decompression.
+   */
+  n -= MAX_UNPACK_OVERRUN_NUM;
 
-    dst += 16;
+  if (!ws->Reserve(n))
+    return 0;
+
+  const uint32_t *tail = src + n;
+
+  if (flags & block_auto)
+    flags = ChooseBlockFlags(src, n);
+
+  /*
+   * Low-cardinality integers are replaced with
+   * indices of a dictionary, and the flags for
+   * signed ones are not needed then. A delta
+   * block does not use dictionaries.
+   */
+  uint32_t  dict[dict_max];
+  size_t    ndict = 0;
+
+  if (version != format_v1 &&
+        (flags & block_delta) == 0 &&
+        BuildDict(src, n, dict, &ndict, ws->values())) {
+    flags = block_dict;
+    src = ws->values();
   }
 
-  return VP32_DIV_ROUNDUP(9 * n, 8);
-}
+  uint32_t head = BlockHeaderSize(flags) +
+      ((ndict != 0)? 4 + 4 * ndict : 0);
 
-inline int Unpack10(const char *restrict src,
-                    const char *restrict slimit,
-                    uint32_t *restrict dst,
-                    const uint32_t *restrict dlimit,
-                    int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 8);
-  if (src + 10 * nloop > slimit ||
-        dst + 8 * nloop > dlimit)
-    return -1;
+  if (dst + head > dlimit)
+    return 0;
 
-  for (int i = 0; i < nloop; i++) {
-    uint16_t v[5];
+  for (size_t i = 0; i < ndict; i++)
+    SetUint32LE(dst + BlockHeaderSize(flags) + 4 + 4 * i,
+                dict[i]);
+  if (ndict != 0)
+    SetUint32LE(dst + BlockHeaderSize(flags), ndict);
 
-    for (int j = 0; j < 5; j++) {
-      v[j] = DecodeUint16(src);
-      src += 2;
+  /*
+   * A delta block packs the gaps between adjacent
+   * integers, and the first integer is kept as
+   * a base. The gaps wrap around, so unsorted
+   * integers are also restored correctly. Then,
+   * the integers are zigzag-encoded if needed.
+   */
+  if (flags & (block_delta | block_zigzag)) {
+    uint32_t *values = ws->values();
+
+    if (flags & block_delta) {
+      values[0] = 0;
+      for (size_t i = 1; i < n; i++)
+        values[i] = src[i] - src[i - 1];
+
+      SetUint32LE(dst + 8, src[0]);
+    } else {
+      memcpy(values, src, n * sizeof(uint32_t));
     }
 
-    /* Then, scatter into a output */
-    dst[0] = (v[0] >> 6) & 0x03ff;
-    dst[1] = (v[0] << 4) & 0x03ff;
-    dst[1] |= v[1] >> 12;
-    dst[2] = (v[1] >> 2) & 0x03ff;
-    dst[3] = (v[1] << 8) & 0x03ff;
-    dst[3] |= v[2] >> 8;
-    dst[4] = (v[2] << 2) & 0x03ff;
-    dst[4] |= v[3] >> 14;
-    dst[5] = (v[3] >> 4) & 0x03ff;
-    dst[6] = (v[3] << 6) & 0x03ff;
-    dst[6] |= v[4] >> 10;
-    dst[7] = v[4] & 0x03ff;
+    if (flags & block_zigzag) {
+      for (size_t i = 0; i < n; i++)
+        values[i] = ZigzagEncode(values[i]);
+    }
 
-    dst += 8;
+    src = values;
   }
 
-  return VP32_DIV_ROUNDUP(5 * n, 4);
-}
+  /*
+   * Bit lengths are computed once for the
+   * partitioning and the packings below.
+   */
+  static const vwidths32_t bit_widths = SelectBitWidths();
 
-inline int Unpack11(const char *restrict src,
-                    const char *restrict slimit,
-                    uint32_t *restrict dst,
-                    const uint32_t *restrict dlimit,
-                    int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 16);
-  if (src + 22 * nloop > slimit ||
-        dst + 16 * nloop > dlimit)
-    return -1;
+  const uint8_t *widths = ws->widths();
+  bit_widths(src, n, ws->widths());
 
-  for (int i = 0; i < nloop; i++) {
-    uint16_t v[11];
+  size_t *parts = ws->parts();
 
-    for (int j = 0; j < 11; j++) {
-      v[j] = DecodeUint16(src);
-      src += 2;
-    }
+  int np = (level < level_max)?
+      ComputeFastPartition(src, n, parts, *ws, penalty) :
+      ComputePartition(src, n, parts, *ws, penalty);
 
-    /* Then, scatter into a output */
-    dst[0] = (v[0] >> 5) & 0x07ff;
-    dst[1] = (v[0] << 6) & 0x07ff;
-    dst[1] |= v[1] >> 10;
-    dst[2] = (v[1] << 1) & 0x07ff;
-    dst[2] |= v[2] >> 15;
-    dst[3] = (v[2] >> 4) & 0x07ff;
-    dst[4] = (v[2] << 7) & 0x07ff;
-    dst[4] |= v[3] >> 9;
-    dst[5] = (v[3] << 2) & 0x07ff;
-    dst[5] |= v[4] >> 14;
-    dst[6] = (v[4] >> 3) & 0x07ff;
-    dst[7] = (v[4] << 8) & 0x07ff;
-    dst[7] |= v[5] >> 8;
-    dst[8] = (v[5] << 3) & 0x07ff;
-    dst[8] |= v[6] >> 13;
-    dst[9] = (v[6] >> 2) & 0x07ff;
-    dst[10] = (v[6] << 9) & 0x07ff;
-    dst[10] |= v[7] >> 7;
-    dst[11] = (v[7] << 4) & 0x07ff;
-    dst[11] |= v[8] >> 12;
-    dst[12] = (v[8] >> 1) & 0x07ff;
-    dst[13] = (v[8] << 10) & 0x07ff;
-    dst[13] |= v[9] >> 6;
-    dst[14] = (v[9] << 5) & 0x07ff;
-    dst[14] |= v[10] >> 11;
-    dst[15] = v[10] & 0x07ff;
+  /*
+   * Choose packings and count control bytes in
+   * advance because extended ones may follow.
+   */
+  Packing  *packs = ws->packs();
+  uint32_t offset = np + head;
 
-    dst += 16;
+  for (int i = 0; i < np; i++) {
+    Packing &p = packs[i];
+    ChoosePacking(src + parts[i], widths + parts[i],
+                  parts[i + 1] - parts[i], &p);
+    if (p.kind != ext_plain ||
+          ctrl_bit[p.nbits] == char(0xff))
+      offset++;
   }
 
-  return VP32_DIV_ROUNDUP(11 * n, 8);
-}
+  char *ctrl = dst + head;
+  char *data = dst + offset;
 
-inline int Unpack12(const char *restrict src,
-                    const char *restrict slimit,
-                    uint32_t *restrict dst,
-                    const uint32_t *restrict dlimit,
-                    int n) {
-  int nloop = VP32_DIV_ROUNDUP(n, 4);
-  if (src + 6 * nloop > slimit ||
-        dst + 4 * nloop > dlimit)
-    return -1;
+  /* Do compressing */
+  uint32_t block_size = offset;
 
-  for (int i = 0; i < nloop; i++) {
-    uint16_t v[3];
+  for (int i = 0; i < np; i++) {
+    size_t plen =
+        parts[i + 1] - parts[i];
 
-    for (int j = 0; j < 3; j++) {
-      v[j] = DecodeUint16(src);
-      src += 2;
-    }
+    const Packing &p = packs[i];
 
-    /* Then, scatter into a output */
-    dst[0] = (v[0] >> 4) & 0x0fff;
-    dst[1] = (v[0] << 8) & 0x0fff;
-    dst[1] |= v[1] >> 8;
-    dst[2] = (v[1] << 4) & 0x0fff;
-    dst[2] |= v[2] >> 12;
-    dst[3] = v[2] & 0x0fff;
+    int maxb = p.nbits;
+    int nwrite = -1;
 
-    dst += 4;
-  }
+    /*
+     * A base is followed by packed differences
+     * from it, exceptions are patched after lower
+     * bits, a run has its length and integer, and
+     * 32-bit integers are just copied in v2.
+     */
+    if (p.kind == ext_for) {
+      uint32_t diffs[128];
 
-  return VP32_DIV_ROUNDUP(3 * n, 2);
-}
+      VP32_ASSERT(plen <= ARRAYSIZE(diffs));
 
-inline int Unpack16(const char *restrict src,
-                    const char *restrict slimit,
-                    uint32_t *restrict dst,
-                    const uint32_t *restrict dlimit,
-                    int n) {
-  if (src + 2 * n > slimit || dst + n > dlimit)
-    return -1;
+      for (size_t j = 0; j < plen; j++)
+        diffs[j] = src[j] - p.base;
 
-  for (int i = 0; i < n; i++) {
-    dst[0] = DecodeUint16(src);
+      if (data + 4 <= dlimit) {
+        SetUint32LE(data, p.base);
+        nwrite = word_packers[maxb](
+            diffs, plen, data + 4, dlimit);
+        if (nwrite >= 0)
+          nwrite += 4;
+      }
+    } else if (p.kind == ext_patch) {
+      nwrite = WritePatched(
+          src, maxb, plen, data, dlimit);
+    } else if (p.kind == ext_run) {
+      if (data + 8 <= dlimit) {
+        SetUint32LE(data, plen);
+        SetUint32LE(data + 4, p.base);
+        nwrite = 8;
+      }
+    } else if (maxb == 32 && version != format_v1) {
+      if (data + 4 * plen <= dlimit) {
+        SetUint32s(data, src, plen, version);
+        nwrite = 4 * plen;
+      }
+    } else {
+      nwrite = word_packers[maxb](
+          src, plen, data, dlimit);
+    }
 
-    src += 2;
-    dst += 1;
+    /* Check if it works correctly */
+    if (nwrite < 0)
+      return 0;
+
+    VP32_ASSERT(p.kind == ext_run ||
+                ctrl_partition[plen] != char(0xff));
+
+    /* Write a control byte */
+    if (p.kind == ext_run) {
+      *ctrl++ = ctrl_ext;
+      *ctrl = ext_run;
+    } else if (p.kind == ext_plain &&
+          ctrl_bit[maxb] != char(0xff)) {
+      *ctrl = ctrl_bit[maxb] | ctrl_partition[plen];
+    } else {
+      *ctrl++ = ctrl_ext | ctrl_partition[plen];
+      *ctrl = p.kind | maxb;
+    }
+
+    /* Move to a next partition */
+    src += plen;
+    data += nwrite;
+    ctrl++;
+    block_size += nwrite;
   }
 
-  return 2 * n;
-}
+  VP32_ASSERT(ctrl == dst + offset);
 
-inline int Unpack32(const char *restrict src,
-                    const char *restrict slimit,
-                    uint32_t *restrict dst,
-                    const uint32_t *restrict dlimit,
-                    int n) {
-  if (src + 4 * n > slimit || dst + n > dlimit)
-    return -1;
+  /* Copy left integers to a output */
+  SetUint32s(data, tail,
+             MAX_UNPACK_OVERRUN_NUM, version);
 
-  for (int i = 0; i < n; i++) {
-    dst[0] = DecodeUint32(src);
+  block_size += 4 * MAX_UNPACK_OVERRUN_NUM;
 
-    src += 4;
-    dst += 1;
-  }
+  /*
+   * Finally, it stores the size of
+   * this block and the offset in the
+   * leading 8-byte space of the block.
+   */
+  SetBlockHeader(dst, block_size, offset,
+                 flags, version);
 
-  return 4 * n;
+  return block_size;
+}
+
+/* It allocates working space in every call */
+inline uint32_t CompressBlock(const uint32_t *src,
+                              size_t n,
+                              char *dst,
+                              const char *restrict dlimit,
+                              int version = format_v2) {
+  Workspace ws;
+  return CompressBlock(src, n, dst, dlimit, version, &ws);
 }
 
 
@@ -874,18 +3757,18 @@ inline int Unpack32(const char *restrict src,
  * Following functions are to help the
  * implementations of Compress() and Uncompress().
  *
- * CompressBlock
- *  src    : integer array to compress
- *  n      : # of input integers
- *  dst    : output buffer
- *  dlimit : terminal address of *dst
- *  return : # of written bytes, or 0 if it fails
+ * UncompressBlock
+ *  src     : sequence of compressed bytes
+ *  dst     : output buffer
+ *  n       : # of decompressed integers
+ *  version : format version of the block
+ *  return  : # of read bytes, or 0 if it fails
  *-------------------------------------------------
  */
-inline uint32_t CompressBlock(const uint32_t *src,
-                              size_t n,
-                              char *dst,
-                              const char *restrict dlimit) {
+inline uint32_t UncompressBlock(const char *src,
+                                uint32_t *dst,
+                                size_t n,
+                                int version = format_v2) {
   VP32_ASSERT(src != NULL);
   VP32_ASSERT(dst != NULL);
   VP32_ASSERT(n != 0);
@@ -895,169 +3778,481 @@ inline uint32_t CompressBlock(const uint32_t *src,
 
   if (max_partition +
         MAX_UNPACK_OVERRUN_NUM > n) {
-    for (size_t i = 0; i < n; i++)
-      SetUint32(dst + 4 * i, src[i]);
-
+    DecodeUint32s(src, dst, n, version);
     return n * 4;
   }
 
+  const CtrlTable &ctrl_table = GetCtrlTable(version);
+
+  /* Ready for decompression */
+  uint32_t block_size;
+  uint32_t offset;
+  uint32_t flags;
+
+  DecodeBlockHeader(src, &block_size, &offset,
+                    &flags, version);
+
+  uint32_t dict[dict_max];
+  uint32_t head;
+
+  if ((flags & ~block_known_flags) != 0 ||
+        offset > block_size ||
+        !DecodeBlockDict(src, flags, offset, &head, dict))
+    return 0;
+
+  const char *ctrl = src + head;
+  const char *data = src + offset;
+  const char *cend = data;
+
   /*
-   * Last MAX_UNPACK_OVERRUN_NUM 32-bit integers
-   * are not compressed and just copied to a output
-   * buffer because of the overrun issue during
-   * decompression.
+   * Validate all the control bytes first; the
+   * partitions must cover n integers except for
+   * the trailing ones, and the packed bytes must
+   * end just before them. Then, any overrun of the
+   * unchecked unpackers falls into the trailing
+   * integers, which are copied at the end.
+   */
+  size_t num = 0;
+  size_t nbytes = 0;
+
+  const char *tail = (block_size - offset >=
+      4 * MAX_UNPACK_OVERRUN_NUM)?
+        src + block_size - 4 * MAX_UNPACK_OVERRUN_NUM : data;
+
+  for (const char *p = ctrl; p < cend; p++) {
+    const CtrlEntry &e = ctrl_table.entries[*p & 0xff];
+
+    if (e.unpack == NULL) {
+      if (++p == cend)
+        return 0;
+
+      const char *pdata = data + nbytes;
+      if (pdata > tail)
+        return 0;
+
+      int sz = CtrlTable::ExtSize(
+          *p & 0xff, e.num, pdata, tail);
+      if (sz < 0)
+        return 0;
+
+      nbytes += sz;
+      num += CtrlTable::ExtNum(e, *p & 0xff, pdata);
+    } else {
+      nbytes += e.nbytes;
+      num += e.num;
+    }
+  }
+
+  if (num + MAX_UNPACK_OVERRUN_NUM != n ||
+        offset + nbytes + 4 * MAX_UNPACK_OVERRUN_NUM !=
+          block_size)
+    return 0;
+
+  /* Do decompression */
+  uint32_t base = (flags & block_delta)?
+      DecodeUint32LE(src + 8) : 0;
+  uint32_t *pending = dst;
+
+  while (ctrl < cend) {
+    const CtrlEntry &e = ctrl_table.entries[*ctrl & 0xff];
+
+    size_t num = e.num;
+
+    if (e.unpack == NULL) {
+      int c = *++ctrl & 0xff;
+
+      num = CtrlTable::ExtNum(e, c, data);
+      data += ctrl_table.Unpack(e, c, data, dst);
+    } else {
+      e.unpack(data, dst, e.num);
+      data += e.nbytes;
+    }
+
+    dst += num;
+    ctrl++;
+
+    /* Partitions are restored together */
+    if (flags != 0 &&
+          (dst - pending >= 256 || ctrl == cend)) {
+      base = ctrl_table.Restore(
+          flags, pending, dst - pending, base, dict);
+      pending = dst;
+    }
+  }
+
+  /* Copy left bytes to a output */
+  DecodeUint32s(data, dst,
+                MAX_UNPACK_OVERRUN_NUM, version);
+
+  return block_size;
+}
+
+/*-------------------------------------------------
+ * A function decodes integers in [lo, hi) of
+ * a block. Partitions before the range are
+ * skipped by their sizes in control bytes, and
+ * only the ones overlapping the range are
+ * unpacked. In a delta block, the partitions
+ * before the range are unpacked as well to sum
+ * up their gaps.
+ *
+ *  src     : head of a block
+ *  n       : # of integers in the block
+ *  version : format version of the block
+ *  lo      : index of the first integer to decode
+ *  hi      : index next to the last one
+ *  dst     : output buffer for (hi - lo) integers
+ *  return  : false if it fails
+ *-------------------------------------------------
+ */
+inline bool UncompressBlockRange(const char *src,
+                                 size_t n,
+                                 int version,
+                                 size_t lo,
+                                 size_t hi,
+                                 uint32_t *dst) {
+  VP32_ASSERT(src != NULL);
+  VP32_ASSERT(dst != NULL);
+  VP32_ASSERT(lo < hi && hi <= n);
+
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  if (max_partition +
+        MAX_UNPACK_OVERRUN_NUM > n) {
+    DecodeUint32s(src + 4 * lo, dst, hi - lo, version);
+    return true;
+  }
+
+  const CtrlTable &ctrl_table = GetCtrlTable(version);
+
+  uint32_t block_size;
+  uint32_t offset;
+  uint32_t flags;
+
+  DecodeBlockHeader(src, &block_size, &offset,
+                    &flags, version);
+
+  uint32_t dict[dict_max];
+  uint32_t head;
+
+  if ((flags & ~block_known_flags) != 0 ||
+        offset + 4 * MAX_UNPACK_OVERRUN_NUM >
+          static_cast<uint64_t>(block_size) ||
+        !DecodeBlockDict(src, flags, offset, &head, dict))
+    return false;
+
+  bool delta = (flags & block_delta) != 0;
+  uint32_t base = delta? DecodeUint32LE(src + 8) : 0;
+
+  const char *ctrl = src + head;
+  const char *cend = src + offset;
+  const char *data = cend;
+  const char *tail =
+      src + block_size - 4 * MAX_UNPACK_OVERRUN_NUM;
+
+  /*
+   * A partition is unpacked into buf[] if it is
+   * not fully in the range because unchecked
+   * unpackers overrun up to 7 integers. Packed
+   * bytes must end before the trailing integers,
+   * and the overreads fall into them. A run is
+   * filled only in the range, and gaps before
+   * the range are summed up by a multiplication.
    */
-  n -= MAX_UNPACK_OVERRUN_NUM;
+  uint32_t  buf[128 + 8];
+  size_t    pos = 0;
 
-  /* parts[] uses stack space */
-  size_t parts[n + 1];
+  VP32_ASSERT(max_partition <= 128);
 
-  int np = ComputePartition(src, n, parts);
+  for (; ctrl < cend && pos < hi; ctrl++) {
+    const CtrlEntry &e = ctrl_table.entries[*ctrl & 0xff];
 
-  uint32_t offset = np + 8;
-  SetUint32(dst + 4, offset);
+    size_t nbytes = e.nbytes;
+    size_t num = e.num;
+    int c = 0;
 
-  char *ctrl = dst + 8;
-  char *data = dst + offset;
+    /* Read an extended control byte */
+    if (e.unpack == NULL) {
+      if (++ctrl == cend)
+        return false;
 
-  /* Do compressing */
-  uint32_t block_size = offset;
+      c = *ctrl & 0xff;
 
-  for (int i = 0; i < np; i++) {
-    size_t plen =
-        parts[i + 1] - parts[i];
+      if (data > tail)
+        return false;
 
-    int maxb = 0;
-    for (size_t j = 0; j < plen; j++) {
-      int b = roundup_bits[
-          32 - VP32_MSB32(src[j])];
-      if (maxb < b)
-        maxb = b;
+      int sz = CtrlTable::ExtSize(c, e.num, data, tail);
+      if (sz < 0)
+        return false;
+
+      nbytes = sz;
+      num = CtrlTable::ExtNum(e, c, data);
     }
 
-    int nwrite = WriteBits(
-        src, maxb, plen, data, dlimit);
+    if (data + nbytes > tail)
+      return false;
 
-    /* Check if it works correctly */
-    if (nwrite < 0)
-      return 0;
+    if ((c & ~ext_bits_mask) == ext_run) {
+      uint32_t v = DecodeUint32LE(data + 4);
 
-    /* Write a control byte */
-    *ctrl = ctrl_bit[maxb] | ctrl_partition[plen];
+      size_t from = (pos > lo)? pos : lo;
+      size_t to = (pos + num < hi)? pos + num : hi;
 
-    VP32_ASSERT(ctrl_bit[maxb] != char(0xff));
-    VP32_ASSERT(ctrl_partition[plen] != char(0xff));
+      if (from > to)
+        from = to = pos + num;
 
-    /* Move to a next partition */
-    src += plen;
-    data += nwrite;
-    ctrl++;
-    block_size += nwrite;
+      if (delta) {
+        uint32_t gap = v;
+        if (flags & block_zigzag)
+          ZigzagDecode(&gap, 1);
+
+        base += gap * static_cast<uint32_t>(from - pos);
+      }
+
+      if (from < to) {
+        std::fill(dst + from - lo, dst + to - lo, v);
+        base = ctrl_table.Restore(
+            flags, dst + from - lo, to - from, base, dict);
+      }
+    } else if (pos >= lo && pos + e.num + 7 <= hi) {
+      ctrl_table.Unpack(e, c, data, dst + pos - lo);
+
+      base = ctrl_table.Restore(
+          flags, dst + pos - lo, e.num, base, dict);
+    } else if (pos + e.num > lo || delta) {
+      ctrl_table.Unpack(e, c, data, buf);
+
+      base = ctrl_table.Restore(
+          flags, buf, e.num, base, dict);
+
+      size_t from = (pos > lo)? pos : lo;
+      size_t to = (pos + e.num < hi)? pos + e.num : hi;
+
+      if (from < to)
+        memcpy(dst + from - lo, buf + from - pos,
+               (to - from) * sizeof(uint32_t));
+    }
+
+    pos += num;
+    data += nbytes;
   }
 
-  /* Copy left integers to a output */
-  for (size_t i = 0;
-        i < MAX_UNPACK_OVERRUN_NUM; i++)
-    SetUint32(data + i * 4, src[i]);
+  /* Copy trailing integers in the range */
+  if (pos < hi) {
+    if (data != tail ||
+          pos + MAX_UNPACK_OVERRUN_NUM != n)
+      return false;
 
-  block_size += 4 * MAX_UNPACK_OVERRUN_NUM;
+    size_t from = (pos > lo)? pos : lo;
 
-  /*
-   * Finally, it stores the size of
-   * this block in the leading 4-byte
-   * space of the block.
-   */
-  SetUint32(dst, block_size);
+    DecodeUint32s(tail + 4 * (from - pos),
+                  dst + from - lo, hi - from, version);
+  }
 
-  return block_size;
+  return true;
 }
 
 
 /*-------------------------------------------------
- * Following functions are to help the
- * implementations of Compress() and Uncompress().
+ * Helpers for blocks in a stream.
  *
- * UncompressBlock
- *  src    : sequence of compressed bytes
- *  dst    : output buffer
- *  n      : # of decompressed integers
- *  return : # of read bytes, or 0 if it fails
+ * BlockLength
+ *  n      : # of integers in a stream
+ *  i      : index of a block
+ *  return : # of integers in the i-th block
+ *
+ * BlockSize
+ *  src     : head of a block
+ *  n       : # of integers in the block
+ *  version : format version of the block
+ *  return  : # of bytes in the block
+ *
+ * BlockBound
+ *  n      : # of integers in a block
+ *  return : maximum size of the block
  *-------------------------------------------------
  */
-inline uint32_t UncompressBlock(const char *src,
-                                uint32_t *dst,
-                                size_t n) {
-  VP32_ASSERT(src != NULL);
-  VP32_ASSERT(dst != NULL);
-  VP32_ASSERT(n != 0);
+inline size_t BlockLength(size_t n, size_t i) {
+  size_t len = n - i * block_num;
+  return (len < block_num)? len : block_num;
+}
 
+inline size_t BlockSize(const char *src,
+                        size_t n,
+                        int version) {
   const size_t max_partition =
       partition_length[ARRAYSIZE(partition_length) - 1];
 
+  /* Short blocks are stored raw */
   if (max_partition +
-        MAX_UNPACK_OVERRUN_NUM > n) {
-    for (size_t i = 0; i < n; i++)
-      dst[i] = DecodeUint32(src + 4 * i);
-
+        MAX_UNPACK_OVERRUN_NUM > n)
     return n * 4;
-  }
 
-  /*
-   * A functional pointer below maps a
-   * given control byte to the corresponding
-   * unpacker function. Higher 4-bits in the
-   * control byte means a index in the
-   * functional pointer.
-   */
-  typedef int (*vpack32_t)(
-      const char *restrict src,
-      const char *restrict slimit,
-      uint32_t *restrict dst,
-      const uint32_t *restrict dlimit, int n);
-
-  static vpack32_t vpacker32[15] = {
-    Unpack0, Unpack1, Unpack2, Unpack3,
-    Unpack4, Unpack5, Unpack6, Unpack7,
-    Unpack8, Unpack9, Unpack10, Unpack11,
-    Unpack12, Unpack16, Unpack32
-  };
+  uint32_t block_size;
+  uint32_t offset;
+  uint32_t flags;
 
-  /* Ready for decompression */
-  uint32_t block_size = DecodeUint32(src);
-  uint32_t offset = DecodeUint32(src + 4);
+  DecodeBlockHeader(src, &block_size, &offset,
+                    &flags, version);
+  return block_size;
+}
 
-  const char *slimit = src + block_size;
-  const uint32_t *dlimit = dst + n;
+inline size_t BlockBound(size_t n) {
+  return 12 + 5 * n;
+}
 
-  const char *ctrl = src + 8;
-  const char *data = src + offset;
+/*-------------------------------------------------
+ * A reader for the magic number at the head of
+ * a stream.
+ *
+ *  src    : head of a stream
+ *  dir    : set true if a block directory follows
+ *  return : format version, or 0 if unknown
+ *-------------------------------------------------
+ */
+inline int DecodeStreamHeader(const char *src,
+                              bool *dir) {
+  uint64_t magic = DecodeUint64(src);
 
-  /* Do decompression */
-  int nloop = data - ctrl;
+  *dir = (magic == VP32_MAGICNUM_V2_DIR);
 
-  for (int i = 0; i < nloop; i++) {
-    size_t k = partition_length[(*ctrl >> 4) & 0x0f];
-    int b = *ctrl & 0x0f;
+  if (magic == VP32_MAGICNUM)
+    return format_v1;
+  if (magic == VP32_MAGICNUM_V2 ||
+        magic == VP32_MAGICNUM_V2_DIR)
+    return format_v2;
 
-    /* Do unpacking */
-    int nread = vpacker32[b](
-        data, slimit, dst, dlimit, k);
-    if (nread < 0)
-      return 0;
+  return 0;
+}
 
-    data += nread;
-    dst += k;
-    ctrl++;
+#ifdef VP32_HAVE_PTHREAD
+/*-------------------------------------------------
+ * A helper runs task->Run(id) in nthreads threads,
+ * and a caller thread works as the 0-th one. It
+ * goes on with fewer threads if some of them
+ * cannot be created.
+ *-------------------------------------------------
+ */
+template <typename Task>
+struct TaskThread {
+  Task       *task;
+  int         id;
+  pthread_t   thread;
+};
+
+template <typename Task>
+inline void *RunTaskThread(void *arg) {
+  TaskThread<Task> *t = static_cast<TaskThread<Task> *>(arg);
+  t->task->Run(t->id);
+  return NULL;
+}
+
+template <typename Task>
+inline void RunThreads(Task *task, int nthreads) {
+  TaskThread<Task> *threads =
+      new(std::nothrow) TaskThread<Task>[nthreads];
+
+  int nstarted = 1;
+
+  for (; threads != NULL && nstarted < nthreads;
+        nstarted++) {
+    TaskThread<Task> *t = &threads[nstarted];
+
+    t->task = task;
+    t->id = nstarted;
+
+    if (pthread_create(&t->thread, NULL,
+                       RunTaskThread<Task>, t) != 0)
+      break;
   }
 
-  /* Copy left bytes to a output */
-  for (size_t i = 0;
-        i < MAX_UNPACK_OVERRUN_NUM; i++)
-    dst[i] = DecodeUint32(data + 4 * i);
+  task->Run(0);
 
-  return block_size;
+  for (int i = 1; i < nstarted; i++)
+    pthread_join(threads[i].thread, NULL);
+
+  delete[] threads;
 }
 
+/*
+ * Tasks that threads share; each thread takes a
+ * next block by an atomic counter. A compressed
+ * block is written into a slot of
+ * BlockBound(block_num) bytes in *dst, and the
+ * slots are stitched together later. The sizes of
+ * blocks are recorded in sizes[], and 0 means
+ * a failure.
+ */
+struct CompressTask {
+  const uint32_t  *src;
+  size_t          n;
+  char           *dst;
+  const char     *dlimit;
+  size_t          nblock;
+  size_t          next;
+  uint32_t       *sizes;
+  Workspace      *ws;
+  uint32_t        flags;
+  int             level;
+  int             penalty;
+
+  void Run(int id) {
+    for (;;) {
+      size_t i = __sync_fetch_and_add(&next, 1);
+      if (i >= nblock)
+        return;
+
+      char *out = dst + i * BlockBound(block_num);
+      const char *limit = (i + 1 < nblock)?
+          out + BlockBound(block_num) : dlimit;
+
+      sizes[i] = CompressBlock(
+          src + i * block_num, BlockLength(n, i),
+          out, limit, format_v2, &ws[id], flags, level,
+          penalty);
+    }
+  }
+};
+
+struct UncompressTask {
+  const char     *src;
+  const size_t   *offsets;
+  uint32_t       *dst;
+  size_t          n;
+  int             version;
+  size_t          nblock;
+  size_t          next;
+  uint32_t       *sizes;
+
+  void Run(int) {
+    for (;;) {
+      size_t i = __sync_fetch_and_add(&next, 1);
+      if (i >= nblock)
+        return;
+
+      const char *block = src + offsets[i];
+      size_t len = BlockLength(n, i);
+
+      /*
+       * Check if a next block follows this one
+       * before decompression because offsets[]
+       * may come from a broken directory.
+       */
+      if (i + 1 < nblock &&
+            offsets[i] + BlockSize(block, len, version) !=
+              offsets[i + 1]) {
+        sizes[i] = 0;
+        continue;
+      }
+
+      sizes[i] = UncompressBlock(
+          block, dst + i * block_num, len, version);
+    }
+  }
+};
+#endif /* VP32_HAVE_PTHREAD */
+
 } /* namespace: backend */
 
 using namespace vpacker32::backend;
@@ -1076,59 +4271,248 @@ inline size_t CompressBound(size_t n) {
   size_t nblock =
       VP32_DIV_ROUNDUP(n, block_num);
 
-  return 8 + 8 * nblock + 5 * n;
+  /* A magic number, a directory, and blocks */
+  return 8 + 8 * nblock + 12 * nblock + 5 * n;
 }
 
 
 /*-------------------------------------------------
- * A simple interface for compression
+ * A compression context that keeps working space
+ * among calls, so repeated compression with the
+ * same object allocates nothing and uses little
+ * stack. An object is not thread-safe, so each
+ * thread needs its own one.
+ *
+ * If nthreads is more than 1, Compress() runs
+ * the threads to compress blocks concurrently,
+ * and the output is byte-identical to the one
+ * with a single thread.
+ *
+ * set_directory
+ *  directory : whether Compress() writes a block
+ *              directory, which has byte offsets
+ *              of all the blocks in a stream
+ *
+ * set_delta
+ *  delta : whether Compress() packs the gaps
+ *          between adjacent integers, which suits
+ *          sorted ones such as document IDs
+ *
+ * set_level
+ *  level : compression level from level_fast
+ *          to level_max (default); level_fast
+ *          compresses several times faster
  *
+ * set_penalty
+ *  penalty : bytes charged for each partition
+ *            from 0 (default) to penalty_max;
+ *            larger ones make output a little
+ *            larger but faster to decode
+ *
+ * Compress
  *  src    : input buffer
  *  dst    : output buffer
  *  n      : # of input integers
  *  return : # of written bytes in Compress()
+ *
+ * Signed integers are zigzag-encoded in blocks,
+ * and Uncompress() restores them as they are.
  *-------------------------------------------------
  */
-inline size_t Compress(const uint32_t *src,
-                       char *dst,
-                       size_t n) {
-  if (src == NULL || dst == NULL)
-    return 0;
+class Compressor {
+ public:
+  explicit Compressor(int nthreads = 1)
+      : nthreads_((nthreads > 1)? nthreads : 1),
+        directory_(false),
+        flags_(0),
+        level_(level_max),
+        penalty_(0),
+        ws_(new(std::nothrow) Workspace[nthreads_]) {}
+  ~Compressor() {delete[] ws_;}
+
+  void set_directory(bool directory) {
+    directory_ = directory;
+  }
 
+  void set_delta(bool delta) {
+    flags_ = delta? (flags_ | block_delta) :
+        (flags_ & ~block_delta);
+  }
+
+  /* Transforms are chosen for each block instead */
+  void set_auto(bool automatic) {
+    flags_ = automatic? (flags_ | block_auto) :
+        (flags_ & ~block_auto);
+  }
 
-  size_t nblock = n / block_num;
-  size_t rblock = n % block_num;
+  void set_level(int level) {
+    level_ = (level < level_fast)? level_fast :
+        (level > level_max)? level_max : level;
+  }
 
-  char *dlimit = dst + CompressBound(n);
+  void set_penalty(int penalty) {
+    penalty_ = (penalty < 0)? 0 :
+        (penalty > penalty_max)? penalty_max : penalty;
+  }
 
-  /* Write down a magic number */
-  SetUint64(dst, VP32_MAGICNUM);
-  dst += 8;
-  size_t wsize = 8;
+  size_t Compress(const uint32_t *src,
+                  char *dst,
+                  size_t n) {
+    return CompressBlocks(src, dst, n, flags_);
+  }
 
-  for (size_t i = 0; i < nblock; i++) {
-    uint32_t nwrite =
-        CompressBlock(src, block_num, dst, dlimit);
-    if (nwrite == 0)
+  size_t Compress(const int32_t *src,
+                  char *dst,
+                  size_t n) {
+    return CompressBlocks(
+        reinterpret_cast<const uint32_t *>(src),
+        dst, n, flags_ | block_zigzag);
+  }
+
+ private:
+  size_t CompressBlocks(const uint32_t *src,
+                        char *dst,
+                        size_t n,
+                        uint32_t flags) {
+    if (src == NULL || dst == NULL || ws_ == NULL)
       return 0;
 
-    /* Move to a next block */
-    src += block_num;
-    dst += nwrite;
-    wsize += nwrite;
+    size_t nblock = VP32_DIV_ROUNDUP(n, block_num);
+
+    /*
+     * Write down a magic number, and leave
+     * space for a block directory.
+     */
+    SetUint64(dst, directory_?
+        VP32_MAGICNUM_V2_DIR : VP32_MAGICNUM_V2);
+    size_t wsize = directory_? 8 + 8 * nblock : 8;
+
+#ifdef VP32_HAVE_PTHREAD
+    if (nthreads_ > 1 && nblock > 1)
+      return CompressParallel(src, dst, n, wsize, flags);
+#endif
+
+    char *dlimit = dst + CompressBound(n);
+
+    for (size_t i = 0; i < nblock; i++) {
+      if (directory_)
+        SetUint64LE(dst + 8 + 8 * i, wsize);
+
+      uint32_t nwrite = CompressBlock(
+          src + i * block_num, BlockLength(n, i),
+          dst + wsize, dlimit, format_v2, ws_, flags, level_,
+          penalty_);
+      if (nwrite == 0)
+        return 0;
+
+      wsize += nwrite;
+    }
+
+    return wsize;
   }
 
-  /* Compress left elements in src */
-  if (rblock) {
-    uint32_t nwrite =
-        CompressBlock(src, rblock, dst, dlimit);
-    if (nwrite == 0)
+#ifdef VP32_HAVE_PTHREAD
+  size_t CompressParallel(const uint32_t *src,
+                          char *dst,
+                          size_t n,
+                          size_t hsize,
+                          uint32_t flags) {
+    CompressTask task;
+
+    task.src = src;
+    task.n = n;
+    task.dst = dst + hsize;
+    task.dlimit = dst + CompressBound(n);
+    task.nblock = VP32_DIV_ROUNDUP(n, block_num);
+    task.next = 0;
+    task.sizes = new(std::nothrow) uint32_t[task.nblock];
+    task.ws = ws_;
+    task.flags = flags;
+    task.level = level_;
+    task.penalty = penalty_;
+
+    if (task.sizes == NULL)
       return 0;
 
-    wsize += nwrite;
+    RunThreads(&task,
+        (static_cast<size_t>(nthreads_) < task.nblock)?
+            nthreads_ : static_cast<int>(task.nblock));
+
+    /* Stitch the blocks together in order */
+    size_t wsize = hsize;
+
+    for (size_t i = 0; i < task.nblock; i++) {
+      if (task.sizes[i] == 0) {
+        wsize = 0;
+        break;
+      }
+
+      if (directory_)
+        SetUint64LE(dst + 8 + 8 * i, wsize);
+
+      memmove(dst + wsize,
+              task.dst + i * BlockBound(block_num),
+              task.sizes[i]);
+      wsize += task.sizes[i];
+    }
+
+    delete[] task.sizes;
+    return wsize;
   }
+#endif
+
+  int         nthreads_;
+  bool        directory_;
+  uint32_t    flags_;
+  int         level_;
+  int         penalty_;
+  Workspace  *ws_;
+
+  /* Not copyable */
+  Compressor(const Compressor &);
+  void operator=(const Compressor &);
+};
+
+
+/*-------------------------------------------------
+ * A simple interface for compression
+ *
+ *  src    : input buffer
+ *  dst    : output buffer
+ *  n      : # of input integers
+ *  return : # of written bytes in Compress()
+ *-------------------------------------------------
+ */
+inline size_t Compress(const uint32_t *src,
+                       char *dst,
+                       size_t n) {
+  Compressor c;
+  return c.Compress(src, dst, n);
+}
+
+/* It uses nthreads threads for compression */
+inline size_t Compress(const uint32_t *src,
+                       char *dst,
+                       size_t n,
+                       int nthreads) {
+  Compressor c(nthreads);
+  return c.Compress(src, dst, n);
+}
+
+/* Signed integers are zigzag-encoded */
+inline size_t Compress(const int32_t *src,
+                       char *dst,
+                       size_t n) {
+  Compressor c;
+  return c.Compress(src, dst, n);
+}
 
-  return wsize;
+inline size_t Compress(const int32_t *src,
+                       char *dst,
+                       size_t n,
+                       int nthreads) {
+  Compressor c(nthreads);
+  return c.Compress(src, dst, n);
 }
 
 
@@ -1148,41 +4532,271 @@ inline size_t Uncompress(const char *src,
     return 0;
 
   /* Check if a magic number is correct */
-  if (VP32_MAGICNUM != DecodeUint64(src))
+  bool dir;
+  int version = DecodeStreamHeader(src, &dir);
+  if (version == 0)
     return 0;
 
-  src += 8;
-  size_t rsize = 8;
+  size_t nblock = VP32_DIV_ROUNDUP(n, block_num);
 
-  size_t nblock = n / block_num;
-  size_t rblock = n % block_num;
+  /* Skip a block directory */
+  size_t rsize = dir? 8 + 8 * nblock : 8;
 
   for (size_t i = 0; i < nblock; i++) {
-    uint32_t nread =
-        UncompressBlock(src, dst, block_num);
+    uint32_t nread = UncompressBlock(
+        src + rsize, dst + i * block_num,
+        BlockLength(n, i), version);
 
     /* Check if it works correctly */
     if (nread == 0)
       return 0;
 
-    /* Move to a next block */
-    src += nread;
-    dst += block_num;
     rsize += nread;
   }
 
-  if (rblock) {
-    uint32_t nread =
-        UncompressBlock(src, dst, rblock);
+  return rsize;
+}
 
-    /* Check if it works correctly */
-    if (nread == 0)
-      return 0;
 
-    rsize += nread;
+/*-------------------------------------------------
+ * An interface for decompression with nthreads
+ * threads. Blocks are found by a block directory
+ * if a stream has it, or by reading the sizes of
+ * the blocks in advance otherwise.
+ *
+ *  src      : input buffer
+ *  dst      : output buffer
+ *  n        : # of output integers
+ *  nthreads : # of threads for decompression
+ *  return   : # of read bytes in Uncompress()
+ *-------------------------------------------------
+ */
+inline size_t Uncompress(const char *src,
+                         uint32_t *dst,
+                         size_t n,
+                         int nthreads) {
+#ifdef VP32_HAVE_PTHREAD
+  size_t nblock = VP32_DIV_ROUNDUP(n, block_num);
+
+  if (src == NULL || dst == NULL ||
+        nthreads <= 1 || nblock <= 1)
+    return Uncompress(src, dst, n);
+
+  bool dir;
+  int version = DecodeStreamHeader(src, &dir);
+  if (version == 0)
+    return 0;
+
+  UncompressTask task;
+
+  task.src = src;
+  task.offsets = NULL;
+  task.dst = dst;
+  task.n = n;
+  task.version = version;
+  task.nblock = nblock;
+  task.next = 0;
+  task.sizes = new(std::nothrow) uint32_t[nblock];
+
+  size_t *offsets = new(std::nothrow) size_t[nblock];
+
+  if (task.sizes == NULL || offsets == NULL) {
+    delete[] task.sizes;
+    delete[] offsets;
+    return 0;
+  }
+
+  /* Find the heads of blocks */
+  size_t hsize = dir? 8 + 8 * nblock : 8;
+  size_t rsize = hsize;
+
+  for (size_t i = 0; i < nblock; i++) {
+    if (dir) {
+      offsets[i] = DecodeUint64LE(src + 8 + 8 * i);
+    } else {
+      offsets[i] = rsize;
+    }
+
+    /*
+     * The heads must follow the previous ones
+     * within the bound of a block because they
+     * may come from a broken directory; otherwise,
+     * blocks are walked one by one.
+     */
+    if ((i == 0)? offsets[0] != hsize :
+          (offsets[i] <= offsets[i - 1] ||
+           offsets[i] - offsets[i - 1] >
+             BlockBound(BlockLength(n, i - 1)))) {
+      delete[] task.sizes;
+      delete[] offsets;
+      return Uncompress(src, dst, n);
+    }
+
+    if (!dir) {
+      rsize += BlockSize(
+          src + rsize, BlockLength(n, i), version);
+    }
+  }
+
+  task.offsets = offsets;
+
+  RunThreads(&task,
+      (static_cast<size_t>(nthreads) < nblock)?
+          nthreads : static_cast<int>(nblock));
+
+  /* Check if the blocks are contiguous */
+  rsize = hsize;
+
+  for (size_t i = 0; i < nblock; i++) {
+    if (task.sizes[i] == 0 || offsets[i] != rsize) {
+      rsize = 0;
+      break;
+    }
+
+    rsize += task.sizes[i];
   }
 
+  delete[] task.sizes;
+  delete[] offsets;
+
   return rsize;
+#else
+  (void)nthreads;
+  return Uncompress(src, dst, n);
+#endif
+}
+
+
+/*
+ * Signed integers compressed by Compress() above
+ * are restored as well because blocks have flags
+ * for zigzag encoding.
+ */
+inline size_t Uncompress(const char *src,
+                         int32_t *dst,
+                         size_t n) {
+  return Uncompress(
+      src, reinterpret_cast<uint32_t *>(dst), n);
+}
+
+inline size_t Uncompress(const char *src,
+                         int32_t *dst,
+                         size_t n,
+                         int nthreads) {
+  return Uncompress(
+      src, reinterpret_cast<uint32_t *>(dst), n, nthreads);
+}
+
+
+/*-------------------------------------------------
+ * Interfaces for random access; they skip blocks
+ * by a block directory if a stream has it, or by
+ * reading the sizes of the blocks otherwise, and
+ * decode only partitions in a given range.
+ *
+ * DecodeRange
+ *  src    : input buffer
+ *  n      : # of integers in the stream
+ *  begin  : index of the first integer to decode
+ *  end    : index next to the last one
+ *  dst    : output buffer for (end - begin) integers
+ *  return : # of decoded integers, or 0 if it fails
+ *
+ * Get
+ *  src    : input buffer
+ *  n      : # of integers in the stream
+ *  i      : index of an integer to decode
+ *  return : the i-th integer, or 0 if it fails
+ *-------------------------------------------------
+ */
+inline size_t DecodeRange(const char *src,
+                          size_t n,
+                          size_t begin,
+                          size_t end,
+                          uint32_t *dst) {
+  if (src == NULL || dst == NULL ||
+        begin >= end || end > n)
+    return 0;
+
+  bool dir;
+  int version = DecodeStreamHeader(src, &dir);
+  if (version == 0)
+    return 0;
+
+  size_t first = begin / block_num;
+  size_t last = (end - 1) / block_num;
+
+  size_t nblock = VP32_DIV_ROUNDUP(n, block_num);
+  size_t hsize = dir? 8 + 8 * nblock : 8;
+
+  /*
+   * Find the first block; the directory is checked
+   * as in Uncompress() with threads, and blocks are
+   * walked one by one if it is broken.
+   */
+  size_t rsize = 0;
+
+  if (dir && DecodeUint64LE(src + 8) == hsize) {
+    rsize = hsize;
+    for (size_t i = 1; i <= first; i++) {
+      size_t offset = DecodeUint64LE(src + 8 + 8 * i);
+      if (offset <= rsize || offset - rsize >
+            BlockBound(BlockLength(n, i - 1))) {
+        rsize = 0;
+        break;
+      }
+
+      rsize = offset;
+    }
+  }
+
+  if (rsize == 0) {
+    rsize = hsize;
+    for (size_t i = 0; i < first; i++) {
+      size_t len = BlockLength(n, i);
+      size_t bsize = BlockSize(src + rsize, len, version);
+      if (bsize == 0 || bsize > BlockBound(len))
+        return 0;
+
+      rsize += bsize;
+    }
+  }
+
+  for (size_t i = first; i <= last; i++) {
+    size_t len = BlockLength(n, i);
+    size_t lo = (i == first)? begin - i * block_num : 0;
+    size_t hi = (i == last)? end - i * block_num : len;
+
+    if (!UncompressBlockRange(
+          src + rsize, len, version, lo, hi, dst))
+      return 0;
+
+    size_t bsize = BlockSize(src + rsize, len, version);
+    if (bsize == 0 || bsize > BlockBound(len))
+      return 0;
+
+    rsize += bsize;
+    dst += hi - lo;
+  }
+
+  return end - begin;
+}
+
+inline uint32_t Get(const char *src,
+                    size_t n,
+                    size_t i) {
+  uint32_t v = 0;
+  DecodeRange(src, n, i, i + 1, &v);
+  return v;
+}
+
+inline size_t DecodeRange(const char *src,
+                          size_t n,
+                          size_t begin,
+                          size_t end,
+                          int32_t *dst) {
+  return DecodeRange(src, n, begin, end,
+                     reinterpret_cast<uint32_t *>(dst));
 }
 
 } /* namespace: vpacker32 */
@@ -49,7 +49,8 @@ TEST_P(Vpacker32P, Compress) {
     1ULL << 4, 1ULL << 5, 1ULL << 6,
     1ULL << 7, 1ULL << 8, 1ULL << 9,
     1ULL << 10, 1ULL << 11, 1ULL << 12,
-    1ULL << 16, 1ULL << 24
+    1ULL << 14, 1ULL << 16, 1ULL << 20,
+    1ULL << 24, 1ULL << 28, 0xffffffff
   };
 
   for (size_t i = 0;
@@ -93,7 +94,8 @@ TEST_P(Vpacker32P, CompressBlock) {
     1ULL << 4, 1ULL << 5, 1ULL << 6,
     1ULL << 7, 1ULL << 8, 1ULL << 9,
     1ULL << 10, 1ULL << 11, 1ULL << 12,
-    1ULL << 16, 1ULL << 24
+    1ULL << 14, 1ULL << 16, 1ULL << 20,
+    1ULL << 24, 1ULL << 28, 0xffffffff
   };
 
   for (size_t i = 0;
@@ -101,18 +103,56 @@ TEST_P(Vpacker32P, CompressBlock) {
     const uint32_t *dv =
         tmgr.generate(&tv, num, range[i]);
 
-    uint32_t wsz =
-        CompressBlock(dv, num, dst, dlimit);
-    ASSERT_TRUE(wsz <= dbound);
+    /* Check both format versions */
+    for (int v = format_v1; v <= format_v2; v++) {
+      uint32_t wsz =
+          CompressBlock(dv, num, dst, dlimit, v);
+      ASSERT_TRUE(wsz <= dbound);
 
-    uint32_t rsz =
-        UncompressBlock(dst, buf, num);
+      uint32_t rsz =
+          UncompressBlock(dst, buf, num, v);
 
-    EXPECT_EQ(rsz, wsz);
-    for (size_t i = 0; i < num; i++)
-      EXPECT_EQ(dv[i], buf[i]);
+      EXPECT_EQ(rsz, wsz);
+      for (size_t i = 0; i < num; i++)
+        EXPECT_EQ(dv[i], buf[i]);
+    }
+  }
+
+  delete[] dst;
+  delete[] buf;
+}
+
+TEST_P(Vpacker32P, UncompressV1) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = GetParam();
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *dlimit = dst + dbound;
+  uint32_t *buf = new uint32_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1ULL << 12);
+
+  /* Write a stream in the v1 format */
+  SetUint64(dst, VP32_MAGICNUM);
+  size_t wsz = 8;
+
+  for (size_t i = 0; i < num; i += block_num) {
+    size_t n = (num - i < block_num)? num - i : block_num;
+
+    uint32_t nwrite = CompressBlock(
+        dv + i, n, dst + wsz, dlimit, format_v1);
+    ASSERT_TRUE(nwrite != 0);
+
+    wsz += nwrite;
   }
 
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(dv[i], buf[i]);
+
   delete[] dst;
   delete[] buf;
 }
@@ -191,13 +231,44 @@ TEST(Vpacker64, SetUint64) {
   EXPECT_EQ(2546335145698555275ULL, DecodeUint64(buf));
 }
 
+TEST(Vpacker32, SetUint32LE) {
+  char  buf[16];
+
+  SetUint32LE(buf, 2169682782);
+  EXPECT_EQ('\x5e', buf[0]);
+  EXPECT_EQ('\xbb', buf[1]);
+  EXPECT_EQ('\x52', buf[2]);
+  EXPECT_EQ('\x81', buf[3]);
+  EXPECT_EQ(2169682782, DecodeUint32LE(buf));
+
+  /* Arrays of raw integers in each format */
+  const uint32_t v[] = {
+    2169682782, 973589125, 0, 0xffffffff
+  };
+  uint32_t  out[4];
+
+  SetUint32s(buf, v, 4, format_v1);
+  EXPECT_EQ(973589125, DecodeUint32(buf + 4));
+
+  DecodeUint32s(buf, out, 4, format_v1);
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(v[i], out[i]);
+
+  SetUint32s(buf, v, 4, format_v2);
+  EXPECT_EQ(973589125, DecodeUint32LE(buf + 4));
+
+  DecodeUint32s(buf, out, 4, format_v2);
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(v[i], out[i]);
+}
+
 TEST(Vpacker32, Unpack0) {
   const char     *src = "0x00"; /* Not used in Unpack0 */
   uint32_t        dst[32];
   const char     *slimit = src;
   const uint32_t *dlimit = dst + 32;
 
-  memset(dst, 0xff, 256);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(0, Unpack0(
           src, slimit, dst, dlimit, 1));
@@ -249,7 +320,7 @@ TEST(Vpacker32, Unpack1) {
   const char     *slimit = src + 2;
   const uint32_t *dlimit = dst + 16;
 
-  memset(dst, 0xff, 128);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(1, Unpack1(
           src, slimit, dst, dlimit, 1));
@@ -329,7 +400,7 @@ TEST(Vpacker32, Unpack2) {
   const char     *slimit = src + 2;
   const uint32_t *dlimit = dst + 8;
 
-  memset(dst, 0xff, 64);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(1, Unpack2(
           src, slimit, dst, dlimit, 1));
@@ -408,7 +479,7 @@ TEST(Vpacker32, Unpack3) {
   const char     *slimit = src + 6;
   const uint32_t *dlimit = dst + 16;
 
-  memset(dst, 0xff, 64);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(1, Unpack3(
           src, slimit, dst, dlimit, 1));
@@ -531,7 +602,7 @@ TEST(Vpacker32, Unpack4) {
   const char     *slimit = src + 2;
   const uint32_t *dlimit = dst + 4;
 
-  memset(dst, 0xff, 32);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(1, Unpack4(
           src, slimit, dst, dlimit, 1));
@@ -575,7 +646,7 @@ TEST(Vpacker32, Unpack5) {
   const char     *slimit = src + 10;
   const uint32_t *dlimit = dst + 16;
 
-  memset(dst, 0xff, 128);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(1, Unpack5(
           src, slimit, dst, dlimit, 1));
@@ -698,7 +769,7 @@ TEST(Vpacker32, Unpack6) {
   const char     *slimit = src + 6;
   const uint32_t *dlimit = dst + 8;
 
-  memset(dst, 0xff, 64);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(1, Unpack6(
           src, slimit, dst, dlimit, 1));
@@ -770,7 +841,7 @@ TEST(Vpacker32, Unpack7) {
   const char     *slimit = src + 14;
   const uint32_t *dlimit = dst + 16;
 
-  memset(dst, 0xff, 128);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(1, Unpack7(
           src, slimit, dst, dlimit, 1));
@@ -893,7 +964,7 @@ TEST(Vpacker32, Unpack8) {
   const char     *slimit = src + 2;
   const uint32_t *dlimit = dst + 2;
 
-  memset(dst, 0xff, 16);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(1, Unpack8(
           src, slimit, dst, dlimit, 1));
@@ -927,7 +998,7 @@ TEST(Vpacker32, Unpack9) {
   const char     *slimit = src + 36;
   const uint32_t *dlimit = dst + 32;
 
-  memset(dst, 0xff, 256);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(2, Unpack9(
           src, slimit, dst, dlimit, 1));
@@ -1210,7 +1281,7 @@ TEST(Vpacker32, Unpack10) {
   const char     *slimit = src + 20;
   const uint32_t *dlimit = dst + 16;
 
-  memset(dst, 0xff, 128);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(2, Unpack10(
           src, slimit, dst, dlimit, 1));
@@ -1340,7 +1411,7 @@ TEST(Vpacker32, Unpack11) {
   const char     *slimit = src + 44;
   const uint32_t *dlimit = dst + 32;
 
-  memset(dst, 0xff, 256);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(2, Unpack11(
           src, slimit, dst, dlimit, 1));
@@ -1601,7 +1672,7 @@ TEST(Vpacker32, Unpack12) {
   const char     *slimit = src + 12;
   const uint32_t *dlimit = dst + 8;
 
-  memset(dst, 0xff, 64);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(2, Unpack12(
           src, slimit, dst, dlimit, 1));
@@ -1680,7 +1751,7 @@ TEST(Vpacker32, Unpack16) {
   const char     *slimit = src + 8;
   const uint32_t *dlimit = dst + 4;
 
-  memset(dst, 0xff, 32);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(2, Unpack16(
           src, slimit, dst, dlimit, 1));
@@ -1724,7 +1795,7 @@ TEST(Vpacker32, Unpack32) {
   const char     *slimit = src + 16;
   const uint32_t *dlimit = dst + 4;
 
-  memset(dst, 0xff, 32);
+  memset(dst, 0xff, sizeof(dst));
 
   EXPECT_EQ(4, Unpack32(
           src, slimit, dst, dlimit, 1));
@@ -1759,6 +1830,180 @@ TEST(Vpacker32, Unpack32) {
           src, slimit, dst, dst, 4));
 }
 
+TEST(Vpacker32, UnpackWord) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  char      src[1024];
+  uint32_t  buf[256];
+
+  for (int nbits = 1; nbits <= 32; nbits++) {
+    uint32_t  max = (nbits == 32)?
+        0xffffffff : (1U << nbits);
+
+    const uint32_t *dv =
+        tmgr.generate(&tv, 128, max);
+
+    int nwrite = WriteBits(
+        dv, nbits, 128, src, src + sizeof(src));
+    ASSERT_TRUE(nwrite >= 0);
+
+    for (int n = 1; n <= 128; n++) {
+      int nread = VP32_DIV_ROUNDUP(nbits * n, 8);
+
+      /* Check both word and one-by-one paths */
+      const char *slimit[2] = {
+        src + nread, src + sizeof(src)
+      };
+
+      for (int j = 0; j < 2; j++) {
+        memset(buf, 0x00, sizeof(buf));
+
+        EXPECT_EQ(nread, word_unpackers[nbits](
+                src, slimit[j], buf, buf + n, n));
+        for (int k = 0; k < n; k++)
+          EXPECT_EQ(dv[k], buf[k]);
+      }
+
+      /* Tests for error checks */
+      EXPECT_EQ(-1, word_unpackers[nbits](
+              src, src + nread - 1, buf, buf + n, n));
+      EXPECT_EQ(-1, word_unpackers[nbits](
+              src, slimit[1], buf, buf + n - 1, n));
+    }
+  }
+
+  /* Hand-written ones have the same results */
+  for (size_t i = 1;
+        i < ARRAYSIZE(bits_length); i++) {
+    int       nbits = bits_length[i];
+    uint32_t  max = (nbits == 32)?
+        0xffffffff : (1U << nbits);
+
+    const uint32_t *dv =
+        tmgr.generate(&tv, 128, max);
+
+    WriteBits(dv, nbits, 128, src, src + sizeof(src));
+
+    for (int n = 1; n <= 128; n++) {
+      int nread = VP32_DIV_ROUNDUP(nbits * n, 8);
+
+      memset(buf, 0x00, sizeof(buf));
+
+      EXPECT_EQ(nread, scalar_unpackers[i](
+              src, src + sizeof(src), buf, buf + 256, n));
+      for (int k = 0; k < n; k++)
+        EXPECT_EQ(dv[k], buf[k]);
+    }
+  }
+}
+
+#ifdef VP32_HAVE_SSE41
+TEST(Vpacker32, UnpackSIMD) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  char      src[1024];
+  uint32_t  buf[256];
+
+  /* Check SIMD unpackers that a processor supports */
+  std::vector<const vpack32_t *> unpackers;
+
+  if (__builtin_cpu_supports("sse4.1"))
+    unpackers.push_back(sse41_unpackers);
+  if (__builtin_cpu_supports("avx2"))
+    unpackers.push_back(avx2_unpackers);
+
+  EXPECT_TRUE(SelectUnpackers() != NULL);
+
+  for (int nbits = 1; nbits <= 32; nbits++) {
+    uint32_t  max = (nbits == 32)?
+        0xffffffff : (1U << nbits);
+
+    const uint32_t *dv =
+        tmgr.generate(&tv, 128, max);
+
+    int nwrite = WriteBits(
+        dv, nbits, 128, src, src + sizeof(src));
+    ASSERT_TRUE(nwrite >= 0);
+
+    for (int n = 1; n <= 128; n++) {
+      int nread = VP32_DIV_ROUNDUP(nbits * n, 8);
+
+      /* Check both SIMD and one-by-one paths */
+      const char *slimit[2] = {
+        src + nread, src + sizeof(src)
+      };
+
+      for (size_t u = 0; u < unpackers.size(); u++) {
+        for (int j = 0; j < 2; j++) {
+          memset(buf, 0x00, sizeof(buf));
+
+          EXPECT_EQ(nread, unpackers[u][nbits](
+                  src, slimit[j], buf, buf + n, n));
+          for (int k = 0; k < n; k++)
+            EXPECT_EQ(dv[k], buf[k]);
+        }
+
+        /* Tests for error checks */
+        EXPECT_EQ(-1, unpackers[u][nbits](
+                src, src + nread - 1, buf, buf + n, n));
+        EXPECT_EQ(-1, unpackers[u][nbits](
+                src, slimit[1], buf, buf + n - 1, n));
+      }
+    }
+  }
+}
+#endif
+
+TEST(Vpacker32, UnpackFast) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  char      src[1024];
+  uint32_t  buf[256];
+
+  /* Check unchecked unpackers that a processor supports */
+  std::vector<const vpack32_fast_t *> unpackers;
+  unpackers.push_back(word_fast_unpackers);
+
+#ifdef VP32_HAVE_SSE41
+  if (__builtin_cpu_supports("sse4.1"))
+    unpackers.push_back(sse41_fast_unpackers);
+#endif
+#ifdef VP32_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    unpackers.push_back(avx2_fast_unpackers);
+#endif
+
+  EXPECT_TRUE(SelectFastUnpackers() != NULL);
+
+  for (int nbits = 0; nbits <= 32; nbits++) {
+    uint32_t  max = (nbits == 32)?
+        0xffffffff : (1U << nbits);
+
+    const uint32_t *dv =
+        tmgr.generate(&tv, 128, max);
+
+    memset(src, 0x00, sizeof(src));
+    WriteBits(dv, nbits, 128, src, src + sizeof(src));
+
+    for (int n = 1; n <= 128; n++) {
+      for (size_t u = 0; u < unpackers.size(); u++) {
+        memset(buf, 0x00, sizeof(buf));
+
+        unpackers[u][nbits](src, buf, n);
+        for (int k = 0; k < n; k++)
+          EXPECT_EQ(dv[k], buf[k]);
+
+        /* Overruns are up to 7 integers */
+        for (int k = n + 7; k < 256; k++)
+          EXPECT_EQ(0, buf[k]);
+      }
+    }
+  }
+}
+
 TEST(Vpacker32, WriteBits) {
   /* Write 0-bit integers */
   {
@@ -2417,6 +2662,35 @@ TEST(Vpacker32, WriteBits) {
   }
 }
 
+TEST(Vpacker32, PackWord) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  /* Upper bits over nbits are ignored */
+  const uint32_t *in =
+      tmgr.generate(&tv, 128, 0xffffffffU);
+
+  char  ref[512 + 8];
+  char  dst[512 + 8];
+
+  for (int b = 0; b <= 32; b++) {
+    for (size_t n = 0; n <= 128; n++) {
+      memset(ref, 0x5a, sizeof(ref));
+      memset(dst, 0x5a, sizeof(dst));
+
+      int sz = WriteBits(in, b, n, ref, ref + sizeof(ref));
+      ASSERT_EQ(sz, word_packers[b](in, n, dst, dst + sz));
+
+      /* The same bytes, and nothing over them */
+      EXPECT_EQ(0, memcmp(ref, dst, sizeof(dst)));
+
+      if (sz > 0) {
+        EXPECT_EQ(-1, word_packers[b](in, n, dst, dst + sz - 1));
+      }
+    }
+  }
+}
+
 TEST(Vpacker32, ComputePartition) {
   /* -1 is a separator for partitions */
   uint32_t  src[160] = {
@@ -2449,7 +2723,7 @@ TEST(Vpacker32, ComputePartition) {
     1, 1
   };
 
-  size_t  parts[11];
+  size_t  parts[12];
 
   EXPECT_EQ(1, ComputePartition(src, 128, parts));
   EXPECT_EQ(0, parts[0]);
@@ -2469,6 +2743,1313 @@ TEST(Vpacker32, ComputePartition) {
   EXPECT_EQ(2, parts[11] - parts[10]);
 }
 
+TEST(Vpacker32, BestCandidate) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 4096;
+  uint64_t *costs = new uint64_t[num + 1];
+  uint32_t *in = new uint32_t[num];
+
+  vcandidate32_t best_candidate = SelectBestCandidate();
+
+  /* Some integers have the highest bit */
+  uint32_t ranges[] = {1U << 4, 1U << 13, 1U << 17, 0xffffffffU};
+
+  for (size_t k = 0; k < ARRAYSIZE(ranges); k++) {
+    const uint32_t *dv = tmgr.generate(&tv, num, ranges[k]);
+
+    for (size_t i = 0; i < num; i++)
+      in[i] = (i % 7 == 0)? dv[i] ^ (1U << 31) : dv[i];
+
+    costs[0] = 0;
+    for (size_t i = 1; i <= num; i++)
+      costs[i] = costs[i - 1] + dv[i - 1] % 5;
+
+    for (size_t i = 128; i <= num; i++) {
+      uint64_t c1 = 0;
+      uint64_t c2 = 0;
+      EXPECT_EQ(BestCandidate(in, costs, i, &c1),
+                best_candidate(in, costs, i, &c2));
+      EXPECT_EQ(c1, c2);
+    }
+  }
+
+  delete[] costs;
+  delete[] in;
+}
+
+TEST(Vpacker32, PruneCandidate) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+  std::vector<uint32_t> th;
+
+  size_t    num = 4096;
+  size_t   *parts = new size_t[num + 1];
+  uint32_t *in = new uint32_t[num];
+
+  vcandidate32_t funcs[] = {BestCandidate, SelectBestCandidate()};
+
+  /* Small and middle integers, and hashes among them */
+  const uint32_t *dv = tmgr.generate(&tv, num, 1U << 12);
+  const uint32_t *hv = tmgr.generate(&th, num, 0xffffffffU);
+
+  for (size_t i = 0; i < num; i++)
+    in[i] = ((i / 256) % 2 == 0 || i % 3 == 0)? hv[i] :
+        (i % 5 == 0)? dv[i] << 12 : dv[i];
+
+  /*
+   * Candidates ending at 1024 see a base with
+   * a narrow range only, and the hashes between
+   * them make longer candidates cheaper.
+   */
+  for (size_t i = 1024 - 128; i < 1024; i++)
+    in[i] = hv[i] | (1U << 31);
+  for (size_t j = 0; j < ARRAYSIZE(partition_length); j++)
+    in[1024 - partition_length[j]] = (1U << 31) + dv[j];
+
+  Workspace ws;
+  ASSERT_TRUE(ws.Reserve(num));
+
+  BitWidths(in, num, ws.widths());
+  ComputePartition(in, num, parts, ws);
+
+  /* The same choices as all the candidates on the DP costs */
+  const uint64_t *costs = ws.costs();
+  size_t npruned = 0;
+
+  for (size_t i = 128; i <= num; i++) {
+    uint32_t  maxv = 0;
+    uint32_t  minv = 0xffffffff;
+    uint64_t  best = ~uint64_t(0);
+    size_t    start = 0;
+
+    for (size_t j = 0; j < ARRAYSIZE(partition_length); j++) {
+      size_t bp = i - partition_length[j];
+
+      maxv = std::max(maxv, in[bp]);
+      minv = std::min(minv, in[bp]);
+
+      uint64_t c = costs[bp] + PackingSize(i - bp, maxv, minv);
+      if (c <= best) {
+        best = c;
+        start = bp;
+      }
+    }
+
+    if (maxv - minv >= 0x80000000U)
+      npruned++;
+
+    for (size_t k = 0; k < ARRAYSIZE(funcs); k++) {
+      uint64_t c = 0;
+      EXPECT_EQ(start, funcs[k](in, costs, i, &c));
+      EXPECT_EQ(best, c);
+    }
+  }
+
+  EXPECT_LT(num / 4, npruned);
+
+  delete[] parts;
+  delete[] in;
+}
+
+TEST(Vpacker32, ComputeFastPartition) {
+  uint32_t  src[397];
+  size_t    parts[16];
+
+  /* A run of 256 zeros */
+  for (size_t i = 0; i < 256; i++)
+    src[i] = 0;
+
+  /* 16 wide integers followed by 112 ones */
+  for (size_t i = 0; i < 16; i++)
+    src[256 + i] = i << 16;
+  for (size_t i = 272; i < 397; i++)
+    src[i] = 1;
+
+  EXPECT_EQ(7, ComputeFastPartition(src, 397, parts));
+  EXPECT_EQ(0, parts[0]);
+  EXPECT_EQ(256, parts[1]);
+  EXPECT_EQ(272, parts[2]);
+  EXPECT_EQ(288, parts[3]);
+  EXPECT_EQ(320, parts[4]);
+  EXPECT_EQ(384, parts[5]);
+  EXPECT_EQ(396, parts[6]);
+  EXPECT_EQ(397, parts[7]);
+
+  /* Outliers are patched instead of split */
+  for (size_t i = 0; i < 128; i++)
+    src[i] = (i % 32 == 8)? 1U << 30 : 3;
+
+  EXPECT_EQ(1, ComputeFastPartition(src, 128, parts));
+  EXPECT_EQ(128, parts[1]);
+}
+
+TEST(Vpacker32, PackedBits) {
+  /* Bit lengths in bits_length[] */
+  EXPECT_EQ(0, PackedBits(128, 0));
+  EXPECT_EQ(12, PackedBits(128, 12));
+  EXPECT_EQ(16, PackedBits(128, 16));
+  EXPECT_EQ(32, PackedBits(1, 32));
+  EXPECT_EQ(0, PackedSize(128, 0));
+  EXPECT_EQ(192, PackedSize(128, 12));
+
+  /* Exact ones are used if they are cheaper */
+  EXPECT_EQ(14, PackedBits(128, 14));
+  EXPECT_EQ(225, PackedSize(128, 14));
+  EXPECT_EQ(20, PackedBits(16, 20));
+  EXPECT_EQ(41, PackedSize(16, 20));
+
+  /* Otherwise, they are rounded up */
+  EXPECT_EQ(16, PackedBits(1, 13));
+  EXPECT_EQ(16, PackedBits(2, 15));
+  EXPECT_EQ(32, PackedBits(1, 31));
+}
+
+TEST(Vpacker32, CompressExactBits) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 65536;
+  char     *dst = new char[CompressBound(num)];
+  uint32_t *buf = new uint32_t[num];
+
+  /* 14-bit and 20-bit integers */
+  const int nbits[] = {14, 20};
+
+  for (size_t i = 0; i < ARRAYSIZE(nbits); i++) {
+    const uint32_t *dv =
+        tmgr.generate(&tv, num, 1U << nbits[i]);
+
+    size_t wsz = Compress(dv, dst, num);
+    EXPECT_TRUE(wsz < num * (nbits[i] + 1) / 8);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t j = 0; j < num; j++)
+      EXPECT_EQ(dv[j], buf[j]);
+  }
+
+  delete[] dst;
+  delete[] buf;
+}
+
+TEST(Vpacker32, UncompressBlockCorrupt) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 4096;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *tmp = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 12);
+
+  uint32_t wsz =
+      CompressBlock(dv, num, dst, dst + dbound);
+  ASSERT_TRUE(wsz > 8);
+
+  uint32_t offset = DecodeUint32LE(dst + 4);
+
+  /* Broken offsets */
+  memcpy(tmp, dst, wsz);
+  SetUint32LE(tmp + 4, 4);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  SetUint32LE(tmp + 4, wsz + 1);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  /* A broken block size */
+  memcpy(tmp, dst, wsz);
+  SetUint32LE(tmp, wsz + 1);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  /* Partitions do not cover integers */
+  memcpy(tmp, dst, wsz);
+  tmp[8] = (tmp[8] & 0x0f) |
+      (((tmp[8] & 0xf0) == 0x00)? 0x10 : 0x00);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  /* Bit lengths do not match with packed bytes */
+  memcpy(tmp, dst, wsz);
+  tmp[offset - 1] = (tmp[offset - 1] & 0xf0) |
+      (((tmp[offset - 1] & 0x0f) == 0x0e)? 0x00 : 0x0e);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  /* An original one works */
+  EXPECT_EQ(wsz, UncompressBlock(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(dv[i], buf[i]);
+
+  delete[] dst;
+  delete[] tmp;
+  delete[] buf;
+}
+
+TEST(Vpacker32, Compressor) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 3 * block_num + 100;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *ref = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+
+  /* One object is reused for various sizes */
+  Compressor c;
+
+  const size_t sizes[] = {
+    num, 1, 100, block_num, block_num + 1, 1000, num
+  };
+
+  for (size_t i = 0; i < ARRAYSIZE(sizes); i++) {
+    const uint32_t *dv =
+        tmgr.generate(&tv, sizes[i], 1U << 20);
+
+    size_t wsz = c.Compress(dv, dst, sizes[i]);
+    ASSERT_TRUE(wsz != 0);
+
+    /* The output is the same with Compress() */
+    EXPECT_EQ(wsz, Compress(dv, ref, sizes[i]));
+    EXPECT_EQ(0, memcmp(dst, ref, wsz));
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, sizes[i]));
+    for (size_t j = 0; j < sizes[i]; j++)
+      EXPECT_EQ(dv[j], buf[j]);
+  }
+
+  delete[] dst;
+  delete[] ref;
+  delete[] buf;
+}
+
+TEST(Vpacker32, CompressParallel) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 5 * block_num + 100;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *ref = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 20);
+
+  const size_t sizes[] = {
+    1, block_num, block_num + 1, 3 * block_num, num
+  };
+
+  const int nthreads[] = {2, 3, 8};
+
+  for (size_t i = 0; i < ARRAYSIZE(sizes); i++) {
+    size_t wsz = Compress(dv, ref, sizes[i]);
+    ASSERT_TRUE(wsz != 0);
+
+    /* The output is byte-identical to a serial one */
+    for (size_t j = 0; j < ARRAYSIZE(nthreads); j++) {
+      memset(dst, 0x00, dbound);
+
+      EXPECT_EQ(wsz, Compress(dv, dst, sizes[i], nthreads[j]));
+      EXPECT_EQ(0, memcmp(dst, ref, wsz));
+
+      EXPECT_EQ(wsz, Uncompress(dst, buf, sizes[i]));
+      for (size_t k = 0; k < sizes[i]; k++)
+        EXPECT_EQ(dv[k], buf[k]);
+    }
+  }
+
+  /* One object is reused */
+  Compressor c(4);
+
+  for (int i = 0; i < 2; i++) {
+    size_t wsz = c.Compress(dv, dst, num);
+
+    EXPECT_EQ(wsz, Compress(dv, ref, num));
+    EXPECT_EQ(0, memcmp(dst, ref, wsz));
+  }
+
+  delete[] dst;
+  delete[] ref;
+  delete[] buf;
+}
+
+TEST(Vpacker32, UncompressParallel) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 5 * block_num + 100;
+  size_t    nblock = 6;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 20);
+
+  size_t wsz_nodir = Compress(dv, dst, num);
+
+  for (int dir = 0; dir < 2; dir++) {
+    for (int nth = 1; nth <= 3; nth += 2) {
+      Compressor c(nth);
+      c.set_directory(dir != 0);
+
+      size_t wsz = c.Compress(dv, dst, num);
+
+      if (dir) {
+        EXPECT_EQ(wsz_nodir + 8 * nblock, wsz);
+        EXPECT_EQ(VP32_MAGICNUM_V2_DIR, DecodeUint64(dst));
+
+        /* The directory points to each block */
+        EXPECT_EQ(8 + 8 * nblock, DecodeUint64LE(dst + 8));
+
+        for (size_t i = 0; i + 1 < nblock; i++) {
+          size_t off = DecodeUint64LE(dst + 8 + 8 * i);
+          EXPECT_EQ(off + BlockSize(dst + off, block_num, format_v2),
+                    DecodeUint64LE(dst + 16 + 8 * i));
+        }
+      } else {
+        EXPECT_EQ(wsz_nodir, wsz);
+      }
+
+      const int nthreads[] = {1, 2, 4, 16};
+
+      for (size_t i = 0; i < ARRAYSIZE(nthreads); i++) {
+        memset(buf, 0x00, num * sizeof(uint32_t));
+
+        EXPECT_EQ(wsz, Uncompress(dst, buf, num, nthreads[i]));
+        for (size_t j = 0; j < num; j++)
+          EXPECT_EQ(dv[j], buf[j]);
+      }
+    }
+  }
+
+  /* A broken directory is detected */
+  size_t off = DecodeUint64LE(dst + 16);
+  SetUint64LE(dst + 16, off + 1);
+  EXPECT_EQ(0, Uncompress(dst, buf, num, 4));
+
+  /*
+   * Offsets out of the blocks are not followed,
+   * and the blocks are walked one by one.
+   */
+  const uint64_t broken[] = {
+    0, 1ULL << 40, ~0ULL - 7
+  };
+
+  for (size_t i = 0; i < ARRAYSIZE(broken); i++) {
+    for (size_t k = 0; k < 2; k++) {
+      SetUint64LE(dst + 8 + 8 * k, broken[i]);
+      memset(buf, 0x00, num * sizeof(uint32_t));
+
+      EXPECT_EQ(wsz_nodir + 8 * nblock, Uncompress(dst, buf, num, 4));
+      for (size_t j = 0; j < num; j++)
+        EXPECT_EQ(dv[j], buf[j]);
+    }
+  }
+
+  delete[] dst;
+  delete[] buf;
+}
+
+TEST(Vpacker32, DecodeRange) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 2 * block_num + 100;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint32_t *buf = new uint32_t[num + 1];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 20);
+
+  const size_t ranges[][2] = {
+    {0, 1}, {0, 200}, {5, 6}, {100, 300}, {1000, 1001},
+    {block_num - 40, block_num - 1}, {block_num - 1, block_num + 1},
+    {block_num - 3, 2 * block_num + 50}, {2 * block_num + 99, num},
+    {0, num}
+  };
+
+  for (int dir = 0; dir < 2; dir++) {
+    Compressor c;
+    c.set_directory(dir != 0);
+
+    ASSERT_TRUE(c.Compress(dv, dst, num) != 0);
+
+    for (size_t i = 0; i < ARRAYSIZE(ranges); i++) {
+      size_t begin = ranges[i][0];
+      size_t end = ranges[i][1];
+
+      /* A sentinel next to the range is kept */
+      buf[end - begin] = 0x5a;
+
+      EXPECT_EQ(end - begin, DecodeRange(dst, num, begin, end, buf));
+      for (size_t j = begin; j < end; j++)
+        EXPECT_EQ(dv[j], buf[j - begin]);
+
+      EXPECT_EQ(0x5a, buf[end - begin]);
+    }
+
+    for (size_t i = 0; i < num; i += 997)
+      EXPECT_EQ(dv[i], Get(dst, num, i));
+
+    EXPECT_EQ(dv[num - 1], Get(dst, num, num - 1));
+
+    /* Ranges out of the stream are invalid */
+    EXPECT_EQ(0, DecodeRange(dst, num, 10, 10, buf));
+    EXPECT_EQ(0, DecodeRange(dst, num, num - 1, num + 1, buf));
+
+    if (dir) {
+      /*
+       * Offsets out of the blocks are not followed,
+       * and the blocks are walked one by one.
+       */
+      const uint64_t broken[] = {
+        0, 1ULL << 40, ~0ULL - 7
+      };
+
+      for (size_t i = 0; i < ARRAYSIZE(broken); i++) {
+        for (size_t k = 0; k < 3; k++) {
+          SetUint64LE(dst + 8 + 8 * k, broken[i]);
+
+          EXPECT_EQ(200, DecodeRange(dst, num, 100, 300, buf));
+          for (size_t j = 100; j < 300; j++)
+            EXPECT_EQ(dv[j], buf[j - 100]);
+
+          EXPECT_EQ(50, DecodeRange(
+              dst, num, 2 * block_num + 50, num, buf));
+          for (size_t j = 2 * block_num + 50; j < num; j++)
+            EXPECT_EQ(dv[j], buf[j - 2 * block_num - 50]);
+        }
+      }
+    } else {
+      /* Broken sizes of blocks are not followed */
+      dst[8 + 3] ^= 0x40;
+      EXPECT_EQ(0, DecodeRange(dst, num, 2 * block_num, num, buf));
+      EXPECT_EQ(0, Get(dst, num, block_num));
+
+      dst[8 + 3] ^= 0x40;
+      SetUint32LE(dst + 8, 0);
+      EXPECT_EQ(0, DecodeRange(dst, num, 2 * block_num, num, buf));
+    }
+  }
+
+  delete[] dst;
+  delete[] buf;
+}
+
+TEST(Vpacker32, PrefixSum) {
+  uint32_t in[40];
+  uint32_t ref[40];
+  uint32_t buf[40];
+
+  for (size_t i = 0; i < ARRAYSIZE(in); i++)
+    in[i] = 0xfffffff0U + 3 * i;
+
+  vprefix32_t funcs[] = {PrefixSum, SelectPrefixSum()};
+
+  for (size_t n = 0; n <= ARRAYSIZE(in); n++) {
+    uint32_t base = 7;
+    for (size_t i = 0; i < n; i++)
+      ref[i] = base += in[i];
+
+    for (size_t k = 0; k < ARRAYSIZE(funcs); k++) {
+      memcpy(buf, in, sizeof(in));
+
+      EXPECT_EQ(base, funcs[k](buf, n, 7));
+      for (size_t i = 0; i < n; i++)
+        EXPECT_EQ(ref[i], buf[i]);
+      for (size_t i = n; i < ARRAYSIZE(in); i++)
+        EXPECT_EQ(in[i], buf[i]);
+    }
+  }
+}
+
+TEST(Vpacker32, CompressDelta) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 3 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+  uint32_t *sorted = new uint32_t[num];
+
+  /* Sorted integers from random gaps */
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 10);
+
+  sorted[0] = dv[0];
+  for (size_t i = 1; i < num; i++)
+    sorted[i] = sorted[i - 1] + dv[i];
+
+  const uint32_t *inputs[] = {sorted, dv};
+
+  for (size_t k = 0; k < ARRAYSIZE(inputs); k++) {
+    const uint32_t *in = inputs[k];
+    size_t plain = Compress(in, dst, num);
+
+    for (int nth = 1; nth <= 3; nth += 2) {
+      Compressor c(nth);
+      c.set_delta(true);
+
+      size_t wsz = c.Compress(in, dst, num);
+      ASSERT_TRUE(wsz != 0);
+
+      /* Gaps are much smaller than sorted integers */
+      if (in == sorted) {
+        EXPECT_GT(plain, wsz);
+        EXPECT_LT(wsz, num * 11 / 8);
+      }
+
+      memset(buf, 0x00, num * sizeof(uint32_t));
+
+      EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+      for (size_t i = 0; i < num; i++)
+        EXPECT_EQ(in[i], buf[i]);
+
+      memset(buf, 0x00, num * sizeof(uint32_t));
+
+      EXPECT_EQ(wsz, Uncompress(dst, buf, num, 4));
+      for (size_t i = 0; i < num; i++)
+        EXPECT_EQ(in[i], buf[i]);
+
+      /* Random access sums up gaps in a block */
+      for (size_t i = 0; i < num; i += 4999)
+        EXPECT_EQ(in[i], Get(dst, num, i));
+
+      EXPECT_EQ(300, DecodeRange(
+          dst, num, block_num + 200, block_num + 500, buf));
+      for (size_t i = 0; i < 300; i++)
+        EXPECT_EQ(in[block_num + 200 + i], buf[i]);
+    }
+  }
+
+  /* Integers wrap around in a delta block */
+  for (size_t i = 0; i < 1000; i++)
+    sorted[i] = 0xffffff00U + uint32_t(i);
+
+  Compressor c;
+  c.set_delta(true);
+
+  size_t wsz = c.Compress(sorted, dst, 1000);
+  EXPECT_EQ(wsz, Uncompress(dst, buf, 1000));
+  for (size_t i = 0; i < 1000; i++)
+    EXPECT_EQ(sorted[i], buf[i]);
+
+  delete[] dst;
+  delete[] buf;
+  delete[] sorted;
+}
+
+TEST(Vpacker32, Zigzag) {
+  const int32_t in[] = {
+    0, -1, 1, -2, 2, 0x7fffffff, -0x7fffffff - 1
+  };
+  const uint32_t ref[] = {
+    0, 1, 2, 3, 4, 0xfffffffeU, 0xffffffffU
+  };
+
+  for (size_t i = 0; i < ARRAYSIZE(in); i++)
+    EXPECT_EQ(ref[i], ZigzagEncode(static_cast<uint32_t>(in[i])));
+
+  /* SIMD ones are the same as a scalar one */
+  uint32_t buf[40];
+  vzigzag32_t funcs[] = {ZigzagDecode, SelectZigzagDecode()};
+
+  for (size_t k = 0; k < ARRAYSIZE(funcs); k++) {
+    for (size_t n = 0; n <= ARRAYSIZE(buf); n++) {
+      for (size_t i = 0; i < ARRAYSIZE(buf); i++)
+        buf[i] = ref[i % ARRAYSIZE(ref)];
+
+      funcs[k](buf, n);
+
+      for (size_t i = 0; i < ARRAYSIZE(buf); i++) {
+        EXPECT_EQ((i < n)? static_cast<uint32_t>(in[i % ARRAYSIZE(in)]) :
+                      ref[i % ARRAYSIZE(ref)], buf[i]);
+      }
+    }
+  }
+}
+
+TEST(Vpacker32, CompressSigned) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 2 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  int32_t  *buf = new int32_t[num];
+  int32_t  *in = new int32_t[num];
+
+  /* Small integers around zero */
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 12);
+
+  for (size_t i = 0; i < num; i++)
+    in[i] = static_cast<int32_t>(dv[i]) - (1 << 11);
+
+  size_t usize = Compress(
+      reinterpret_cast<const uint32_t *>(in), dst, num);
+
+  for (int nth = 1; nth <= 3; nth += 2) {
+    size_t wsz = Compress(in, dst, num, nth);
+    ASSERT_TRUE(wsz != 0);
+    EXPECT_GT(usize, wsz);
+    EXPECT_LT(wsz, num * 13 / 8);
+
+    memset(buf, 0x00, num * sizeof(int32_t));
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    memset(buf, 0x00, num * sizeof(int32_t));
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num, 4));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(100, DecodeRange(dst, num, 5000, 5100, buf));
+    for (size_t i = 0; i < 100; i++)
+      EXPECT_EQ(in[5000 + i], buf[i]);
+  }
+
+  /* Signed gaps with block_delta */
+  for (size_t i = 1; i < num; i++)
+    in[i] += in[i - 1];
+
+  Compressor c;
+  c.set_delta(true);
+
+  size_t wsz = c.Compress(in, dst, num);
+  ASSERT_TRUE(wsz != 0);
+  EXPECT_GT(usize, wsz);
+  EXPECT_LT(wsz, num * 13 / 8);
+
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  for (size_t i = 0; i < num; i += 3331)
+    EXPECT_EQ(static_cast<uint32_t>(in[i]), Get(dst, num, i));
+
+  delete[] dst;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker32, AddBase) {
+  uint32_t buf[40];
+  vaddbase32_t funcs[] = {AddBase, SelectAddBase()};
+
+  for (size_t k = 0; k < ARRAYSIZE(funcs); k++) {
+    for (size_t n = 0; n <= ARRAYSIZE(buf); n++) {
+      for (size_t i = 0; i < ARRAYSIZE(buf); i++)
+        buf[i] = i;
+
+      funcs[k](buf, n, 0xfffffff0U);
+
+      for (size_t i = 0; i < ARRAYSIZE(buf); i++)
+        EXPECT_EQ((i < n)? uint32_t(0xfffffff0U + i) : i, buf[i]);
+    }
+  }
+}
+
+TEST(Vpacker32, BitWidths) {
+  uint32_t in[100];
+  uint8_t  widths[101];
+  size_t   num = 0;
+
+  /* Integers around every power of two */
+  in[num++] = 0;
+  for (int b = 0; b < 32; b++) {
+    in[num++] = (1U << b) - 1;
+    in[num++] = 1U << b;
+    in[num++] = (1U << b) + 1;
+  }
+  in[num++] = 0xfffffffeU;
+  in[num++] = 0xffffffffU;
+
+  vwidths32_t funcs[] = {BitWidths, SelectBitWidths()};
+
+  for (size_t k = 0; k < ARRAYSIZE(funcs); k++) {
+    for (size_t n = 0; n <= num; n++) {
+      memset(widths, 0xff, sizeof(widths));
+      funcs[k](in, n, widths);
+
+      for (size_t i = 0; i < n; i++)
+        EXPECT_EQ(32 - VP32_MSB32(in[i]), widths[i]);
+
+      EXPECT_EQ(0xff, widths[n]);
+    }
+  }
+}
+
+TEST(Vpacker32, CompressFOR) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 2 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+  uint32_t *in = new uint32_t[num];
+
+  /* 8-bit ranges around 1,000,000 */
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 8);
+
+  for (size_t i = 0; i < num; i++)
+    in[i] = 1000000 + dv[i];
+
+  Packing p;
+  ChoosePacking(in, 128, &p);
+  EXPECT_EQ(ext_for, p.kind);
+  EXPECT_GE(8, p.nbits);
+  EXPECT_EQ(5 + 16 * p.nbits, p.size);
+
+  /* No base is needed for small integers */
+  ChoosePacking(dv, 128, &p);
+  EXPECT_EQ(ext_plain, p.kind);
+
+  size_t wsz = Compress(in, dst, num);
+  EXPECT_LT(wsz, num * 9 / 8);
+
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  EXPECT_EQ(500, DecodeRange(dst, num, 1000, 1500, buf));
+  for (size_t i = 0; i < 500; i++)
+    EXPECT_EQ(in[1000 + i], buf[i]);
+
+  /* Bases are added before gaps are summed up */
+  Compressor c;
+  c.set_delta(true);
+
+  for (size_t i = 0; i < num; i++)
+    in[i] = (i % 256 == 0)? 1U << 30 : dv[i];
+
+  wsz = c.Compress(in, dst, num);
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  delete[] dst;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker32, PatchedSize) {
+  uint32_t hist[33] = {0};
+  int nbits = -1;
+
+  /* 120 4-bit integers and 8 20-bit ones */
+  hist[4] = 120;
+  hist[20] = 8;
+
+  EXPECT_EQ(3 + 64 + 8 + 16,
+            PatchedSize(hist, 20, 128, 320, &nbits));
+  EXPECT_EQ(4, nbits);
+
+  /* A limit is returned if a patch is not cheaper */
+  nbits = -1;
+  EXPECT_EQ(90, PatchedSize(hist, 20, 128, 90, &nbits));
+  EXPECT_EQ(-1, nbits);
+
+  /* Patch lists are validated */
+  char src[2 + 16 + 3 + 6] = {0};
+  src[0] = 3;
+  src[1] = 16;
+  src[18] = 1;
+  src[19] = 5;
+  src[20] = 127;
+  EXPECT_EQ(27, CtrlTable::PatchSize(1, 128, src, src + 27));
+  EXPECT_EQ(-1, CtrlTable::PatchSize(1, 128, src, src + 26));
+  EXPECT_EQ(-1, CtrlTable::PatchSize(1, 64, src, src + 27));
+  EXPECT_EQ(-1, CtrlTable::PatchSize(17, 128, src, src + 27));
+
+  src[19] = 1;
+  EXPECT_EQ(-1, CtrlTable::PatchSize(1, 128, src, src + 27));
+}
+
+TEST(Vpacker32, CompressPatch) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 2 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+  uint32_t *in = new uint32_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 8);
+
+  /* 20-bit outliers in 8-bit integers */
+  for (size_t i = 0; i < num; i++)
+    in[i] = (i % 16 == 0)? dv[i] << 12 | 1 : dv[i];
+
+  Packing p;
+  ChoosePacking(in, 128, &p);
+  EXPECT_EQ(ext_patch, p.kind);
+  EXPECT_EQ(8, p.nbits);
+
+  size_t wsz = Compress(in, dst, num);
+  EXPECT_LT(wsz, num * 10 / 8);
+
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  EXPECT_EQ(500, DecodeRange(dst, num, 1000, 1500, buf));
+  for (size_t i = 0; i < 500; i++)
+    EXPECT_EQ(in[1000 + i], buf[i]);
+
+  /* 32-bit exceptions in zeros */
+  for (size_t i = 0; i < num; i++)
+    in[i] = (i % 64 == 0)? 0xffffffff - i : 0;
+
+  ChoosePacking(in, 128, &p);
+  EXPECT_EQ(ext_patch, p.kind);
+  EXPECT_EQ(0, p.nbits);
+
+  Compressor c;
+  c.set_delta(true);
+
+  for (int k = 0; k < 2; k++) {
+    wsz = (k == 0)? Compress(in, dst, num) :
+        c.Compress(in, dst, num);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+  }
+
+  delete[] dst;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker32, CompressRun) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 2 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+  uint32_t *in = new uint32_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 12);
+
+  /* Runs of 1000 integers in random ones */
+  for (size_t i = 0; i < num; i++)
+    in[i] = (i % 3000 < 1000)? 12345 : dv[i];
+
+  size_t parts[1300 + 1];
+  int np = ComputePartition(in, 1300, parts);
+  EXPECT_EQ(1000, parts[1] - parts[0]);
+  for (int i = 1; i < np; i++)
+    EXPECT_GE(128, parts[i + 1] - parts[i]);
+
+  Packing p;
+  ChoosePacking(in, 1000, &p);
+  EXPECT_EQ(ext_run, p.kind);
+  EXPECT_EQ(12345, p.base);
+
+  size_t wsz = Compress(in, dst, num);
+  EXPECT_LT(wsz, num * 2 * 14 / 3 / 8);
+
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  /* Ranges in and across runs */
+  const size_t ranges[][2] = {
+    {0, 1}, {500, 600}, {900, 1100}, {2999, 4200}, {3500, 3501}
+  };
+
+  Compressor c;
+
+  for (int k = 0; k < 2; k++) {
+    c.set_delta(k == 1);
+
+    /* Runs of the same gaps in delta blocks */
+    if (k == 1) {
+      for (size_t i = 0; i < num; i++)
+        in[i] = (i % 3000 < 1000)? 7 * i : dv[i];
+    }
+
+    wsz = c.Compress(in, dst, num);
+    ASSERT_TRUE(wsz != 0);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    for (size_t i = 0; i < ARRAYSIZE(ranges); i++) {
+      size_t lo = ranges[i][0], hi = ranges[i][1];
+
+      EXPECT_EQ(hi - lo, DecodeRange(dst, num, lo, hi, buf));
+      for (size_t j = lo; j < hi; j++)
+        EXPECT_EQ(in[j], buf[j - lo]);
+    }
+  }
+
+  /* Decreasing runs in signed integers */
+  int32_t *sin = reinterpret_cast<int32_t *>(in);
+  int32_t *sbuf = reinterpret_cast<int32_t *>(buf);
+
+  for (size_t i = 0; i < num; i++)
+    sin[i] = (i % 3000 < 1000)? -3 * int32_t(i) : dv[i];
+
+  wsz = c.Compress(sin, dst, num);
+  EXPECT_EQ(wsz, Uncompress(dst, sbuf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(sin[i], sbuf[i]);
+
+  EXPECT_EQ(1000, DecodeRange(dst, num, 2500, 3500, sbuf));
+  for (size_t i = 0; i < 1000; i++)
+    EXPECT_EQ(sin[2500 + i], sbuf[i]);
+
+  delete[] dst;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker32, Lookup) {
+  uint32_t dict[dict_max] = {0};
+  uint32_t buf[40];
+  vlookup32_t funcs[] = {Lookup, SelectLookup()};
+
+  for (size_t i = 0; i < 100; i++)
+    dict[i] = 0xfffffff0U - 3 * i;
+
+  for (size_t k = 0; k < ARRAYSIZE(funcs); k++) {
+    for (size_t n = 0; n <= ARRAYSIZE(buf); n++) {
+      for (size_t i = 0; i < ARRAYSIZE(buf); i++)
+        buf[i] = (i * 7) % 100;
+
+      /* Broken indices are masked */
+      buf[0] = 0xffffff00;
+
+      funcs[k](buf, n, dict);
+
+      for (size_t i = 0; i < ARRAYSIZE(buf); i++) {
+        uint32_t idx = (i == 0)? 0 : (i * 7) % 100;
+        EXPECT_EQ((i < n)? dict[idx] :
+                  (i == 0)? 0xffffff00 : idx, buf[i]);
+      }
+    }
+  }
+}
+
+TEST(Vpacker32, CompressDict) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 2 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *tmp = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+  uint32_t *in = new uint32_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 5);
+
+  /* 32 distinct integers in millions */
+  for (size_t i = 0; i < num; i++)
+    in[i] = 1000000 + 99991 * dv[i];
+
+  uint32_t dict[dict_max];
+  size_t ndict;
+
+  ASSERT_TRUE(BuildDict(in, 4096, dict, &ndict, buf));
+  EXPECT_GE(32, ndict);
+  for (size_t i = 0; i < 4096; i++) {
+    EXPECT_EQ(in[i], dict[buf[i]]);
+    if (i + 1 < ndict) {
+      EXPECT_LT(dict[i], dict[i + 1]);
+    }
+  }
+
+  /* Small integers or too many distinct ones */
+  EXPECT_FALSE(BuildDict(dv, 4096, dict, &ndict, buf));
+  for (size_t i = 0; i < 4096; i++)
+    buf[i] = 1000000 + i;
+  EXPECT_FALSE(BuildDict(buf, 4096, dict, &ndict, buf + 4096));
+
+  for (int k = 0; k < 2; k++) {
+    size_t wsz = (k == 0)?
+        Compress(in, dst, num) :
+        Compress(reinterpret_cast<int32_t *>(in), dst, num);
+    EXPECT_LT(wsz, num * 6 / 8);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(500, DecodeRange(dst, num, 1000, 1500, buf));
+    for (size_t i = 0; i < 500; i++)
+      EXPECT_EQ(in[1000 + i], buf[i]);
+  }
+
+  /* Broken dictionaries */
+  uint32_t wsz = CompressBlock(in, 4096, dst, dst + dbound);
+  ASSERT_EQ(block_dict, DecodeUint32LE(dst + 4) >> 24);
+  EXPECT_EQ(wsz, UncompressBlock(dst, buf, 4096));
+
+  const uint32_t ndicts[] = {0, dict_max + 1, 1U << 20};
+
+  for (size_t i = 0; i < ARRAYSIZE(ndicts); i++) {
+    memcpy(tmp, dst, wsz);
+    SetUint32LE(tmp + 8, ndicts[i]);
+    EXPECT_EQ(0, UncompressBlock(tmp, buf, 4096));
+    EXPECT_FALSE(UncompressBlockRange(
+        tmp, 4096, format_v2, 0, 1, buf));
+  }
+
+  memcpy(tmp, dst, wsz);
+  tmp[7] |= block_delta;
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, 4096));
+
+  delete[] dst;
+  delete[] tmp;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker32, CompressAuto) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 3 * block_num;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+  uint32_t *in = new uint32_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 10);
+
+  /* Sorted, small, and signed small integers */
+  in[0] = 0;
+  for (size_t i = 1; i < block_num; i++)
+    in[i] = in[i - 1] + dv[i];
+  for (size_t i = block_num; i < 2 * block_num; i++)
+    in[i] = dv[i];
+  for (size_t i = 2 * block_num; i < num; i++)
+    in[i] = dv[i] - (1U << 9);
+
+  EXPECT_EQ(block_delta, ChooseBlockFlags(in, block_num));
+  EXPECT_EQ(0, ChooseBlockFlags(in + block_num, block_num));
+  EXPECT_EQ(block_zigzag,
+            ChooseBlockFlags(in + 2 * block_num, block_num));
+  EXPECT_EQ(0, ChooseBlockFlags(in + block_num, 300));
+
+  size_t plain = Compress(in, dst, num);
+
+  for (int nth = 1; nth <= 3; nth += 2) {
+    Compressor c(nth);
+    c.set_auto(true);
+
+    size_t wsz = c.Compress(in, dst, num);
+    ASSERT_TRUE(wsz != 0);
+    EXPECT_LT(wsz, plain * 3 / 4);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(1000, DecodeRange(
+        dst, num, block_num - 500, block_num + 500, buf));
+    for (size_t i = 0; i < 1000; i++)
+      EXPECT_EQ(in[block_num - 500 + i], buf[i]);
+  }
+
+  delete[] dst;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker32, CompressLevel) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 3 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *tmp = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+  uint32_t *in = new uint32_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 20);
+
+  /* Skewed integers, outliers, and runs */
+  for (size_t i = 0; i < num; i++) {
+    in[i] = (i % 10 == 0)? dv[i] : dv[i] & 0xff;
+    if (i % 997 == 0)
+      in[i] = dv[i] << 11;
+    if ((i / 5000) % 3 == 2)
+      in[i] = 7;
+  }
+
+  size_t best = Compress(in, dst, num);
+
+  for (int nth = 1; nth <= 3; nth += 2) {
+    Compressor c(nth);
+    c.set_level(level_fast);
+
+    size_t wsz = c.Compress(in, dst, num);
+    ASSERT_TRUE(wsz != 0);
+    EXPECT_LT(wsz, best * 11 / 10);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(1000, DecodeRange(
+        dst, num, block_num - 500, block_num + 500, buf));
+    for (size_t i = 0; i < 1000; i++)
+      EXPECT_EQ(in[block_num - 500 + i], buf[i]);
+  }
+
+  /* Levels are clamped */
+  Compressor c;
+  c.set_level(level_fast);
+  size_t wsz = c.Compress(in, tmp, num);
+
+  c.set_level(0);
+  EXPECT_EQ(wsz, c.Compress(in, dst, num));
+  EXPECT_EQ(0, memcmp(dst, tmp, wsz));
+
+  c.set_level(level_max + 1);
+  EXPECT_EQ(best, c.Compress(in, dst, num));
+
+  /* Delta and signed blocks */
+  c.set_level(level_fast);
+  c.set_delta(true);
+
+  for (size_t i = 1; i < num; i++)
+    in[i] = in[i - 1] + (dv[i] & 0x3f);
+
+  wsz = c.Compress(in, dst, num);
+  EXPECT_LT(wsz, num);
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  c.set_delta(false);
+
+  for (size_t i = 0; i < num; i++)
+    in[i] = (dv[i] & 0x3f) - 32;
+
+  wsz = c.Compress(reinterpret_cast<int32_t *>(in), dst, num);
+  EXPECT_LT(wsz, num);
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  delete[] dst;
+  delete[] tmp;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker32, CompressPenalty) {
+  TestDataMgr<uint32_t> tmgr;
+  std::vector<uint32_t> tv;
+
+  size_t    num = 3 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *tmp = new char[dbound];
+  uint32_t *buf = new uint32_t[num];
+  uint32_t *in = new uint32_t[num];
+  size_t   *parts = new size_t[num];
+
+  const uint32_t *dv =
+      tmgr.generate(&tv, num, 1U << 20);
+
+  /* Skewed integers with outliers */
+  for (size_t i = 0; i < num; i++) {
+    in[i] = (i % 10 == 0)? dv[i] : dv[i] & 0xff;
+    if (i % 997 == 0)
+      in[i] = dv[i] << 11;
+  }
+
+  /* Larger penalties give less partitions */
+  Workspace ws;
+  ASSERT_TRUE(ws.Reserve(block_num));
+  BitWidths(in, block_num, ws.widths());
+
+  int np = ComputePartition(in, block_num, parts, ws);
+  int fnp = ComputeFastPartition(in, block_num, parts, ws);
+
+  for (int penalty = 1; penalty <= penalty_max; penalty *= 4) {
+    int pnp = ComputePartition(in, block_num, parts, ws, penalty);
+    EXPECT_GE(np, pnp);
+    np = pnp;
+
+    EXPECT_EQ(0, parts[0]);
+    EXPECT_EQ(block_num, parts[pnp]);
+
+    pnp = ComputeFastPartition(in, block_num, parts, ws, penalty);
+    EXPECT_GE(fnp, pnp);
+    fnp = pnp;
+  }
+
+  size_t best = Compress(in, dst, num);
+
+  for (int level = level_fast; level <= level_max; level++) {
+    Compressor c(3);
+    c.set_level(level);
+
+    for (int penalty = 0;
+          penalty <= penalty_max; penalty += penalty_max / 4) {
+      c.set_penalty(penalty);
+
+      size_t wsz = c.Compress(in, dst, num);
+      ASSERT_TRUE(wsz != 0);
+      EXPECT_LT(wsz, best * 2);
+
+      EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+      for (size_t i = 0; i < num; i++)
+        EXPECT_EQ(in[i], buf[i]);
+    }
+  }
+
+  /* Penalties are clamped */
+  Compressor c;
+  EXPECT_EQ(best, c.Compress(in, tmp, num));
+
+  c.set_penalty(-1);
+  EXPECT_EQ(best, c.Compress(in, dst, num));
+  EXPECT_EQ(0, memcmp(dst, tmp, best));
+
+  c.set_penalty(penalty_max);
+  size_t wsz = c.Compress(in, tmp, num);
+  EXPECT_LE(best, wsz);
+
+  c.set_penalty(penalty_max + 1);
+  EXPECT_EQ(wsz, c.Compress(in, dst, num));
+  EXPECT_EQ(0, memcmp(dst, tmp, wsz));
+
+  delete[] dst;
+  delete[] tmp;
+  delete[] buf;
+  delete[] in;
+  delete[] parts;
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
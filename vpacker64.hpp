@@ -14,10 +14,38 @@
 #define __INCLUDE_VPACKER64_HPP__
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
 
+#include <new>
+#include <algorithm>
+
+/*
+ * SIMD functions are compiled with target
+ * attributes on x86 processors, so they do not
+ * depend on compiler options such as -march.
+ * One of them is selected at runtime by using
+ * cpuid.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) &&  \
+    (defined(__clang__) || __GNUC__ > 4 ||         \
+        (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# include <immintrin.h>
+# define VP64_HAVE_AVX2
+# define VP64_TARGET_AVX2   __attribute__((target("avx2")))
+#endif
+
+/*
+ * Compressor uses POSIX threads to compress
+ * blocks concurrently if they are available.
+ */
+#if defined(__GNUC__) && (defined(__unix__) || defined(__APPLE__))
+# include <pthread.h>
+# define VP64_HAVE_PTHREAD
+#endif
+
 /* A C99 standard option */
 #if __STDC_VERSION__ < 199901L
 # define restrict
@@ -41,6 +69,18 @@
 # define VP64_ASSERT(__x__)
 #endif
 
+/*
+ * Byte-order detection; multi-byte values are
+ * loaded at once if it is known.
+ */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+# if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define VP64_LITTLE_ENDIAN
+# elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#  define VP64_BIG_ENDIAN
+# endif
+#endif
+
 /* Hardware bit-count detection */
 #if defined(__GNUC__)
 # define VP64_MSB64(__x__)  \
@@ -81,6 +121,24 @@ namespace vpacker64 {
  */
 static const uint64_t VP64_MAGICNUM = 0x08b5a7033f4cbc3dULL;
 
+/*
+ * VP64_MAGICNUM_V2 marks the second format, in
+ * which block headers, raw integers, and 64-bit
+ * partitions are stored in little-endian. It was
+ * picked in the same way as the above, and
+ * Uncompress() accepts both formats.
+ */
+static const uint64_t VP64_MAGICNUM_V2 = 0xd71f940416633081ULL;
+
+/*
+ * VP64_MAGICNUM_V2_DIR marks v2 streams that have
+ * a block directory just after the magic number.
+ * The directory has little-endian 64-bit byte
+ * offsets of all the blocks from the head of
+ * a stream, so they can be decoded in parallel.
+ */
+static const uint64_t VP64_MAGICNUM_V2_DIR = 0xad8a69d22ba1d382ULL;
+
 namespace backend {
 
 /*
@@ -107,6 +165,20 @@ static const int roundup_bits[] = {
   64, 64, 64, 64, 64, 64, 64, 64
 };
 
+/*
+ * Round-up bit lengths for wide blocks below;
+ * any length up to 56 bits is used as it is.
+ */
+static const int roundup_wide_bits[] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+  11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
+  21, 22, 23, 24, 25, 26, 27, 28, 29, 30,
+  31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+  41, 42, 43, 44, 45, 46, 47, 48, 49, 50,
+  51, 52, 53, 54, 55, 56,
+  64, 64, 64, 64, 64, 64, 64, 64
+};
+
 /*
  * Partition lengths split by using Dynamic
  * Programming in ComputePartition().
@@ -188,6 +260,86 @@ static const char ctrl_partition[] = {
  */
 static const size_t block_num = 65536;
 
+/* Format versions marked by the magic numbers */
+static const int format_v1 = 1;
+static const int format_v2 = 2;
+
+/*
+ * Flags of a block in the v2 format, which are
+ * stored in the top byte of the offset in a block
+ * header. A block with block_delta has the gaps
+ * between adjacent integers, and a 64-bit base
+ * value follows the header. block_zigzag maps
+ * signed integers (or signed gaps with
+ * block_delta) to unsigned ones by zigzag
+ * encoding, so small negative ones are packed
+ * into a few bits.
+ *
+ * A block with block_dict has a dictionary of
+ * up to dict_max distinct integers after the
+ * header; 32-bit # of entries and the sorted
+ * 64-bit entries in little-endian follow, and
+ * packed integers are indices of the entries.
+ * It is not used with the other flags.
+ *
+ * For time series, a block with block_dod has
+ * the gaps of the gaps (delta-of-delta), which
+ * are zero for regular timestamps, and a block
+ * with block_xor has XORs of adjacent integers,
+ * which have leading zeros for close doubles.
+ * They have a base value as block_delta, and
+ * only one of the three is used in a block.
+ *
+ * A block with block_wide has 2-byte control
+ * bytes instead; the first byte is a bit length
+ * in roundup_wide_bits[], and the second one is
+ * an index of partition_length[]. It is used
+ * with any other flags for wide integers such as
+ * 40-bit IDs, which are otherwise packed in
+ * 64 bits.
+ */
+static const uint32_t block_delta = 0x01;
+static const uint32_t block_zigzag = 0x02;
+static const uint32_t block_dict = 0x04;
+static const uint32_t block_dod = 0x08;
+static const uint32_t block_xor = 0x10;
+static const uint32_t block_wide = 0x20;
+static const uint32_t block_known_flags =
+    block_delta | block_zigzag | block_dict |
+    block_dod | block_xor | block_wide;
+
+/* Flags with a base value after a header */
+static const uint32_t block_based =
+    block_delta | block_dod | block_xor;
+
+static const size_t dict_max = 256;
+
+/*
+ * block_auto is not stored in blocks; it makes
+ * CompressBlock() choose block_delta,
+ * block_dod, block_xor, and block_zigzag for
+ * each block by sampling.
+ */
+static const uint32_t block_auto = 0x80;
+
+/*
+ * Compression levels; level_fast computes
+ * partitions in linear time, and level_max
+ * computes optimal ones by DP. Both of them
+ * output the same format.
+ */
+static const int level_fast = 1;
+static const int level_max = 2;
+
+/*
+ * Partitioning charges each partition its control
+ * bytes and a penalty in bytes up to penalty_max;
+ * a larger penalty gives less and longer
+ * partitions, which are faster to decode, for
+ * a little larger output.
+ */
+static const int penalty_max = 256;
+
 
 /*-------------------------------------------------
  * A writer/reader for a given unsigned value
@@ -204,16 +356,34 @@ static const size_t block_num = 65536;
  *  return : 16/32/64-bit value to read
  *-------------------------------------------------
  */
+/*
+ * If byte-ordering is known, the writers below
+ * use a unaligned store with memcpy() as
+ * the readers do.
+ */
 inline void SetUint32(char *restrict out,
                       uint32_t v) {
+#if defined(VP64_LITTLE_ENDIAN)
+  v = __builtin_bswap32(v);
+  memcpy(out, &v, sizeof(v));
+#elif defined(VP64_BIG_ENDIAN)
+  memcpy(out, &v, sizeof(v));
+#else
   out[0] = (v >> 24) & 0xff;
   out[1] = (v >> 16) & 0xff;
   out[2] = (v >> 8) & 0xff;
   out[3] = v & 0xff;
+#endif
 }
 
 inline void SetUint64(char *restrict out,
                       uint64_t v) {
+#if defined(VP64_LITTLE_ENDIAN)
+  v = __builtin_bswap64(v);
+  memcpy(out, &v, sizeof(v));
+#elif defined(VP64_BIG_ENDIAN)
+  memcpy(out, &v, sizeof(v));
+#else
   out[0] = (v >> 56) & 0xff;
   out[1] = (v >> 48) & 0xff;
   out[2] = (v >> 40) & 0xff;
@@ -222,6 +392,7 @@ inline void SetUint64(char *restrict out,
   out[5] = (v >> 16) & 0xff;
   out[6] = (v >> 8) & 0xff;
   out[7] = v & 0xff;
+#endif
 }
 
 inline uint16_t
@@ -231,20 +402,230 @@ inline uint16_t
   return v;
 }
 
+/*
+ * If byte-ordering is known, the readers below
+ * use a unaligned load with memcpy(), which
+ * compilers translate into a single instruction.
+ */
 inline uint32_t
     DecodeUint32(const char *restrict in) {
+#if defined(VP64_LITTLE_ENDIAN)
+  uint32_t v;
+  memcpy(&v, in, sizeof(v));
+  return __builtin_bswap32(v);
+#elif defined(VP64_BIG_ENDIAN)
+  uint32_t v;
+  memcpy(&v, in, sizeof(v));
+  return v;
+#else
   uint32_t v = in[0] & 0xff;
   for (int i = 1; i < 4; i++)
     v = (v << 8) | (in[i] & 0xff);
   return v;
+#endif
 }
 
 inline uint64_t
     DecodeUint64(const char *restrict in) {
+#if defined(VP64_LITTLE_ENDIAN)
+  uint64_t v;
+  memcpy(&v, in, sizeof(v));
+  return __builtin_bswap64(v);
+#elif defined(VP64_BIG_ENDIAN)
+  uint64_t v;
+  memcpy(&v, in, sizeof(v));
+  return v;
+#else
   uint64_t v = in[0] & 0xff;
   for (int i = 1; i < 8; i++)
     v = (v << 8) | (in[i] & 0xff);
   return v;
+#endif
+}
+
+/*
+ * Little-endian writers/readers for the v2
+ * format. The ones for arrays below switch byte
+ * ordering by a format version, and the arrays
+ * are just copied with memcpy() in v2 if
+ * a running processor is little-endian.
+ */
+inline void SetUint32LE(char *restrict out,
+                        uint32_t v) {
+#if defined(VP64_LITTLE_ENDIAN)
+  memcpy(out, &v, sizeof(v));
+#elif defined(VP64_BIG_ENDIAN)
+  v = __builtin_bswap32(v);
+  memcpy(out, &v, sizeof(v));
+#else
+  for (int i = 0; i < 4; i++)
+    out[i] = (v >> (8 * i)) & 0xff;
+#endif
+}
+
+inline uint32_t
+    DecodeUint32LE(const char *restrict in) {
+  uint32_t v;
+#if defined(VP64_LITTLE_ENDIAN)
+  memcpy(&v, in, sizeof(v));
+#elif defined(VP64_BIG_ENDIAN)
+  memcpy(&v, in, sizeof(v));
+  v = __builtin_bswap32(v);
+#else
+  v = 0;
+  for (int i = 4 - 1; i >= 0; i--)
+    v = (v << 8) | (in[i] & 0xff);
+#endif
+  return v;
+}
+
+inline void SetUint64LE(char *restrict out,
+                        uint64_t v) {
+#if defined(VP64_LITTLE_ENDIAN)
+  memcpy(out, &v, sizeof(v));
+#elif defined(VP64_BIG_ENDIAN)
+  v = __builtin_bswap64(v);
+  memcpy(out, &v, sizeof(v));
+#else
+  for (int i = 0; i < 8; i++)
+    out[i] = (v >> (8 * i)) & 0xff;
+#endif
+}
+
+inline uint64_t
+    DecodeUint64LE(const char *restrict in) {
+  uint64_t v;
+#if defined(VP64_LITTLE_ENDIAN)
+  memcpy(&v, in, sizeof(v));
+#elif defined(VP64_BIG_ENDIAN)
+  memcpy(&v, in, sizeof(v));
+  v = __builtin_bswap64(v);
+#else
+  v = 0;
+  for (int i = 8 - 1; i >= 0; i--)
+    v = (v << 8) | (in[i] & 0xff);
+#endif
+  return v;
+}
+
+inline void SetUint64s(char *restrict out,
+                       const uint64_t *restrict v,
+                       size_t n, int version) {
+  if (version == format_v1) {
+    for (size_t i = 0; i < n; i++)
+      SetUint64(out + 8 * i, v[i]);
+    return;
+  }
+
+#if defined(VP64_LITTLE_ENDIAN)
+  memcpy(out, v, n * sizeof(uint64_t));
+#else
+  for (size_t i = 0; i < n; i++)
+    SetUint64LE(out + 8 * i, v[i]);
+#endif
+}
+
+inline void DecodeUint64s(const char *restrict in,
+                          uint64_t *restrict v,
+                          size_t n, int version) {
+  if (version == format_v1) {
+    for (size_t i = 0; i < n; i++)
+      v[i] = DecodeUint64(in + 8 * i);
+    return;
+  }
+
+#if defined(VP64_LITTLE_ENDIAN)
+  memcpy(v, in, n * sizeof(uint64_t));
+#else
+  for (size_t i = 0; i < n; i++)
+    v[i] = DecodeUint64LE(in + 8 * i);
+#endif
+}
+
+/*
+ * A writer/reader for a block header, which has
+ * the size of a block, the offset of packed
+ * data in the block, and block flags in v2.
+ * BlockHeaderSize() includes values following
+ * the header for the flags.
+ */
+inline void SetBlockHeader(char *restrict out,
+                           uint32_t block_size,
+                           uint32_t offset,
+                           uint32_t flags,
+                           int version) {
+  VP64_ASSERT(offset < (1U << 24));
+  VP64_ASSERT(flags == 0 || version != format_v1);
+
+  if (version == format_v1) {
+    SetUint32(out, block_size);
+    SetUint32(out + 4, offset);
+  } else {
+    SetUint32LE(out, block_size);
+    SetUint32LE(out + 4, offset | (flags << 24));
+  }
+}
+
+inline void DecodeBlockHeader(const char *restrict in,
+                              uint32_t *block_size,
+                              uint32_t *offset,
+                              uint32_t *flags,
+                              int version) {
+  if (version == format_v1) {
+    *block_size = DecodeUint32(in);
+    *offset = DecodeUint32(in + 4);
+    *flags = 0;
+  } else {
+    *block_size = DecodeUint32LE(in);
+    *offset = DecodeUint32LE(in + 4) & 0xffffff;
+    *flags = DecodeUint32LE(in + 4) >> 24;
+  }
+}
+
+inline uint32_t BlockHeaderSize(uint32_t flags) {
+  return (flags & block_based)? 16 : 8;
+}
+
+inline bool ValidBlockFlags(uint32_t flags) {
+  uint32_t based = flags & block_based;
+  return (flags & ~block_known_flags) == 0 &&
+      (based & (based - 1)) == 0;
+}
+
+/*
+ * A reader for a dictionary of a block_dict
+ * block; dict[] gets the entries padded with 0,
+ * and *ctrl_offset gets the head of control
+ * bytes for any flags. It returns false if the
+ * dictionary is broken.
+ */
+inline bool DecodeBlockDict(const char *restrict in,
+                            uint32_t flags,
+                            uint32_t offset,
+                            uint32_t *ctrl_offset,
+                            uint64_t *restrict dict) {
+  *ctrl_offset = BlockHeaderSize(flags);
+
+  if ((flags & block_dict) == 0)
+    return offset >= *ctrl_offset;
+
+  if ((flags & ~block_wide) != block_dict ||
+        offset < *ctrl_offset + 4)
+    return false;
+
+  uint32_t ndict = DecodeUint32LE(in + *ctrl_offset);
+
+  if (ndict == 0 || ndict > dict_max ||
+        offset < *ctrl_offset + 4 + 8 * ndict)
+    return false;
+
+  for (uint32_t i = 0; i < dict_max; i++) {
+    dict[i] = (i < ndict)?
+        DecodeUint64LE(in + *ctrl_offset + 4 + 8 * i) : 0;
+  }
+
+  *ctrl_offset += 4 + 8 * ndict;
+  return true;
 }
 
 
@@ -294,15 +675,35 @@ inline int WriteBits(const uint64_t *src,
 
   /*
    * Otherwise, buffer written bits in a 64-bit
-   * value (buf), and write them.
+   * value (buf), and write them. Integers over
+   * 32 bits are split into upper (hbits) and
+   * lower (lbits) bits so that buf never
+   * overflows.
    */
   int       nused = 0;
   uint64_t  buf = 0;
 
+  int hbits = (nbits > 32)? nbits - 32 : 0;
+  int lbits = nbits - hbits;
+
   for (size_t i = 0; i < n; i++) {
-    buf = (buf << nbits) |
-        (src[i] & ((uint64_t(1) << nbits) - 1));
-    nused += nbits;
+    if (hbits > 0) {
+      buf = (buf << hbits) |
+          ((src[i] >> lbits) & ((uint64_t(1) << hbits) - 1));
+      nused += hbits;
+
+      if (nused >= 32) {
+        uint32_t w = (buf >> (nused - 32)) &
+            ((uint64_t(1) << 32) - 1);
+        SetUint32(dst, w);
+        nused -= 32;
+        dst += 4;
+      }
+    }
+
+    buf = (buf << lbits) |
+        (src[i] & ((uint64_t(1) << lbits) - 1));
+    nused += lbits;
 
     if (nused >= 32) {
       uint32_t w = (buf >> (nused - 32)) &
@@ -333,21 +734,476 @@ inline int WriteBits(const uint64_t *src,
 }
 
 
+/*-------------------------------------------------
+ * Packers specialized on a bit length B, which
+ * write the same bytes as WriteBits(). Each group
+ * of 32 integers, or 4 * B bytes, is packed into
+ * 64-bit words with shifts fixed in compile time,
+ * and a full word is stored at once; an integer
+ * over the word is split into the two. Left
+ * groups of 8 integers, or B bytes, are packed
+ * in the same way, and the others are written
+ * by WriteBits().
+ *
+ * The interface is the same as WriteBits().
+ *-------------------------------------------------
+ */
+typedef int (*vwrite64_t)(const uint64_t *src,
+                          size_t n,
+                          char *dst,
+                          const char *restrict dlimit);
+
+template <int B, int N, int K, int NUSED>
+struct WordPacker {
+  /*
+   * NUSED is # of bits in a current word, and the
+   * word is stored if the K-th integer fills it;
+   * the upper kFill bits of the integer go to the
+   * word, and the rest start a next one.
+   */
+  static const bool kStore = (NUSED + B >= 64);
+  static const int  kFill = kStore? 64 - NUSED : B;
+  static const int  kNused = kStore? NUSED + B - 64 : NUSED + B;
+
+  static inline void Run(const uint64_t *restrict src,
+                         char *restrict dst,
+                         uint64_t *w) {
+    uint64_t v = src[K] & ((uint64_t(1) << B) - 1);
+
+    if (kStore) {
+      SetUint64(dst + (((K + 1) * B - kNused) >> 3) - 8,
+                (*w << kFill) | (v >> (B - kFill)));
+      *w = v;
+    } else {
+      *w = (*w << B) | v;
+    }
+
+    WordPacker<B, N, K + 1, kNused>::Run(src, dst, w);
+  }
+};
+
+template <int B, int N, int NUSED>
+struct WordPacker<B, N, N, NUSED> {
+  /*
+   * Left bits are in bytes because N * B is,
+   * and they are 0 or 32 bits if N == 32.
+   */
+  static inline void Run(const uint64_t *restrict,
+                         char *restrict dst,
+                         uint64_t *w) {
+    if (NUSED == 32) {
+      SetUint32(dst + (N * B - NUSED) / 8, *w);
+      return;
+    }
+
+    for (int i = 0; i < (NUSED >> 3); i++) {
+      dst[(N * B - NUSED) / 8 + i] =
+          (*w >> (NUSED - 8 - 8 * i)) & 0xff;
+    }
+  }
+};
+
+template <int B, int N>
+inline void PackWordFast(const uint64_t *restrict src,
+                         char *restrict dst,
+                         size_t n) {
+  for (size_t i = 0; i < n; i += N) {
+    uint64_t w = 0;
+    WordPacker<B, N, 0, 0>::Run(src, dst, &w);
+
+    src += N;
+    dst += (N * B) / 8;
+  }
+}
+
+template <int B>
+inline int PackWord(const uint64_t *src,
+                    size_t n,
+                    char *dst,
+                    const char *restrict dlimit) {
+  VP64_ASSERT(n <= 128);
+
+  int nwritten = VP64_DIV_ROUNDUP(B * n, 8);
+  if (dst + nwritten > dlimit)
+    return -1;
+
+  size_t i = n & ~size_t(31);
+  PackWordFast<B, 32>(src, dst, i);
+
+  size_t j = n & ~size_t(7);
+  PackWordFast<B, 8>(src + i, dst + (i / 8) * B, j - i);
+
+  /* Write left integers */
+  if (j < n)
+    WriteBits(src + j, B, n - j, dst + (j / 8) * B, dlimit);
+
+  return nwritten;
+}
+
+inline int PackWord0(const uint64_t *,
+                     size_t n,
+                     char *dst,
+                     const char *restrict dlimit) {
+  VP64_ASSERT(n <= 128);
+  (void)n;
+  return (dst > dlimit)? -1 : 0;
+}
+
+/* 64-bit integers are just stored in v1 */
+inline int PackWord64(const uint64_t *src,
+                      size_t n,
+                      char *dst,
+                      const char *restrict dlimit) {
+  return WriteBits(src, 64, n, dst, dlimit);
+}
+
+/*
+ * A table of the packers above, which is indexed
+ * by a bit length. Wide blocks round 57-63 bits
+ * up to 64 bits, so they are not used.
+ */
+static const vwrite64_t word_packers[65] = {
+  PackWord0, PackWord<1>, PackWord<2>, PackWord<3>, PackWord<4>,
+  PackWord<5>, PackWord<6>, PackWord<7>, PackWord<8>, PackWord<9>,
+  PackWord<10>, PackWord<11>, PackWord<12>, PackWord<13>,
+  PackWord<14>, PackWord<15>, PackWord<16>, PackWord<17>,
+  PackWord<18>, PackWord<19>, PackWord<20>, PackWord<21>,
+  PackWord<22>, PackWord<23>, PackWord<24>, PackWord<25>,
+  PackWord<26>, PackWord<27>, PackWord<28>, PackWord<29>,
+  PackWord<30>, PackWord<31>, PackWord<32>, PackWord<33>,
+  PackWord<34>, PackWord<35>, PackWord<36>, PackWord<37>,
+  PackWord<38>, PackWord<39>, PackWord<40>, PackWord<41>,
+  PackWord<42>, PackWord<43>, PackWord<44>, PackWord<45>,
+  PackWord<46>, PackWord<47>, PackWord<48>, PackWord<49>,
+  PackWord<50>, PackWord<51>, PackWord<52>, PackWord<53>,
+  PackWord<54>, PackWord<55>, PackWord<56>, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, PackWord64
+};
+
+
+/*-------------------------------------------------
+ * A function computes bit lengths of integers in
+ * one pass before partitioning, and then the DP
+ * and the packer read them instead of counting
+ * leading zeros for each candidate.
+ *
+ *  src    : integer array in a block
+ *  n      : # of the integers
+ *  widths : result bit lengths (0...64)
+ *-------------------------------------------------
+ */
+inline void BitWidths(const uint64_t *restrict src,
+                      size_t n,
+                      uint8_t *restrict widths) {
+  for (size_t i = 0; i < n; i++)
+    widths[i] = 64 - VP64_MSB64(src[i]);
+}
+
+
+/*-------------------------------------------------
+ * Working space for ComputePartition() and
+ * CompressBlock(); each array needs (n + 1)
+ * entries for n integers, values() keeps
+ * integers transformed for block flags, and
+ * widths() keeps their bit lengths. Compressor
+ * keeps the space, so it is reused among blocks
+ * and calls instead of taking stack space.
+ *-------------------------------------------------
+ */
+class Workspace {
+ public:
+  Workspace()
+      : refs_(NULL), costs_(NULL), parts_(NULL),
+        values_(NULL), widths_(NULL), capacity_(0) {}
+  ~Workspace() {Release();}
+
+  /* Make room for n integers, or return false */
+  bool Reserve(size_t n) {
+    if (n <= capacity_ && refs_ != NULL)
+      return true;
+
+    Release();
+
+    refs_ = new(std::nothrow) int64_t[n + 1];
+    costs_ = new(std::nothrow) uint64_t[n + 1];
+    parts_ = new(std::nothrow) size_t[n + 1];
+    values_ = new(std::nothrow) uint64_t[n + 1];
+    widths_ = new(std::nothrow) uint8_t[n + 1];
+
+    if (refs_ == NULL || costs_ == NULL ||
+          parts_ == NULL || values_ == NULL ||
+          widths_ == NULL) {
+      Release();
+      return false;
+    }
+
+    capacity_ = n;
+    return true;
+  }
+
+  int64_t *refs() const {return refs_;}
+  uint64_t *costs() const {return costs_;}
+  size_t *parts() const {return parts_;}
+  uint64_t *values() const {return values_;}
+  uint8_t *widths() const {return widths_;}
+
+ private:
+  void Release() {
+    delete[] refs_;
+    delete[] costs_;
+    delete[] parts_;
+    delete[] values_;
+    delete[] widths_;
+
+    refs_ = NULL;
+    costs_ = NULL;
+    parts_ = NULL;
+    values_ = NULL;
+    widths_ = NULL;
+    capacity_ = 0;
+  }
+
+  int64_t   *refs_;
+  uint64_t  *costs_;
+  size_t    *parts_;
+  uint64_t  *values_;
+  uint8_t   *widths_;
+  size_t    capacity_;
+
+  /* Not copyable */
+  Workspace(const Workspace &);
+  void operator=(const Workspace &);
+};
+
+
+/*-------------------------------------------------
+ * Functions evaluate partition_length[] candidates
+ * of a partition ending at a given position for
+ * ComputePartition(), and return the cheapest one,
+ * or the longest one among the cheapest ones.
+ * A maximum bit length is updated at the start
+ * of each candidate. AVX2 evaluates the 16
+ * candidates at once with prefix maximums, so
+ * both give the same partitions. Sizes are not
+ * computed after 64 bits because they are 8 bytes
+ * for each integer.
+ *
+ *  widths  : bit lengths of integers to partition
+ *  roundup : round-up bit lengths to pack
+ *  costs   : costs of partitions before each position
+ *  i       : end of the candidates
+ *  cost    : result cost of the chosen one
+ *  return  : start of the chosen one
+ *-------------------------------------------------
+ */
+typedef size_t (*vcandidate64_t)(const uint8_t *widths,
+                                 const int *roundup,
+                                 const uint64_t *costs,
+                                 size_t i,
+                                 uint64_t *cost);
+
+inline size_t BestCandidate(const uint8_t *widths,
+                            const int *roundup,
+                            const uint64_t *costs,
+                            size_t i,
+                            uint64_t *cost) {
+  int     maxb = 0;
+  size_t  best = 0;
+
+  for (size_t j = 0;
+        j < ARRAYSIZE(partition_length); j++) {
+    size_t bp = i - partition_length[j];
+
+    /*
+     * Update a maximum bit length in
+     * a given array.
+     */
+    int b = roundup[widths[bp]];
+    if (maxb < b)
+      maxb = b;
+
+    uint64_t c = costs[bp] +
+        VP64_DIV_ROUNDUP((i - bp) * maxb, 8);
+
+    if (j == 0 || c <= *cost) {
+      *cost = c;
+      best = bp;
+    }
+
+    /*
+     * Longer candidates cost 8 bytes for each
+     * integer at 64 bits without updating
+     * the maximum.
+     */
+    if (maxb == 64) {
+      for (j++; j < ARRAYSIZE(partition_length); j++) {
+        bp = i - partition_length[j];
+        c = costs[bp] + 8 * (i - bp);
+
+        if (c <= *cost) {
+          *cost = c;
+          best = bp;
+        }
+      }
+
+      break;
+    }
+  }
+
+  return best;
+}
+
+#ifdef VP64_HAVE_AVX2
+VP64_TARGET_AVX2 inline size_t BestCandidateAVX2(
+    const uint8_t *widths, const int *roundup,
+    const uint64_t *costs, size_t i, uint64_t *cost) {
+  VP64_ASSERT(ARRAYSIZE(partition_length) == 16);
+  VP64_ASSERT(partition_length[15] == 128);
+  VP64_ASSERT(costs[i - 1] < (uint64_t(1) << 31));
+
+  /* partition_length[] in two vectors */
+  const __m256i len0 = _mm256_setr_epi32(
+      1, 2, 3, 4, 5, 6, 7, 8);
+  const __m256i len1 = _mm256_setr_epi32(
+      9, 10, 11, 12, 16, 32, 64, 128);
+  const __m256i off0 = _mm256_sub_epi32(
+      _mm256_setzero_si256(), len0);
+  const __m256i off1 = _mm256_sub_epi32(
+      _mm256_setzero_si256(), len1);
+
+  const __m256i reverse = _mm256_setr_epi32(
+      7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i shift1 = _mm256_setr_epi32(
+      0, 0, 1, 2, 3, 4, 5, 6);
+  const __m256i shift2 = _mm256_setr_epi32(
+      0, 1, 0, 1, 2, 3, 4, 5);
+  const __m256i shift4 = _mm256_setr_epi32(
+      0, 1, 2, 3, 0, 1, 2, 3);
+  const __m256i last = _mm256_set1_epi32(7);
+  const __m256i seven = _mm256_set1_epi32(7);
+  const __m256i full = _mm256_set1_epi32(64);
+
+  /*
+   * The last 8 widths are loaded at once not to
+   * read over widths[i], and the others are
+   * gathered by bytes.
+   */
+  __m256i w0 = _mm256_permutevar8x32_epi32(
+      _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+          reinterpret_cast<const __m128i *>(widths + i - 8))),
+      reverse);
+
+  /* Lower halves of costs[] on little-endian */
+  const int *c = reinterpret_cast<const int *>(costs + i);
+
+  /* Prefix maximums over candidates */
+  __m256i max0 = _mm256_i32gather_epi32(roundup, w0, 4);
+
+  max0 = _mm256_max_epi32(
+      max0, _mm256_permutevar8x32_epi32(max0, shift1));
+  max0 = _mm256_max_epi32(
+      max0, _mm256_permutevar8x32_epi32(max0, shift2));
+  max0 = _mm256_max_epi32(
+      max0, _mm256_permutevar8x32_epi32(max0, shift4));
+
+  __m256i c0 = _mm256_add_epi32(
+      _mm256_i32gather_epi32(c, _mm256_add_epi32(off0, off0), 4),
+      _mm256_srli_epi32(_mm256_add_epi32(
+          _mm256_mullo_epi32(len0, max0), seven), 3));
+  __m256i c1 = _mm256_i32gather_epi32(
+      c, _mm256_add_epi32(off1, off1), 4);
+
+  /*
+   * The second half costs 8 bytes for each integer
+   * after 64 bits as BestCandidate().
+   */
+  if (_mm256_movemask_ps(_mm256_castsi256_ps(
+          _mm256_cmpeq_epi32(max0, full))) != 0) {
+    c1 = _mm256_add_epi32(c1, _mm256_slli_epi32(len1, 3));
+  } else {
+    __m256i w1 = _mm256_and_si256(
+        _mm256_i32gather_epi32(
+            reinterpret_cast<const int *>(widths + i), off1, 1),
+        _mm256_set1_epi32(0xff));
+    __m256i max1 = _mm256_i32gather_epi32(roundup, w1, 4);
+
+    max1 = _mm256_max_epi32(
+        max1, _mm256_permutevar8x32_epi32(max1, shift1));
+    max1 = _mm256_max_epi32(
+        max1, _mm256_permutevar8x32_epi32(max1, shift2));
+    max1 = _mm256_max_epi32(
+        max1, _mm256_permutevar8x32_epi32(max1, shift4));
+    max1 = _mm256_max_epi32(
+        max1, _mm256_permutevar8x32_epi32(max0, last));
+
+    c1 = _mm256_add_epi32(c1, _mm256_srli_epi32(
+        _mm256_add_epi32(_mm256_mullo_epi32(len1, max1), seven), 3));
+  }
+
+  /* A minimum cost in all the lanes */
+  __m256i m = _mm256_min_epu32(c0, c1);
+  m = _mm256_min_epu32(
+      m, _mm256_permute2x128_si256(m, m, 1));
+  m = _mm256_min_epu32(
+      m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+  m = _mm256_min_epu32(
+      m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+
+  /* The last candidate of the minimum cost */
+  uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(c0, m)));
+  mask |= _mm256_movemask_ps(_mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(c1, m))) << 8;
+
+  *cost = uint32_t(_mm_cvtsi128_si32(
+      _mm256_castsi256_si128(m)));
+  return i - partition_length[
+      63 - VP64_MSB64(uint64_t(mask))];
+}
+#endif /* VP64_HAVE_AVX2 */
+
+inline vcandidate64_t SelectBestCandidate() {
+#ifdef VP64_HAVE_AVX2
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return BestCandidateAVX2;
+#endif
+
+  return BestCandidate;
+}
+
+
 /*-------------------------------------------------
  * A function computes optimal partitions to
  * pack integers by Dynamic Programming.
  *
- *  src    : integer array to partition with DP
- *  n      : # of input integers
- *  parts  : result partitions
- *  return : # of partitions
+ *  src     : integer array to partition with DP
+ *  n       : # of input integers
+ *  parts   : result partitions
+ *  ws      : working space for (n + 1) entries,
+ *            and widths() has bit lengths of *src
+ *  roundup : round-up bit lengths to pack
+ *  csize   : # of control bytes for each partition
+ *  penalty : bytes charged for each partition
+ *            besides its control bytes
+ *  return  : # of partitions
  *-------------------------------------------------
  */
 inline int ComputePartition(const uint64_t *src,
                             size_t n,
-                            size_t *parts) {
+                            size_t *parts,
+                            const Workspace &ws,
+                            const int *roundup = roundup_bits,
+                            int csize = 1,
+                            int penalty = 0) {
   VP64_ASSERT(src != NULL);
   VP64_ASSERT(parts != NULL);
+  VP64_ASSERT(csize == 1 || csize == 2);
+  VP64_ASSERT(penalty >= 0 && penalty <= penalty_max);
+
+  /* Bit lengths of *src are read from ws.widths() */
+  (void)src;
 
   const size_t max_partition =
       partition_length[ARRAYSIZE(partition_length) - 1];
@@ -361,52 +1217,36 @@ inline int ComputePartition(const uint64_t *src,
    * corresponding to the partitoin. Initially, refs[]
    * and costs[] are set to -1 and 0.
    */
-  int64_t   refs[n + 1];
-  uint64_t  costs[n + 1];
+  int64_t       *refs = ws.refs();
+  uint64_t      *costs = ws.costs();
+  const uint8_t *widths = ws.widths();
 
   for (size_t i = 0; i <= n; i++) {
     refs[i] = -1;
     costs[i] = 0;
   }
 
+  /* Control bytes and a penalty for each partition */
+  const uint64_t overhead = csize + penalty;
+
   /*
    * Initialize costs in costs[0...max_partition-1]
    * Leading max_partition-elements in refs[] must
    * reference to the previous one there.
    */
-  costs[0] = VP64_DIV_ROUNDUP(
-      64 - VP64_MSB64(src[0]), 8);
   for (size_t i = 1;
         i < max_partition; i++) {
     refs[i] = i - 1;
-    costs[i] = costs[i - 1] +
-        VP64_DIV_ROUNDUP(64 - VP64_MSB64(src[i]), 8);
+    costs[i] = costs[i - 1] + overhead +
+        VP64_DIV_ROUNDUP(roundup[widths[i - 1]], 8);
   }
 
-  for (size_t i = max_partition; i <= n; i++) {
-    int     maxb = 0;
-
-    for (size_t j = 0;
-          j < ARRAYSIZE(partition_length); j++) {
-      size_t bp = i - partition_length[j];
-
-      /*
-       * Update a maximum bit length in
-       * a given array.
-       */
-      int b = roundup_bits[
-          64 - VP64_MSB64(src[bp])];
-      if (maxb < b)
-        maxb = b;
+  static const vcandidate64_t best_candidate =
+      SelectBestCandidate();
 
-      uint64_t c = costs[bp] +
-          VP64_DIV_ROUNDUP((i - bp) * maxb, 8);
-
-      if (refs[i] == -1 || c <= costs[i]) {
-        costs[i] = c;
-        refs[i] = bp;
-      }
-    }
+  for (size_t i = max_partition; i <= n; i++) {
+    refs[i] = best_candidate(widths, roundup, costs, i, &costs[i]);
+    costs[i] += overhead;
   }
 
   /* Compute the number of partitions */
@@ -424,21 +1264,139 @@ inline int ComputePartition(const uint64_t *src,
   return pnum;
 }
 
+/* It allocates working space in every call */
+inline int ComputePartition(const uint64_t *src,
+                            size_t n,
+                            size_t *parts) {
+  Workspace ws;
+  if (!ws.Reserve(n))
+    return 0;
+
+  BitWidths(src, n, ws.widths());
+  return ComputePartition(src, n, parts, ws);
+}
 
 /*-------------------------------------------------
- * Unpack fixed-bit integers by a given length.
- * NOTE: The following functions overrun a given
- * buffer to some extent in view of unpacking
- * performance. Therefore, a caller must use the
- * functions while taking into accounts the
- * overruns during unpacking.
+ * A function computes partitions in linear time
+ * for level_fast. Each max_partition integers
+ * are halved recursively only if the halves are
+ * smaller in total with control bytes and
+ * a penalty for each, and left integers are split
+ * into the longest partitions.
  *
- *  src    : integer array to pack
- *  slimit : terminal address of *src
- *  dst    : output buffer
- *  dlimit : terminal address of *dst
- *  n      : # of decompressed integers
- *  return : # of read bytes, or -1 if it fails
+ *  src     : integer array to partition
+ *  n       : # of input integers
+ *  parts   : result partitions
+ *  roundup : round-up bit lengths to pack
+ *  csize   : # of control bytes for each partition
+ *  penalty : bytes charged for each partition
+ *            besides its control bytes
+ *  return  : # of partitions
+ *-------------------------------------------------
+ */
+inline int ComputeFastPartition(const uint64_t *src,
+                                size_t n,
+                                size_t *parts,
+                                const int *roundup = roundup_bits,
+                                int csize = 1,
+                                int penalty = 0) {
+  VP64_ASSERT(src != NULL);
+  VP64_ASSERT(parts != NULL);
+  VP64_ASSERT(csize == 1 || csize == 2);
+  VP64_ASSERT(penalty >= 0 && penalty <= penalty_max);
+
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  VP64_ASSERT(max_partition == 128);
+
+  const size_t overhead = csize + penalty;
+
+  int     pnum = 0;
+  size_t  pos = 0;
+
+  parts[0] = 0;
+
+  for (; pos + max_partition <= n; pos += max_partition) {
+    /*
+     * Nodes of a binary tree are in heap order;
+     * the k-th node has 128 >> depth(k) integers,
+     * and the leaves (128...255) have one each.
+     */
+    uint64_t  bits[256];
+    size_t    costs[256];
+    bool      split[256];
+
+    for (int k = 128; k < 256; k++) {
+      bits[k] = src[pos + k - 128];
+      costs[k] = overhead + VP64_DIV_ROUNDUP(
+          roundup[64 - VP64_MSB64(bits[k])], 8);
+      split[k] = false;
+    }
+
+    for (int k = 127; k >= 1; k--) {
+      size_t len = max_partition >> (63 - VP64_MSB64(k));
+
+      bits[k] = bits[2 * k] | bits[2 * k + 1];
+
+      size_t whole = overhead + VP64_DIV_ROUNDUP(
+          len * roundup[64 - VP64_MSB64(bits[k])], 8);
+      size_t halves = costs[2 * k] + costs[2 * k + 1];
+
+      split[k] = (halves < whole);
+      costs[k] = split[k]? halves : whole;
+    }
+
+    /* Emit the nodes that are not split in order */
+    int stack[16];
+    int sp = 0;
+
+    stack[sp++] = 1;
+
+    size_t start = pos;
+
+    while (sp > 0) {
+      int k = stack[--sp];
+
+      if (split[k]) {
+        stack[sp++] = 2 * k + 1;
+        stack[sp++] = 2 * k;
+        continue;
+      }
+
+      start += max_partition >> (63 - VP64_MSB64(k));
+      parts[++pnum] = start;
+    }
+  }
+
+  /* Split left integers */
+  while (pos < n) {
+    size_t j = ARRAYSIZE(partition_length) - 1;
+    while (partition_length[j] > n - pos)
+      j--;
+
+    pos += partition_length[j];
+    parts[++pnum] = pos;
+  }
+
+  return pnum;
+}
+
+
+/*-------------------------------------------------
+ * Unpack fixed-bit integers by a given length.
+ * NOTE: The following functions overrun a given
+ * buffer to some extent in view of unpacking
+ * performance. Therefore, a caller must use the
+ * functions while taking into accounts the
+ * overruns during unpacking.
+ *
+ *  src    : integer array to pack
+ *  slimit : terminal address of *src
+ *  dst    : output buffer
+ *  dlimit : terminal address of *dst
+ *  n      : # of decompressed integers
+ *  return : # of read bytes, or -1 if it fails
  *
  * XXX: Unpacking integers byte-by-byte eats many
  * processor time, so it is better to exploit
@@ -908,310 +1866,1622 @@ inline int Unpack64(const char *restrict src,
   return 8 * n;
 }
 
+/*
+ * A functional pointer type for the unpackers
+ * above, and the ones below have the same
+ * interface.
+ */
+typedef int (*vpack64_t)(
+    const char *restrict src,
+    const char *restrict slimit,
+    uint64_t *restrict dst,
+    const uint64_t *restrict dlimit, int n);
+
 
 /*-------------------------------------------------
- * Following functions are to help the
- * implementations of Compress() and Uncompress().
+ * A reader for a nbits-bit integer that begins at
+ * the bpos-th bit in *src. It only touches bytes
+ * that cover the integer, so it is used to unpack
+ * trailing integers that UnpackWord() cannot
+ * load safely.
  *
- * CompressBlock
- *  src    : integer array to compress
- *  n      : # of input integers
- *  dst    : output buffer
- *  dlimit : terminal address of *dst
- *  return : # of written bytes, or 0 if it fails
+ *  src    : packed bytes
+ *  bpos   : bit position of the integer
+ *  nbits  : # of bits of the integer
+ *  return : unpacked value
  *-------------------------------------------------
  */
-inline uint32_t CompressBlock(const uint64_t *src,
-                              size_t n,
-                              char *dst,
-                              const char *restrict dlimit) {
-  VP64_ASSERT(src != NULL);
-  VP64_ASSERT(dst != NULL);
-  VP64_ASSERT(n != 0);
-
-  const size_t max_partition =
-      partition_length[ARRAYSIZE(partition_length) - 1];
-
-  if (max_partition +
-        MAX_UNPACK_OVERRUN_NUM > n) {
-    for (size_t i = 0; i < n; i++)
-      SetUint64(dst + 8 * i, src[i]);
-
-    return n * 8;
+inline uint64_t ReadBits(const char *restrict src,
+                         size_t bpos,
+                         int nbits) {
+  VP64_ASSERT(nbits > 0 && nbits <= 64);
+
+  const char *p = src + (bpos >> 3);
+  int sbits = bpos & 0x07;
+  int nc = VP64_DIV_ROUNDUP(sbits + nbits, 8);
+
+  uint64_t v = 0;
+  for (int i = 0; i < nc && i < 8; i++)
+    v = (v << 8) | (p[i] & 0xff);
+
+  /* The integer spans 9 bytes */
+  if (nc > 8) {
+    v = (v << sbits) |
+        ((p[8] & 0xff) >> (8 - sbits));
+    return v >> (64 - nbits);
   }
 
-  /*
-   * Last MAX_UNPACK_OVERRUN_NUM 64-bit integers
-   * are not compressed and just copied to a output
-   * buffer because of the overrun issue during
-   * decompression.
-   */
-  n -= MAX_UNPACK_OVERRUN_NUM;
+  v <<= 64 - 8 * nc + sbits;
+  return v >> (64 - nbits);
+}
 
-  /* parts[] uses stack space */
-  size_t parts[n + 1];
+/*
+ * A functional pointer type for the unchecked
+ * unpackers below; they decode n integers in
+ * groups of 8 without bounds checks, so they might
+ * write up to 7 integers over n in *dst and read
+ * up to 72 bytes over the packed bytes in *src.
+ * UncompressBlock() validates a whole block in
+ * advance and uses them because the overruns
+ * always fall into the trailing raw integers of
+ * the block.
+ */
+typedef void (*vpack64_fast_t)(
+    const char *restrict src,
+    uint64_t *restrict dst, size_t n);
 
-  int np = ComputePartition(src, n, parts);
+/*
+ * # of groups of 8 integers in n that checked
+ * unpackers can decode with the unchecked ones;
+ * the loads of a group reach up to nload bytes
+ * from the head of the group, and the group heads
+ * are aligned to B bytes.
+ */
+inline int LoadableGroups(const char *src,
+                          const char *slimit,
+                          int n, int B, int nload) {
+  if (slimit - src < nload)
+    return 0;
 
-  uint32_t offset = np + 8;
-  SetUint32(dst + 4, offset);
+  ptrdiff_t ng = (slimit - src - nload) / B + 1;
+  return (ng < n / 8)? static_cast<int>(ng) : n / 8;
+}
 
-  char *ctrl = dst + 8;
-  char *data = dst + offset;
+inline void UnpackFast0(const char *restrict,
+                        uint64_t *restrict dst,
+                        size_t n) {
+  memset(dst, 0x00, n * sizeof(uint64_t));
+}
 
-  /* Do compressing */
-  uint32_t block_size = offset;
+/* 64-bit partitions in the v2 format */
+inline void UnpackFast64LE(const char *restrict src,
+                           uint64_t *restrict dst,
+                           size_t n) {
+  DecodeUint64s(src, dst, n, format_v2);
+}
 
-  for (int i = 0; i < np; i++) {
-    size_t plen =
-        parts[i + 1] - parts[i];
 
-    int maxb = 0;
-    for (size_t j = 0; j < plen; j++) {
-      int b = roundup_bits[
-          64 - VP64_MSB64(src[j])];
-      if (maxb < b)
-        maxb = b;
-    }
+/*-------------------------------------------------
+ * Portable unpackers that exploit 64-bit registers
+ * as mentioned in the XXX note above. Each group
+ * of 8 integers, or B bytes, is decoded from
+ * unaligned big-endian 64-bit loads; a new word
+ * is loaded only if a next integer does not fit
+ * in the current one, so the loop loads a word
+ * per 8 integers for B <= 7. The integers are
+ * extracted with shifts.
+ *
+ * The interface is the same as the unpackers
+ * above, except that the functions only write
+ * n integers in *dst.
+ *-------------------------------------------------
+ */
+template <int B, int K, int WPOS>
+struct WordUnpacker {
+  /*
+   * WPOS is the bit position of a current word in
+   * a group, and a next word is loaded if the K-th
+   * integer does not fit in the word. All the
+   * positions are fixed in compile time.
+   */
+  static const bool kLoad = (K * B + B - WPOS > 64);
+  static const int  kWpos = kLoad? ((K * B) & ~0x07) : WPOS;
 
-    int nwrite = WriteBits(
-        src, maxb, plen, data, dlimit);
+  static inline void Run(const char *restrict src,
+                         uint64_t *restrict dst,
+                         uint64_t *w) {
+    if (kLoad)
+      *w = DecodeUint64(src + (kWpos >> 3));
 
-    /* Check if it works correctly */
-    if (nwrite < 0)
-      return 0;
+    dst[K] = (*w << (K * B - kWpos)) >> (64 - B);
 
-    /* Write a control byte */
-    *ctrl = ctrl_bit[maxb] | ctrl_partition[plen];
+    WordUnpacker<B, K + 1, kWpos>::Run(src, dst, w);
+  }
+};
 
-    VP64_ASSERT(ctrl_bit[maxb] != char(0xff));
-    VP64_ASSERT(ctrl_partition[plen] != char(0xff));
+template <int B, int WPOS>
+struct WordUnpacker<B, 8, WPOS> {
+  static inline void Run(const char *restrict,
+                         uint64_t *restrict,
+                         uint64_t *) {}
+};
 
-    /* Move to a next partition */
-    src += plen;
-    data += nwrite;
-    ctrl++;
-    block_size += nwrite;
-  }
+template <int B>
+inline void UnpackWordFast(const char *restrict src,
+                           uint64_t *restrict dst,
+                           size_t n) {
+  for (size_t i = 0; i < n; i += 8) {
+    uint64_t w;
+    WordUnpacker<B, 0, -64>::Run(src, dst, &w);
 
-  /* Copy left integers to a output */
-  for (size_t i = 0;
-        i < MAX_UNPACK_OVERRUN_NUM; i++)
-    SetUint64(data + i * 8, src[i]);
+    src += B;
+    dst += 8;
+  }
+}
 
-  block_size += 8 * MAX_UNPACK_OVERRUN_NUM;
+template <int B>
+inline int UnpackWord(const char *restrict src,
+                      const char *restrict slimit,
+                      uint64_t *restrict dst,
+                      const uint64_t *restrict dlimit,
+                      int n) {
+  int nread = VP64_DIV_ROUNDUP(B * n, 8);
+  if (src + nread > slimit || dst + n > dlimit)
+    return -1;
 
   /*
-   * Finally, it stores the size of
-   * this block in the leading 4-byte
-   * space of the block.
+   * The loads in a group do not exceed (B + 8)
+   * bytes from the head of the group.
    */
-  SetUint32(dst, block_size);
+  int i = 8 * LoadableGroups(src, slimit, n, B, B + 8);
+  UnpackWordFast<B>(src, dst, i);
 
-  return block_size;
+  /* Unpack left integers one by one */
+  src += (i / 8) * B;
+  dst += i;
+
+  for (int j = 0; i < n; i++, j++)
+    dst[j] = ReadBits(src, j * B, B);
+
+  return nread;
 }
 
+/*
+ * Tables of the unpackers above, which are
+ * indexed by lower 4-bits in a control byte.
+ */
+static const vpack64_t scalar_unpackers[16] = {
+  Unpack0, Unpack1, Unpack2, Unpack3,
+  Unpack4, Unpack5, Unpack6, Unpack7,
+  Unpack8, Unpack9, Unpack10, Unpack11,
+  Unpack12, Unpack16, Unpack32, Unpack64
+};
+
+static const vpack64_t word_unpackers[16] = {
+  Unpack0, UnpackWord<1>, UnpackWord<2>, UnpackWord<3>,
+  UnpackWord<4>, UnpackWord<5>, UnpackWord<6>, UnpackWord<7>,
+  UnpackWord<8>, UnpackWord<9>, UnpackWord<10>, UnpackWord<11>,
+  UnpackWord<12>, UnpackWord<16>, UnpackWord<32>, UnpackWord<64>
+};
+
+static const vpack64_fast_t word_fast_unpackers[16] = {
+  UnpackFast0, UnpackWordFast<1>, UnpackWordFast<2>,
+  UnpackWordFast<3>, UnpackWordFast<4>, UnpackWordFast<5>,
+  UnpackWordFast<6>, UnpackWordFast<7>, UnpackWordFast<8>,
+  UnpackWordFast<9>, UnpackWordFast<10>, UnpackWordFast<11>,
+  UnpackWordFast<12>, UnpackWordFast<16>, UnpackWordFast<32>,
+  UnpackWordFast<64>
+};
+
+/*
+ * A table of the unchecked unpackers for wide
+ * blocks, which is indexed by a bit length.
+ * Integers of 57-63 bits might span 9 bytes
+ * from a byte boundary, so they are not used.
+ */
+static const vpack64_fast_t wide_fast_unpackers[65] = {
+  UnpackFast0, UnpackWordFast<1>, UnpackWordFast<2>,
+  UnpackWordFast<3>, UnpackWordFast<4>, UnpackWordFast<5>,
+  UnpackWordFast<6>, UnpackWordFast<7>, UnpackWordFast<8>,
+  UnpackWordFast<9>, UnpackWordFast<10>, UnpackWordFast<11>,
+  UnpackWordFast<12>, UnpackWordFast<13>, UnpackWordFast<14>,
+  UnpackWordFast<15>, UnpackWordFast<16>, UnpackWordFast<17>,
+  UnpackWordFast<18>, UnpackWordFast<19>, UnpackWordFast<20>,
+  UnpackWordFast<21>, UnpackWordFast<22>, UnpackWordFast<23>,
+  UnpackWordFast<24>, UnpackWordFast<25>, UnpackWordFast<26>,
+  UnpackWordFast<27>, UnpackWordFast<28>, UnpackWordFast<29>,
+  UnpackWordFast<30>, UnpackWordFast<31>, UnpackWordFast<32>,
+  UnpackWordFast<33>, UnpackWordFast<34>, UnpackWordFast<35>,
+  UnpackWordFast<36>, UnpackWordFast<37>, UnpackWordFast<38>,
+  UnpackWordFast<39>, UnpackWordFast<40>, UnpackWordFast<41>,
+  UnpackWordFast<42>, UnpackWordFast<43>, UnpackWordFast<44>,
+  UnpackWordFast<45>, UnpackWordFast<46>, UnpackWordFast<47>,
+  UnpackWordFast<48>, UnpackWordFast<49>, UnpackWordFast<50>,
+  UnpackWordFast<51>, UnpackWordFast<52>, UnpackWordFast<53>,
+  UnpackWordFast<54>, UnpackWordFast<55>, UnpackWordFast<56>,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  UnpackFast64LE
+};
 
 /*-------------------------------------------------
- * Following functions are to help the
- * implementations of Compress() and Uncompress().
+ * A function restores integers in a delta block
+ * from their gaps in place. It runs right after
+ * each partition is unpacked, so the integers are
+ * still in L1 cache and no extra pass over *dst
+ * is needed.
  *
- * UncompressBlock
- *  src    : sequence of compressed bytes
- *  dst    : output buffer
- *  n      : # of decompressed integers
- *  return : # of read bytes, or 0 if it fails
+ *  v      : gaps to restore in place
+ *  n      : # of the gaps
+ *  base   : an integer just before v[0]
+ *  return : the last restored integer
  *-------------------------------------------------
  */
-inline uint32_t UncompressBlock(const char *src,
-                                uint64_t *dst,
-                                size_t n) {
-  VP64_ASSERT(src != NULL);
-  VP64_ASSERT(dst != NULL);
-  VP64_ASSERT(n != 0);
+inline uint64_t PrefixSum(uint64_t *restrict v,
+                          size_t n, uint64_t base) {
+  for (size_t i = 0; i < n; i++)
+    v[i] = base += v[i];
 
-  const size_t max_partition =
-      partition_length[ARRAYSIZE(partition_length) - 1];
+  return base;
+}
 
-  if (max_partition +
-        MAX_UNPACK_OVERRUN_NUM > n) {
+/*-------------------------------------------------
+ * Functions for zigzag encoding; 0, -1, 1, -2, ...
+ * are mapped to 0, 1, 2, 3, ... ZigzagDecode()
+ * restores integers in place in the same way as
+ * PrefixSum().
+ *-------------------------------------------------
+ */
+inline uint64_t ZigzagEncode(uint64_t v) {
+  return (v << 1) ^ (0ULL - (v >> 63));
+}
+
+inline void ZigzagDecode(uint64_t *restrict v, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    v[i] = (v[i] >> 1) ^ (0ULL - (v[i] & 0x01));
+}
+
+/*
+ * A function undoes block flags on unpacked
+ * integers, and returns the last one as a next
+ * base for block_delta, block_dod, and
+ * block_xor; *gap keeps the last gap for
+ * block_dod, and dict has dict_max entries for
+ * block_dict. Indices are masked so that broken
+ * ones never read over the entries. Time series
+ * are restored with zigzag decoding in a single
+ * pass.
+ */
+inline uint64_t RestoreValues(uint32_t flags,
+                              uint64_t *restrict v,
+                              size_t n,
+                              uint64_t base,
+                              uint64_t *gap,
+                              const uint64_t *dict) {
+  if (flags & block_dod) {
+    uint64_t g = *gap;
+    uint64_t zmask = (flags & block_zigzag)? ~0ULL : 0;
+
+    for (size_t i = 0; i < n; i++) {
+      uint64_t d = v[i];
+      d = (d >> (zmask & 1)) ^ (zmask & (0ULL - (d & 0x01)));
+
+      g += d;
+      v[i] = base += g;
+    }
+
+    *gap = g;
+    return base;
+  }
+
+  if (flags & block_xor) {
     for (size_t i = 0; i < n; i++)
-      dst[i] = DecodeUint64(src + 8 * i);
+      v[i] = base ^= v[i];
 
-    return n * 8;
+    return base;
   }
 
-  /*
-   * A functional pointer below maps a
-   * given control byte to the corresponding
-   * unpacker function. Higher 4-bits in the
-   * control byte means a index in the
-   * functional pointer.
-   */
-  typedef int (*vpack64_t)(
-      const char *restrict src,
-      const char *restrict slimit,
-      uint64_t *restrict dst,
-      const uint64_t *restrict dlimit, int n);
-
-  static vpack64_t vpacker64[16] = {
-    Unpack0, Unpack1, Unpack2, Unpack3,
-    Unpack4, Unpack5, Unpack6, Unpack7,
-    Unpack8, Unpack9, Unpack10, Unpack11,
-    Unpack12, Unpack16, Unpack32, Unpack64
-  };
+  if (flags & block_dict) {
+    for (size_t i = 0; i < n; i++)
+      v[i] = dict[v[i] & (dict_max - 1)];
+  }
+  if (flags & block_zigzag)
+    ZigzagDecode(v, n);
+  if (flags & block_delta)
+    base = PrefixSum(v, n, base);
 
-  /* Ready for decompression */
-  uint32_t block_size = DecodeUint32(src);
-  uint32_t offset = DecodeUint32(src + 4);
+  return base;
+}
 
-  const char *slimit = src + block_size;
-  const uint64_t *dlimit = dst + n;
+/*-------------------------------------------------
+ * A decode table for control bytes, which maps
+ * each of 256 bytes to # of integers in a
+ * partition, # of packed bytes, and the unchecked
+ * unpacker. The unpackers depend on a format
+ * version because 64-bit partitions are
+ * little-endian in v2.
+ *
+ * Get() decodes a control byte, or 2 bytes in
+ * a wide block, and returns NULL for the bytes
+ * that no partition has.
+ *-------------------------------------------------
+ */
+struct CtrlEntry {
+  uint32_t        num;
+  uint32_t        nbytes;
+  vpack64_fast_t  unpack;
+};
 
-  const char *ctrl = src + 8;
-  const char *data = src + offset;
+struct CtrlTable {
+  CtrlEntry entries[256];
+  CtrlEntry wide_entries[16][65];
 
-  /* Do decompression */
-  int nloop = data - ctrl;
+  explicit CtrlTable(int version) {
+    for (int c = 0; c < 256; c++) {
+      CtrlEntry *e = &entries[c];
+      int b = bits_length[c & 0x0f];
 
-  for (int i = 0; i < nloop; i++) {
-    size_t k = partition_length[(*ctrl >> 4) & 0x0f];
-    int b = *ctrl & 0x0f;
+      e->num = partition_length[c >> 4];
+      e->nbytes = VP64_DIV_ROUNDUP(e->num * b, 8);
+      e->unpack = (b == 64 && version != format_v1)?
+          UnpackFast64LE : word_fast_unpackers[c & 0x0f];
+    }
 
-    /* Do unpacking */
-    int nread = vpacker64[b](
-        data, slimit, dst, dlimit, k);
-    if (nread < 0)
-      return 0;
+    for (int p = 0; p < 16; p++) {
+      for (int b = 0; b <= 64; b++) {
+        CtrlEntry *e = &wide_entries[p][b];
 
-    data += nread;
-    dst += k;
-    ctrl++;
+        e->num = partition_length[p];
+        e->nbytes = VP64_DIV_ROUNDUP(e->num * b, 8);
+        e->unpack = wide_fast_unpackers[b];
+      }
+    }
   }
 
-  /* Copy left bytes to a output */
-  for (size_t i = 0;
-        i < MAX_UNPACK_OVERRUN_NUM; i++)
-    dst[i] = DecodeUint64(data + 8 * i);
+  const CtrlEntry *Get(const char *c, bool wide) const {
+    if (!wide)
+      return &entries[*c & 0xff];
 
-  return block_size;
-}
+    int b = c[0] & 0xff;
+    int p = c[1] & 0xff;
 
-} /* namespace: backend */
+    if (b > 64 || p >= 16 ||
+          wide_entries[p][b].unpack == NULL)
+      return NULL;
 
-using namespace vpacker64::backend;
+    return &wide_entries[p][b];
+  }
+};
 
-/*-------------------------------------------------
- * The function provides the maximumx size that
- * Compress() may output. It is useful to know
- * the size in advance because of memory
- * allocation for *dst in Compress().
- *
- *  n      : # of input integers
- *  return : maximum size Compess() may outputs
- *-------------------------------------------------
+/*
+ * Tables for each format version are built only
+ * once, and they have the unchecked unpackers for
+ * a running processor.
  */
-inline size_t CompressBound(size_t n) {
-  size_t nblock =
-      VP64_DIV_ROUNDUP(n, block_num);
+inline const CtrlTable &GetCtrlTable(int version) {
+  static const CtrlTable v1_table(format_v1);
+  static const CtrlTable v2_table(format_v2);
 
-  return 8 + 8 * nblock + 9 * n;
+  return (version == format_v1)? v1_table : v2_table;
 }
 
 
 /*-------------------------------------------------
- * A simple interface for compression
+ * A function builds a dictionary of integers for
+ * block_dict. Distinct integers are collected by
+ * an open-addressing hash table of 2 * dict_max
+ * slots, and it gives up once they are more than
+ * dict_max. The dictionary is used only if the
+ * indices and the entries are smaller than
+ * the integers packed with a frame of reference.
  *
- *  src    : input buffer
- *  dst    : output buffer
- *  n      : # of input integers
- *  return : # of written bytes in Compress()
+ *  src    : integer array in a block
+ *  n      : # of the integers
+ *  dict   : result sorted entries
+ *  ndict  : result # of the entries
+ *  codes  : result indices of src[] in dict[]
+ *  return : false if no dictionary is used
  *-------------------------------------------------
  */
-inline size_t Compress(const uint64_t *src,
-                       char *dst,
-                       size_t n) {
-  if (src == NULL || dst == NULL)
-    return 0;
+inline uint32_t DictSlot(uint64_t v) {
+  return (v * 0x9e3779b97f4a7c15ULL) >> 55;
+}
+
+inline bool BuildDict(const uint64_t *src,
+                      size_t n,
+                      uint64_t *dict,
+                      size_t *ndict,
+                      uint64_t *codes) {
+  VP64_ASSERT(src != NULL);
+  VP64_ASSERT(n != 0);
 
-  size_t nblock = n / block_num;
-  size_t rblock = n % block_num;
+  const uint32_t slot_mask = 2 * dict_max - 1;
 
-  char *dlimit = dst + CompressBound(n);
+  uint64_t  keys[2 * dict_max];
+  int32_t   slots[2 * dict_max];
+  size_t    nd = 0;
 
-  /* Write down a magic number */
-  SetUint64(dst, VP64_MAGICNUM);
-  dst += 8;
-  size_t wsize = 8;
+  for (size_t i = 0; i <= slot_mask; i++)
+    slots[i] = -1;
 
-  for (size_t i = 0; i < nblock; i++) {
-    uint32_t nwrite =
-        CompressBlock(src, block_num, dst, dlimit);
-    if (nwrite == 0)
-      return 0;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t h = DictSlot(src[i]);
+
+    while (slots[h] >= 0 && keys[h] != src[i])
+      h = (h + 1) & slot_mask;
+
+    if (slots[h] < 0) {
+      if (nd == dict_max)
+        return false;
+
+      keys[h] = src[i];
+      slots[h] = nd;
+      dict[nd++] = src[i];
+    }
+  }
+
+  std::sort(dict, dict + nd);
+
+  /* Bit lengths of indices and ones with a base */
+  uint64_t ib = 64 - VP64_MSB64(nd - 1);
+  uint64_t fb = 64 - VP64_MSB64(dict[nd - 1] - dict[0]);
 
-    /* Move to a next block */
-    src += block_num;
-    dst += nwrite;
-    wsize += nwrite;
+  if (8 * (nd + 1) > n ||
+        ib * n + 64 * (nd + 1) >= fb * n)
+    return false;
+
+  for (size_t i = 0; i <= slot_mask; i++) {
+    if (slots[i] >= 0)
+      slots[i] = std::lower_bound(
+          dict, dict + nd, keys[i]) - dict;
   }
 
-  /* Compress left elements in src */
-  if (rblock) {
-    uint32_t nwrite =
-        CompressBlock(src, rblock, dst, dlimit);
-    if (nwrite == 0)
-      return 0;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t h = DictSlot(src[i]);
+
+    while (keys[h] != src[i])
+      h = (h + 1) & slot_mask;
 
-    wsize += nwrite;
+    codes[i] = slots[h];
   }
 
-  return wsize;
+  *ndict = nd;
+  return true;
 }
 
 
 /*-------------------------------------------------
- * A simple interface for decompression
+ * A function chooses block flags for block_auto.
+ * It samples 8 windows of up to 512 integers
+ * over a block, and sums up packed sizes of
+ * 128-integer partitions in the windows for
+ * each transform, that is, the cost that
+ * ComputePartition() uses. A transform is chosen
+ * only if it is estimated smaller than the ones
+ * with less flags.
  *
- *  src    : input buffer
- *  dst    : output buffer
- *  n      : # of input bytes
- *  return : # of read bytes in Uncompress()
+ *  src    : integer array in a block
+ *  n      : # of the integers
+ *  return : block flags for the block
  *-------------------------------------------------
  */
-inline size_t Uncompress(const char *src,
-                         uint64_t *dst,
-                         size_t n) {
-  if (src == NULL || dst == NULL)
-    return 0;
+inline uint32_t ChooseBlockFlags(const uint64_t *src,
+                                 size_t n) {
+  VP64_ASSERT(src != NULL);
+  VP64_ASSERT(n >= 128);
 
-  /* Check if a magic number is correct */
-  if (VP64_MAGICNUM != DecodeUint64(src))
-    return 0;
+  static const uint32_t candidates[] = {
+    0, block_zigzag, block_delta,
+    block_delta | block_zigzag,
+    block_dod | block_zigzag, block_xor
+  };
 
-  src += 8;
-  size_t rsize = 8;
+  const size_t nwindow = 8;
+  const size_t window = ((n < 512)? n : 512) & ~size_t(127);
 
-  size_t nblock = n / block_num;
-  size_t rblock = n % block_num;
+  uint64_t sizes[ARRAYSIZE(candidates)] = {0};
 
-  for (size_t i = 0; i < nblock; i++) {
-    uint32_t nread =
-        UncompressBlock(src, dst, block_num);
+  for (size_t w = 0; w < nwindow; w++) {
+    size_t start = (n - window) * w / (nwindow - 1);
 
-    /* Check if it works correctly */
-    if (nread == 0)
+    for (size_t p = start; p < start + window; p += 128) {
+      for (size_t k = 0; k < ARRAYSIZE(candidates); k++) {
+        int maxb = 0;
+
+        for (size_t i = 0; i < 128; i++) {
+          size_t j = p + i;
+          uint64_t v = src[j];
+
+          if (candidates[k] & block_delta)
+            v = (j > 0)? v - src[j - 1] : 0;
+          if (candidates[k] & block_dod)
+            v = (j > 1)? v - 2 * src[j - 1] + src[j - 2] :
+                (j > 0)? v - src[j - 1] : 0;
+          if (candidates[k] & block_xor)
+            v = (j > 0)? v ^ src[j - 1] : 0;
+          if (candidates[k] & block_zigzag)
+            v = ZigzagEncode(v);
+
+          int b = roundup_bits[64 - VP64_MSB64(v)];
+          if (maxb < b)
+            maxb = b;
+        }
+
+        sizes[k] += VP64_DIV_ROUNDUP(128 * maxb, 8);
+      }
+    }
+  }
+
+  size_t best = 0;
+
+  for (size_t k = 1; k < ARRAYSIZE(candidates); k++) {
+    if (sizes[k] < sizes[best])
+      best = k;
+  }
+
+  return candidates[best];
+}
+
+/*-------------------------------------------------
+ * A function decides whether a block uses
+ * block_wide. It samples windows as
+ * ChooseBlockFlags() does, and compares packed
+ * sizes of 16-integer partitions with the two
+ * sets of bit lengths while charging an extra
+ * control byte for each 128 integers in a wide
+ * block.
+ *
+ *  src    : integer array in a block
+ *  n      : # of the integers
+ *  return : true if block_wide is estimated smaller
+ *-------------------------------------------------
+ */
+inline bool UseWideBlock(const uint64_t *src,
+                         size_t n) {
+  VP64_ASSERT(src != NULL);
+  VP64_ASSERT(n >= 128);
+
+  const size_t nwindow = 8;
+  const size_t window = ((n < 512)? n : 512) & ~size_t(127);
+
+  uint64_t size = 0;
+  uint64_t wide_size = 0;
+
+  for (size_t w = 0; w < nwindow; w++) {
+    size_t start = (n - window) * w / (nwindow - 1);
+
+    for (size_t p = start; p < start + window; p += 16) {
+      uint64_t bits = 0;
+      for (size_t i = 0; i < 16; i++)
+        bits |= src[p + i];
+
+      int b = 64 - VP64_MSB64(bits);
+
+      size += 2 * roundup_bits[b];
+      wide_size += 2 * roundup_wide_bits[b];
+    }
+
+    wide_size += window / 128;
+  }
+
+  return wide_size < size;
+}
+
+
+/*-------------------------------------------------
+ * Following functions are to help the
+ * implementations of Compress() and Uncompress().
+ *
+ * CompressBlock
+ *  src    : integer array to compress
+ *  n      : # of input integers
+ *  dst     : output buffer
+ *  dlimit  : terminal address of *dst
+ *  version : format version of the block
+ *  ws      : working space reserved if needed
+ *  flags   : block flags or block_auto, only for v2
+ *  level   : compression level
+ *  penalty : bytes charged for each partition
+ *  return  : # of written bytes, or 0 if it fails
+ *-------------------------------------------------
+ */
+inline uint32_t CompressBlock(const uint64_t *src,
+                              size_t n,
+                              char *dst,
+                              const char *restrict dlimit,
+                              int version,
+                              Workspace *ws,
+                              uint32_t flags = 0,
+                              int level = level_max,
+                              int penalty = 0) {
+  VP64_ASSERT(src != NULL);
+  VP64_ASSERT(dst != NULL);
+  VP64_ASSERT(n != 0);
+
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  if (max_partition +
+        MAX_UNPACK_OVERRUN_NUM > n) {
+    SetUint64s(dst, src, n, version);
+    return n * 8;
+  }
+
+  /*
+   * Last MAX_UNPACK_OVERRUN_NUM 64-bit integers
+   * are not compressed and just copied to a output
+   * buffer because of the overrun issue during
+   * decompression.
+   */
+  n -= MAX_UNPACK_OVERRUN_NUM;
+
+  if (!ws->Reserve(n))
+    return 0;
+
+  const uint64_t *tail = src + n;
+
+  if (flags & block_auto)
+    flags = ChooseBlockFlags(src, n);
+
+  /*
+   * Low-cardinality integers are replaced with
+   * indices of a dictionary, and the flags for
+   * signed ones are not needed then. Blocks with
+   * a base do not use dictionaries.
+   */
+  uint64_t  dict[dict_max];
+  size_t    ndict = 0;
+
+  if (version != format_v1 &&
+        (flags & block_based) == 0 &&
+        BuildDict(src, n, dict, &ndict, ws->values())) {
+    flags = block_dict;
+    src = ws->values();
+  }
+
+  uint32_t head = BlockHeaderSize(flags) +
+      ((ndict != 0)? 4 + 8 * ndict : 0);
+
+  /* Written after the transforms below */
+  uint32_t  cflags = flags;
+
+  if (dst + head > dlimit)
+    return 0;
+
+  for (size_t i = 0; i < ndict; i++)
+    SetUint64LE(dst + BlockHeaderSize(flags) + 4 + 8 * i,
+                dict[i]);
+  if (ndict != 0)
+    SetUint32LE(dst + BlockHeaderSize(flags), ndict);
+
+  /*
+   * A delta block packs the gaps between adjacent
+   * integers, and the first integer is kept as
+   * a base. The gaps wrap around, so unsorted
+   * integers are also restored correctly. A dod
+   * block packs the gaps of the gaps, and a xor
+   * block packs the XORs in the same way. Then,
+   * the integers are zigzag-encoded if needed.
+   */
+  if (flags & (block_based | block_zigzag)) {
+    uint64_t *values = ws->values();
+
+    if (flags & block_delta) {
+      values[0] = 0;
+      for (size_t i = 1; i < n; i++)
+        values[i] = src[i] - src[i - 1];
+    } else if (flags & block_dod) {
+      uint64_t prev = 0;
+
+      values[0] = 0;
+      for (size_t i = 1; i < n; i++) {
+        uint64_t gap = src[i] - src[i - 1];
+        values[i] = gap - prev;
+        prev = gap;
+      }
+    } else if (flags & block_xor) {
+      values[0] = 0;
+      for (size_t i = 1; i < n; i++)
+        values[i] = src[i] ^ src[i - 1];
+    } else {
+      memcpy(values, src, n * sizeof(uint64_t));
+    }
+
+    if (flags & block_zigzag) {
+      for (size_t i = 0; i < n; i++)
+        values[i] = ZigzagEncode(values[i]);
+    }
+
+    if (flags & block_based)
+      SetUint64LE(dst + 8, src[0]);
+
+    src = values;
+  }
+
+  /*
+   * Integers over 16 bits might be packed smaller
+   * with any bit lengths up to 56 and 2-byte
+   * control bytes.
+   */
+  if (version != format_v1 && UseWideBlock(src, n))
+    cflags |= block_wide;
+
+  const int *roundup = (cflags & block_wide)?
+      roundup_wide_bits : roundup_bits;
+  uint32_t csize = (cflags & block_wide)? 2 : 1;
+
+  /*
+   * Bit lengths are computed once for the
+   * partitioning and the packings below.
+   */
+  const uint8_t *widths = ws->widths();
+  BitWidths(src, n, ws->widths());
+
+  size_t *parts = ws->parts();
+
+  int np = (level < level_max)?
+      ComputeFastPartition(src, n, parts, roundup, csize, penalty) :
+      ComputePartition(src, n, parts, *ws, roundup, csize, penalty);
+
+  uint32_t offset = np * csize + head;
+
+  if (dst + offset > dlimit)
+    return 0;
+
+  char *ctrl = dst + head;
+  char *data = dst + offset;
+
+  /* Do compressing */
+  uint32_t block_size = offset;
+
+  for (int i = 0; i < np; i++) {
+    size_t plen =
+        parts[i + 1] - parts[i];
+
+    int maxb = 0;
+    for (size_t j = 0; j < plen; j++) {
+      if (maxb < widths[j])
+        maxb = widths[j];
+    }
+
+    maxb = roundup[maxb];
+
+    int nwrite = -1;
+
+    /* 64-bit integers are just copied in v2 */
+    if (maxb == 64 && version != format_v1) {
+      if (data + 8 * plen <= dlimit) {
+        SetUint64s(data, src, plen, version);
+        nwrite = 8 * plen;
+      }
+    } else {
+      nwrite = word_packers[maxb](
+          src, plen, data, dlimit);
+    }
+
+    /* Check if it works correctly */
+    if (nwrite < 0)
+      return 0;
+
+    VP64_ASSERT(ctrl_partition[plen] != char(0xff));
+
+    /* Write a control byte */
+    if (cflags & block_wide) {
+      ctrl[0] = maxb;
+      ctrl[1] = (ctrl_partition[plen] >> 4) & 0x0f;
+    } else {
+      *ctrl = ctrl_bit[maxb] | ctrl_partition[plen];
+      VP64_ASSERT(ctrl_bit[maxb] != char(0xff));
+    }
+
+    /* Move to a next partition */
+    src += plen;
+    widths += plen;
+    data += nwrite;
+    ctrl += csize;
+    block_size += nwrite;
+  }
+
+  /* Copy left integers to a output */
+  SetUint64s(data, tail,
+             MAX_UNPACK_OVERRUN_NUM, version);
+
+  block_size += 8 * MAX_UNPACK_OVERRUN_NUM;
+
+  /*
+   * Finally, it stores the size of
+   * this block and the offset in the
+   * leading 8-byte space of the block.
+   */
+  SetBlockHeader(dst, block_size, offset,
+                 cflags, version);
+
+  return block_size;
+}
+
+/* It allocates working space in every call */
+inline uint32_t CompressBlock(const uint64_t *src,
+                              size_t n,
+                              char *dst,
+                              const char *restrict dlimit,
+                              int version = format_v2) {
+  Workspace ws;
+  return CompressBlock(src, n, dst, dlimit, version, &ws);
+}
+
+
+/*-------------------------------------------------
+ * Following functions are to help the
+ * implementations of Compress() and Uncompress().
+ *
+ * UncompressBlock
+ *  src     : sequence of compressed bytes
+ *  dst     : output buffer
+ *  n       : # of decompressed integers
+ *  version : format version of the block
+ *  return  : # of read bytes, or 0 if it fails
+ *-------------------------------------------------
+ */
+inline uint32_t UncompressBlock(const char *src,
+                                uint64_t *dst,
+                                size_t n,
+                                int version = format_v2) {
+  VP64_ASSERT(src != NULL);
+  VP64_ASSERT(dst != NULL);
+  VP64_ASSERT(n != 0);
+
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  if (max_partition +
+        MAX_UNPACK_OVERRUN_NUM > n) {
+    DecodeUint64s(src, dst, n, version);
+    return n * 8;
+  }
+
+  const CtrlTable &ctrl_table = GetCtrlTable(version);
+
+  /* Ready for decompression */
+  uint32_t block_size;
+  uint32_t offset;
+  uint32_t flags;
+
+  DecodeBlockHeader(src, &block_size, &offset,
+                    &flags, version);
+
+  uint64_t dict[dict_max];
+  uint32_t head;
+
+  if (!ValidBlockFlags(flags) ||
+        offset > block_size ||
+        !DecodeBlockDict(src, flags, offset, &head, dict))
+    return 0;
+
+  const char *ctrl = src + head;
+  const char *data = src + offset;
+  const char *cend = data;
+
+  bool wide = (flags & block_wide) != 0;
+  uint32_t csize = wide? 2 : 1;
+
+  if ((offset - head) % csize != 0)
+    return 0;
+
+  /*
+   * Validate all the control bytes first; the
+   * partitions must cover n integers except for
+   * the trailing ones, and the packed bytes must
+   * end just before them. Then, any overrun of the
+   * unchecked unpackers falls into the trailing
+   * integers, which are copied at the end.
+   */
+  size_t num = 0;
+  size_t nbytes = 0;
+
+  for (const char *p = ctrl; p < cend; p += csize) {
+    const CtrlEntry *e = ctrl_table.Get(p, wide);
+    if (e == NULL)
+      return 0;
+
+    num += e->num;
+    nbytes += e->nbytes;
+  }
+
+  if (num + MAX_UNPACK_OVERRUN_NUM != n ||
+        offset + nbytes + 8 * MAX_UNPACK_OVERRUN_NUM !=
+          block_size)
+    return 0;
+
+  /* Do decompression */
+  uint64_t base = (flags & block_based)?
+      DecodeUint64LE(src + 8) : 0;
+  uint64_t gap = 0;
+
+  for (; ctrl < cend; ctrl += csize) {
+    const CtrlEntry &e = *ctrl_table.Get(ctrl, wide);
+
+    e.unpack(data, dst, e.num);
+
+    if (flags != 0)
+      base = RestoreValues(flags, dst, e.num,
+                           base, &gap, dict);
+
+    data += e.nbytes;
+    dst += e.num;
+  }
+
+  /* Copy left bytes to a output */
+  DecodeUint64s(data, dst,
+                MAX_UNPACK_OVERRUN_NUM, version);
+
+  return block_size;
+}
+
+/*-------------------------------------------------
+ * A function decodes integers in [lo, hi) of
+ * a block. Partitions before the range are
+ * skipped by their sizes in control bytes, and
+ * only the ones overlapping the range are
+ * unpacked. In a block with a base, the
+ * partitions before the range are unpacked as
+ * well to restore the base.
+ *
+ *  src     : head of a block
+ *  n       : # of integers in the block
+ *  version : format version of the block
+ *  lo      : index of the first integer to decode
+ *  hi      : index next to the last one
+ *  dst     : output buffer for (hi - lo) integers
+ *  return  : false if it fails
+ *-------------------------------------------------
+ */
+inline bool UncompressBlockRange(const char *src,
+                                 size_t n,
+                                 int version,
+                                 size_t lo,
+                                 size_t hi,
+                                 uint64_t *dst) {
+  VP64_ASSERT(src != NULL);
+  VP64_ASSERT(dst != NULL);
+  VP64_ASSERT(lo < hi && hi <= n);
+
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  if (max_partition +
+        MAX_UNPACK_OVERRUN_NUM > n) {
+    DecodeUint64s(src + 8 * lo, dst, hi - lo, version);
+    return true;
+  }
+
+  const CtrlTable &ctrl_table = GetCtrlTable(version);
+
+  uint32_t block_size;
+  uint32_t offset;
+  uint32_t flags;
+
+  DecodeBlockHeader(src, &block_size, &offset,
+                    &flags, version);
+
+  uint64_t dict[dict_max];
+  uint32_t head;
+
+  if (!ValidBlockFlags(flags) ||
+        offset + 8 * MAX_UNPACK_OVERRUN_NUM >
+          static_cast<uint64_t>(block_size) ||
+        !DecodeBlockDict(src, flags, offset, &head, dict))
+    return false;
+
+  bool delta = (flags & block_based) != 0;
+  uint64_t base = delta? DecodeUint64LE(src + 8) : 0;
+  uint64_t gap = 0;
+
+  const char *ctrl = src + head;
+  const char *cend = src + offset;
+  const char *data = cend;
+
+  bool wide = (flags & block_wide) != 0;
+  uint32_t csize = wide? 2 : 1;
+
+  if ((offset - head) % csize != 0)
+    return false;
+  const char *tail =
+      src + block_size - 8 * MAX_UNPACK_OVERRUN_NUM;
+
+  /*
+   * A partition is unpacked into buf[] if it is
+   * not fully in the range because unchecked
+   * unpackers overrun up to 7 integers. Packed
+   * bytes must end before the trailing integers,
+   * and the overreads fall into them.
+   */
+  uint64_t  buf[128 + 8];
+  size_t    pos = 0;
+
+  VP64_ASSERT(max_partition <= 128);
+
+  for (; ctrl < cend && pos < hi; ctrl += csize) {
+    const CtrlEntry *ep = ctrl_table.Get(ctrl, wide);
+    if (ep == NULL)
+      return false;
+
+    const CtrlEntry &e = *ep;
+
+    vpack64_fast_t unpack = e.unpack;
+    size_t nbytes = e.nbytes;
+
+    if (data + nbytes > tail)
+      return false;
+
+    if (pos >= lo && pos + e.num + 7 <= hi) {
+      unpack(data, dst + pos - lo, e.num);
+
+      base = RestoreValues(
+          flags, dst + pos - lo, e.num, base, &gap, dict);
+    } else if (pos + e.num > lo || delta) {
+      unpack(data, buf, e.num);
+
+      base = RestoreValues(flags, buf, e.num,
+                           base, &gap, dict);
+
+      size_t from = (pos > lo)? pos : lo;
+      size_t to = (pos + e.num < hi)? pos + e.num : hi;
+
+      if (from < to)
+        memcpy(dst + from - lo, buf + from - pos,
+               (to - from) * sizeof(uint64_t));
+    }
+
+    pos += e.num;
+    data += nbytes;
+  }
+
+  /* Copy trailing integers in the range */
+  if (pos < hi) {
+    if (data != tail ||
+          pos + MAX_UNPACK_OVERRUN_NUM != n)
+      return false;
+
+    size_t from = (pos > lo)? pos : lo;
+
+    DecodeUint64s(tail + 8 * (from - pos),
+                  dst + from - lo, hi - from, version);
+  }
+
+  return true;
+}
+
+
+/*-------------------------------------------------
+ * Helpers for blocks in a stream.
+ *
+ * BlockLength
+ *  n      : # of integers in a stream
+ *  i      : index of a block
+ *  return : # of integers in the i-th block
+ *
+ * BlockSize
+ *  src     : head of a block
+ *  n       : # of integers in the block
+ *  version : format version of the block
+ *  return  : # of bytes in the block
+ *
+ * BlockBound
+ *  n      : # of integers in a block
+ *  return : maximum size of the block
+ *-------------------------------------------------
+ */
+inline size_t BlockLength(size_t n, size_t i) {
+  size_t len = n - i * block_num;
+  return (len < block_num)? len : block_num;
+}
+
+inline size_t BlockSize(const char *src,
+                        size_t n,
+                        int version) {
+  const size_t max_partition =
+      partition_length[ARRAYSIZE(partition_length) - 1];
+
+  /* Short blocks are stored raw */
+  if (max_partition +
+        MAX_UNPACK_OVERRUN_NUM > n)
+    return n * 8;
+
+  uint32_t block_size;
+  uint32_t offset;
+  uint32_t flags;
+
+  DecodeBlockHeader(src, &block_size, &offset,
+                    &flags, version);
+  return block_size;
+}
+
+inline size_t BlockBound(size_t n) {
+  return 16 + 9 * n;
+}
+
+/*-------------------------------------------------
+ * A reader for the magic number at the head of
+ * a stream.
+ *
+ *  src    : head of a stream
+ *  dir    : set true if a block directory follows
+ *  return : format version, or 0 if unknown
+ *-------------------------------------------------
+ */
+inline int DecodeStreamHeader(const char *src,
+                              bool *dir) {
+  uint64_t magic = DecodeUint64(src);
+
+  *dir = (magic == VP64_MAGICNUM_V2_DIR);
+
+  if (magic == VP64_MAGICNUM)
+    return format_v1;
+  if (magic == VP64_MAGICNUM_V2 ||
+        magic == VP64_MAGICNUM_V2_DIR)
+    return format_v2;
+
+  return 0;
+}
+
+#ifdef VP64_HAVE_PTHREAD
+/*-------------------------------------------------
+ * A helper runs task->Run(id) in nthreads threads,
+ * and a caller thread works as the 0-th one. It
+ * goes on with fewer threads if some of them
+ * cannot be created.
+ *-------------------------------------------------
+ */
+template <typename Task>
+struct TaskThread {
+  Task       *task;
+  int         id;
+  pthread_t   thread;
+};
+
+template <typename Task>
+inline void *RunTaskThread(void *arg) {
+  TaskThread<Task> *t = static_cast<TaskThread<Task> *>(arg);
+  t->task->Run(t->id);
+  return NULL;
+}
+
+template <typename Task>
+inline void RunThreads(Task *task, int nthreads) {
+  TaskThread<Task> *threads =
+      new(std::nothrow) TaskThread<Task>[nthreads];
+
+  int nstarted = 1;
+
+  for (; threads != NULL && nstarted < nthreads;
+        nstarted++) {
+    TaskThread<Task> *t = &threads[nstarted];
+
+    t->task = task;
+    t->id = nstarted;
+
+    if (pthread_create(&t->thread, NULL,
+                       RunTaskThread<Task>, t) != 0)
+      break;
+  }
+
+  task->Run(0);
+
+  for (int i = 1; i < nstarted; i++)
+    pthread_join(threads[i].thread, NULL);
+
+  delete[] threads;
+}
+
+/*
+ * Tasks that threads share; each thread takes a
+ * next block by an atomic counter. A compressed
+ * block is written into a slot of
+ * BlockBound(block_num) bytes in *dst, and the
+ * slots are stitched together later. The sizes of
+ * blocks are recorded in sizes[], and 0 means
+ * a failure.
+ */
+struct CompressTask {
+  const uint64_t  *src;
+  size_t          n;
+  char           *dst;
+  const char     *dlimit;
+  size_t          nblock;
+  size_t          next;
+  uint32_t       *sizes;
+  Workspace      *ws;
+  uint32_t        flags;
+  int             level;
+  int             penalty;
+
+  void Run(int id) {
+    for (;;) {
+      size_t i = __sync_fetch_and_add(&next, 1);
+      if (i >= nblock)
+        return;
+
+      char *out = dst + i * BlockBound(block_num);
+      const char *limit = (i + 1 < nblock)?
+          out + BlockBound(block_num) : dlimit;
+
+      sizes[i] = CompressBlock(
+          src + i * block_num, BlockLength(n, i),
+          out, limit, format_v2, &ws[id], flags, level,
+          penalty);
+    }
+  }
+};
+
+struct UncompressTask {
+  const char     *src;
+  const size_t   *offsets;
+  uint64_t       *dst;
+  size_t          n;
+  int             version;
+  size_t          nblock;
+  size_t          next;
+  uint32_t       *sizes;
+
+  void Run(int) {
+    for (;;) {
+      size_t i = __sync_fetch_and_add(&next, 1);
+      if (i >= nblock)
+        return;
+
+      const char *block = src + offsets[i];
+      size_t len = BlockLength(n, i);
+
+      /*
+       * Check if a next block follows this one
+       * before decompression because offsets[]
+       * may come from a broken directory.
+       */
+      if (i + 1 < nblock &&
+            offsets[i] + BlockSize(block, len, version) !=
+              offsets[i + 1]) {
+        sizes[i] = 0;
+        continue;
+      }
+
+      sizes[i] = UncompressBlock(
+          block, dst + i * block_num, len, version);
+    }
+  }
+};
+#endif /* VP64_HAVE_PTHREAD */
+
+} /* namespace: backend */
+
+using namespace vpacker64::backend;
+
+/*-------------------------------------------------
+ * The function provides the maximumx size that
+ * Compress() may output. It is useful to know
+ * the size in advance because of memory
+ * allocation for *dst in Compress().
+ *
+ *  n      : # of input integers
+ *  return : maximum size Compess() may outputs
+ *-------------------------------------------------
+ */
+inline size_t CompressBound(size_t n) {
+  size_t nblock =
+      VP64_DIV_ROUNDUP(n, block_num);
+
+  /* A magic number, a directory, and blocks */
+  return 8 + 8 * nblock + 16 * nblock + 9 * n;
+}
+
+
+/*-------------------------------------------------
+ * A compression context that keeps working space
+ * among calls, so repeated compression with the
+ * same object allocates nothing and uses little
+ * stack. An object is not thread-safe, so each
+ * thread needs its own one.
+ *
+ * If nthreads is more than 1, Compress() runs
+ * the threads to compress blocks concurrently,
+ * and the output is byte-identical to the one
+ * with a single thread.
+ *
+ * set_directory
+ *  directory : whether Compress() writes a block
+ *              directory, which has byte offsets
+ *              of all the blocks in a stream
+ *
+ * set_delta
+ *  delta : whether Compress() packs the gaps
+ *          between adjacent integers, which suits
+ *          sorted ones such as timestamps
+ *
+ * set_delta_of_delta
+ *  dod : whether Compress() packs the gaps of
+ *        the gaps, which suits timestamps sampled
+ *        at regular intervals
+ *
+ * set_level
+ *  level : compression level from level_fast
+ *          to level_max (default); level_fast
+ *          compresses several times faster
+ *
+ * set_penalty
+ *  penalty : bytes charged for each partition
+ *            from 0 (default) to penalty_max;
+ *            larger ones make output a little
+ *            larger but faster to decode
+ *
+ * Compress
+ *  src    : input buffer
+ *  dst    : output buffer
+ *  n      : # of input integers
+ *  return : # of written bytes in Compress()
+ *
+ * Signed integers are zigzag-encoded in blocks,
+ * and Uncompress() restores them as they are.
+ * Doubles are packed as XORs of adjacent bit
+ * patterns, and restored bit-exactly.
+ *-------------------------------------------------
+ */
+class Compressor {
+ public:
+  explicit Compressor(int nthreads = 1)
+      : nthreads_((nthreads > 1)? nthreads : 1),
+        directory_(false),
+        flags_(0),
+        level_(level_max),
+        penalty_(0),
+        ws_(new(std::nothrow) Workspace[nthreads_]) {}
+  ~Compressor() {delete[] ws_;}
+
+  void set_directory(bool directory) {
+    directory_ = directory;
+  }
+
+  void set_delta(bool delta) {
+    flags_ &= ~(block_dod | block_zigzag);
+    flags_ = delta? (flags_ | block_delta) :
+        (flags_ & ~block_delta);
+  }
+
+  /* The gaps of the gaps are zigzag-encoded */
+  void set_delta_of_delta(bool dod) {
+    flags_ &= ~block_delta;
+    flags_ = dod? (flags_ | block_dod | block_zigzag) :
+        (flags_ & ~(block_dod | block_zigzag));
+  }
+
+  /* Transforms are chosen for each block instead */
+  void set_auto(bool automatic) {
+    flags_ = automatic? (flags_ | block_auto) :
+        (flags_ & ~block_auto);
+  }
+
+  void set_level(int level) {
+    level_ = (level < level_fast)? level_fast :
+        (level > level_max)? level_max : level;
+  }
+
+  void set_penalty(int penalty) {
+    penalty_ = (penalty < 0)? 0 :
+        (penalty > penalty_max)? penalty_max : penalty;
+  }
+
+  size_t Compress(const uint64_t *src,
+                  char *dst,
+                  size_t n) {
+    return CompressBlocks(src, dst, n, flags_);
+  }
+
+  size_t Compress(const int64_t *src,
+                  char *dst,
+                  size_t n) {
+    return CompressBlocks(
+        reinterpret_cast<const uint64_t *>(src),
+        dst, n, flags_ | block_zigzag);
+  }
+
+  size_t Compress(const double *src,
+                  char *dst,
+                  size_t n) {
+    return CompressBlocks(
+        reinterpret_cast<const uint64_t *>(src), dst, n,
+        (flags_ & ~(block_based | block_zigzag)) | block_xor);
+  }
+
+ private:
+  size_t CompressBlocks(const uint64_t *src,
+                        char *dst,
+                        size_t n,
+                        uint32_t flags) {
+    if (src == NULL || dst == NULL || ws_ == NULL)
       return 0;
 
-    /* Move to a next block */
-    src += nread;
-    dst += block_num;
-    rsize += nread;
+    size_t nblock = VP64_DIV_ROUNDUP(n, block_num);
+
+    /*
+     * Write down a magic number, and leave
+     * space for a block directory.
+     */
+    SetUint64(dst, directory_?
+        VP64_MAGICNUM_V2_DIR : VP64_MAGICNUM_V2);
+    size_t wsize = directory_? 8 + 8 * nblock : 8;
+
+#ifdef VP64_HAVE_PTHREAD
+    if (nthreads_ > 1 && nblock > 1)
+      return CompressParallel(src, dst, n, wsize, flags);
+#endif
+
+    char *dlimit = dst + CompressBound(n);
+
+    for (size_t i = 0; i < nblock; i++) {
+      if (directory_)
+        SetUint64LE(dst + 8 + 8 * i, wsize);
+
+      uint32_t nwrite = CompressBlock(
+          src + i * block_num, BlockLength(n, i),
+          dst + wsize, dlimit, format_v2, ws_, flags, level_,
+          penalty_);
+      if (nwrite == 0)
+        return 0;
+
+      wsize += nwrite;
+    }
+
+    return wsize;
+  }
+
+#ifdef VP64_HAVE_PTHREAD
+  size_t CompressParallel(const uint64_t *src,
+                          char *dst,
+                          size_t n,
+                          size_t hsize,
+                          uint32_t flags) {
+    CompressTask task;
+
+    task.src = src;
+    task.n = n;
+    task.dst = dst + hsize;
+    task.dlimit = dst + CompressBound(n);
+    task.nblock = VP64_DIV_ROUNDUP(n, block_num);
+    task.next = 0;
+    task.sizes = new(std::nothrow) uint32_t[task.nblock];
+    task.ws = ws_;
+    task.flags = flags;
+    task.level = level_;
+    task.penalty = penalty_;
+
+    if (task.sizes == NULL)
+      return 0;
+
+    RunThreads(&task,
+        (static_cast<size_t>(nthreads_) < task.nblock)?
+            nthreads_ : static_cast<int>(task.nblock));
+
+    /* Stitch the blocks together in order */
+    size_t wsize = hsize;
+
+    for (size_t i = 0; i < task.nblock; i++) {
+      if (task.sizes[i] == 0) {
+        wsize = 0;
+        break;
+      }
+
+      if (directory_)
+        SetUint64LE(dst + 8 + 8 * i, wsize);
+
+      memmove(dst + wsize,
+              task.dst + i * BlockBound(block_num),
+              task.sizes[i]);
+      wsize += task.sizes[i];
+    }
+
+    delete[] task.sizes;
+    return wsize;
   }
+#endif
+
+  int         nthreads_;
+  bool        directory_;
+  uint32_t    flags_;
+  int         level_;
+  int         penalty_;
+  Workspace  *ws_;
+
+  /* Not copyable */
+  Compressor(const Compressor &);
+  void operator=(const Compressor &);
+};
+
+
+/*-------------------------------------------------
+ * A simple interface for compression
+ *
+ *  src    : input buffer
+ *  dst    : output buffer
+ *  n      : # of input integers
+ *  return : # of written bytes in Compress()
+ *-------------------------------------------------
+ */
+inline size_t Compress(const uint64_t *src,
+                       char *dst,
+                       size_t n) {
+  Compressor c;
+  return c.Compress(src, dst, n);
+}
+
+/* It uses nthreads threads for compression */
+inline size_t Compress(const uint64_t *src,
+                       char *dst,
+                       size_t n,
+                       int nthreads) {
+  Compressor c(nthreads);
+  return c.Compress(src, dst, n);
+}
+
+/* Signed integers are zigzag-encoded */
+inline size_t Compress(const int64_t *src,
+                       char *dst,
+                       size_t n) {
+  Compressor c;
+  return c.Compress(src, dst, n);
+}
+
+inline size_t Compress(const int64_t *src,
+                       char *dst,
+                       size_t n,
+                       int nthreads) {
+  Compressor c(nthreads);
+  return c.Compress(src, dst, n);
+}
+
+/* Doubles are packed as XORs of bit patterns */
+inline size_t Compress(const double *src,
+                       char *dst,
+                       size_t n) {
+  Compressor c;
+  return c.Compress(src, dst, n);
+}
+
+inline size_t Compress(const double *src,
+                       char *dst,
+                       size_t n,
+                       int nthreads) {
+  Compressor c(nthreads);
+  return c.Compress(src, dst, n);
+}
+
+
+/*-------------------------------------------------
+ * A simple interface for decompression
+ *
+ *  src    : input buffer
+ *  dst    : output buffer
+ *  n      : # of input bytes
+ *  return : # of read bytes in Uncompress()
+ *-------------------------------------------------
+ */
+inline size_t Uncompress(const char *src,
+                         uint64_t *dst,
+                         size_t n) {
+  if (src == NULL || dst == NULL)
+    return 0;
 
-  if (rblock) {
-    uint32_t nread =
-        UncompressBlock(src, dst, rblock);
+  /* Check if a magic number is correct */
+  bool dir;
+  int version = DecodeStreamHeader(src, &dir);
+  if (version == 0)
+    return 0;
+
+  size_t nblock = VP64_DIV_ROUNDUP(n, block_num);
+
+  /* Skip a block directory */
+  size_t rsize = dir? 8 + 8 * nblock : 8;
+
+  for (size_t i = 0; i < nblock; i++) {
+    uint32_t nread = UncompressBlock(
+        src + rsize, dst + i * block_num,
+        BlockLength(n, i), version);
 
     /* Check if it works correctly */
     if (nread == 0)
@@ -1223,6 +3493,272 @@ inline size_t Uncompress(const char *src,
   return rsize;
 }
 
+
+/*-------------------------------------------------
+ * An interface for decompression with nthreads
+ * threads. Blocks are found by a block directory
+ * if a stream has it, or by reading the sizes of
+ * the blocks in advance otherwise.
+ *
+ *  src      : input buffer
+ *  dst      : output buffer
+ *  n        : # of output integers
+ *  nthreads : # of threads for decompression
+ *  return   : # of read bytes in Uncompress()
+ *-------------------------------------------------
+ */
+inline size_t Uncompress(const char *src,
+                         uint64_t *dst,
+                         size_t n,
+                         int nthreads) {
+#ifdef VP64_HAVE_PTHREAD
+  size_t nblock = VP64_DIV_ROUNDUP(n, block_num);
+
+  if (src == NULL || dst == NULL ||
+        nthreads <= 1 || nblock <= 1)
+    return Uncompress(src, dst, n);
+
+  bool dir;
+  int version = DecodeStreamHeader(src, &dir);
+  if (version == 0)
+    return 0;
+
+  UncompressTask task;
+
+  task.src = src;
+  task.offsets = NULL;
+  task.dst = dst;
+  task.n = n;
+  task.version = version;
+  task.nblock = nblock;
+  task.next = 0;
+  task.sizes = new(std::nothrow) uint32_t[nblock];
+
+  size_t *offsets = new(std::nothrow) size_t[nblock];
+
+  if (task.sizes == NULL || offsets == NULL) {
+    delete[] task.sizes;
+    delete[] offsets;
+    return 0;
+  }
+
+  /* Find the heads of blocks */
+  size_t hsize = dir? 8 + 8 * nblock : 8;
+  size_t rsize = hsize;
+
+  for (size_t i = 0; i < nblock; i++) {
+    if (dir) {
+      offsets[i] = DecodeUint64LE(src + 8 + 8 * i);
+    } else {
+      offsets[i] = rsize;
+    }
+
+    /*
+     * The heads must follow the previous ones
+     * within the bound of a block because they
+     * may come from a broken directory; otherwise,
+     * blocks are walked one by one.
+     */
+    if ((i == 0)? offsets[0] != hsize :
+          (offsets[i] <= offsets[i - 1] ||
+           offsets[i] - offsets[i - 1] >
+             BlockBound(BlockLength(n, i - 1)))) {
+      delete[] task.sizes;
+      delete[] offsets;
+      return Uncompress(src, dst, n);
+    }
+
+    if (!dir) {
+      rsize += BlockSize(
+          src + rsize, BlockLength(n, i), version);
+    }
+  }
+
+  task.offsets = offsets;
+
+  RunThreads(&task,
+      (static_cast<size_t>(nthreads) < nblock)?
+          nthreads : static_cast<int>(nblock));
+
+  /* Check if the blocks are contiguous */
+  rsize = hsize;
+
+  for (size_t i = 0; i < nblock; i++) {
+    if (task.sizes[i] == 0 || offsets[i] != rsize) {
+      rsize = 0;
+      break;
+    }
+
+    rsize += task.sizes[i];
+  }
+
+  delete[] task.sizes;
+  delete[] offsets;
+
+  return rsize;
+#else
+  (void)nthreads;
+  return Uncompress(src, dst, n);
+#endif
+}
+
+
+/*
+ * Signed integers compressed by Compress() above
+ * are restored as well because blocks have flags
+ * for zigzag encoding.
+ */
+inline size_t Uncompress(const char *src,
+                         int64_t *dst,
+                         size_t n) {
+  return Uncompress(
+      src, reinterpret_cast<uint64_t *>(dst), n);
+}
+
+inline size_t Uncompress(const char *src,
+                         int64_t *dst,
+                         size_t n,
+                         int nthreads) {
+  return Uncompress(
+      src, reinterpret_cast<uint64_t *>(dst), n, nthreads);
+}
+
+inline size_t Uncompress(const char *src,
+                         double *dst,
+                         size_t n) {
+  return Uncompress(
+      src, reinterpret_cast<uint64_t *>(dst), n);
+}
+
+inline size_t Uncompress(const char *src,
+                         double *dst,
+                         size_t n,
+                         int nthreads) {
+  return Uncompress(
+      src, reinterpret_cast<uint64_t *>(dst), n, nthreads);
+}
+
+
+/*-------------------------------------------------
+ * Interfaces for random access; they skip blocks
+ * by a block directory if a stream has it, or by
+ * reading the sizes of the blocks otherwise, and
+ * decode only partitions in a given range.
+ *
+ * DecodeRange
+ *  src    : input buffer
+ *  n      : # of integers in the stream
+ *  begin  : index of the first integer to decode
+ *  end    : index next to the last one
+ *  dst    : output buffer for (end - begin) integers
+ *  return : # of decoded integers, or 0 if it fails
+ *
+ * Get
+ *  src    : input buffer
+ *  n      : # of integers in the stream
+ *  i      : index of an integer to decode
+ *  return : the i-th integer, or 0 if it fails
+ *-------------------------------------------------
+ */
+inline size_t DecodeRange(const char *src,
+                          size_t n,
+                          size_t begin,
+                          size_t end,
+                          uint64_t *dst) {
+  if (src == NULL || dst == NULL ||
+        begin >= end || end > n)
+    return 0;
+
+  bool dir;
+  int version = DecodeStreamHeader(src, &dir);
+  if (version == 0)
+    return 0;
+
+  size_t first = begin / block_num;
+  size_t last = (end - 1) / block_num;
+
+  size_t nblock = VP64_DIV_ROUNDUP(n, block_num);
+  size_t hsize = dir? 8 + 8 * nblock : 8;
+
+  /*
+   * Find the first block; the directory is checked
+   * as in Uncompress() with threads, and blocks are
+   * walked one by one if it is broken.
+   */
+  size_t rsize = 0;
+
+  if (dir && DecodeUint64LE(src + 8) == hsize) {
+    rsize = hsize;
+    for (size_t i = 1; i <= first; i++) {
+      size_t offset = DecodeUint64LE(src + 8 + 8 * i);
+      if (offset <= rsize || offset - rsize >
+            BlockBound(BlockLength(n, i - 1))) {
+        rsize = 0;
+        break;
+      }
+
+      rsize = offset;
+    }
+  }
+
+  if (rsize == 0) {
+    rsize = hsize;
+    for (size_t i = 0; i < first; i++) {
+      size_t len = BlockLength(n, i);
+      size_t bsize = BlockSize(src + rsize, len, version);
+      if (bsize == 0 || bsize > BlockBound(len))
+        return 0;
+
+      rsize += bsize;
+    }
+  }
+
+  for (size_t i = first; i <= last; i++) {
+    size_t len = BlockLength(n, i);
+    size_t lo = (i == first)? begin - i * block_num : 0;
+    size_t hi = (i == last)? end - i * block_num : len;
+
+    if (!UncompressBlockRange(
+          src + rsize, len, version, lo, hi, dst))
+      return 0;
+
+    size_t bsize = BlockSize(src + rsize, len, version);
+    if (bsize == 0 || bsize > BlockBound(len))
+      return 0;
+
+    rsize += bsize;
+    dst += hi - lo;
+  }
+
+  return end - begin;
+}
+
+inline uint64_t Get(const char *src,
+                    size_t n,
+                    size_t i) {
+  uint64_t v = 0;
+  DecodeRange(src, n, i, i + 1, &v);
+  return v;
+}
+
+inline size_t DecodeRange(const char *src,
+                          size_t n,
+                          size_t begin,
+                          size_t end,
+                          int64_t *dst) {
+  return DecodeRange(src, n, begin, end,
+                     reinterpret_cast<uint64_t *>(dst));
+}
+
+inline size_t DecodeRange(const char *src,
+                          size_t n,
+                          size_t begin,
+                          size_t end,
+                          double *dst) {
+  return DecodeRange(src, n, begin, end,
+                     reinterpret_cast<uint64_t *>(dst));
+}
+
 } /* namespace: vpacker64 */
 
 #endif /* __INCLUDE_VPACKER64_HPP__ */
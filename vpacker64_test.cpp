@@ -49,7 +49,8 @@ TEST_P(Vpacker64P, Compress) {
     1ULL << 4, 1ULL << 5, 1ULL << 6,
     1ULL << 7, 1ULL << 8, 1ULL << 9,
     1ULL << 10, 1ULL << 11, 1ULL << 12,
-    1ULL << 16, 1ULL << 32, 1ULL << 48
+    1ULL << 16, 1ULL << 32, 1ULL << 48,
+    0xffffffffffffffffULL
   };
 
   for (size_t i = 0;
@@ -93,7 +94,8 @@ TEST_P(Vpacker64P, CompressBlock) {
     1ULL << 4, 1ULL << 5, 1ULL << 6,
     1ULL << 7, 1ULL << 8, 1ULL << 9,
     1ULL << 10, 1ULL << 11, 1ULL << 12,
-    1ULL << 16, 1ULL << 32, 1ULL << 48
+    1ULL << 16, 1ULL << 32, 1ULL << 48,
+    0xffffffffffffffffULL
   };
 
   for (size_t i = 0;
@@ -101,18 +103,56 @@ TEST_P(Vpacker64P, CompressBlock) {
     const uint64_t *dv =
         tmgr.generate(&tv, num, range[i]);
 
-    uint32_t wsz =
-        CompressBlock(dv, num, dst, dlimit);
-    ASSERT_TRUE(wsz <= dbound);
+    /* Check both format versions */
+    for (int v = format_v1; v <= format_v2; v++) {
+      uint32_t wsz =
+          CompressBlock(dv, num, dst, dlimit, v);
+      ASSERT_TRUE(wsz <= dbound);
 
-    uint32_t rsz =
-        UncompressBlock(dst, buf, num);
+      uint32_t rsz =
+          UncompressBlock(dst, buf, num, v);
 
-    EXPECT_EQ(rsz, wsz);
-    for (size_t i = 0; i < num; i++)
-      EXPECT_EQ(dv[i], buf[i]);
+      EXPECT_EQ(rsz, wsz);
+      for (size_t i = 0; i < num; i++)
+        EXPECT_EQ(dv[i], buf[i]);
+    }
+  }
+
+  delete[] dst;
+  delete[] buf;
+}
+
+TEST_P(Vpacker64P, UncompressV1) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = GetParam();
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *dlimit = dst + dbound;
+  uint64_t *buf = new uint64_t[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1ULL << 12);
+
+  /* Write a stream in the v1 format */
+  SetUint64(dst, VP64_MAGICNUM);
+  size_t wsz = 8;
+
+  for (size_t i = 0; i < num; i += block_num) {
+    size_t n = (num - i < block_num)? num - i : block_num;
+
+    uint32_t nwrite = CompressBlock(
+        dv + i, n, dst + wsz, dlimit, format_v1);
+    ASSERT_TRUE(nwrite != 0);
+
+    wsz += nwrite;
   }
 
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(dv[i], buf[i]);
+
   delete[] dst;
   delete[] buf;
 }
@@ -191,6 +231,43 @@ TEST(Vpacker64, SetUint64) {
   EXPECT_EQ(2546335145698555275ULL, DecodeUint64(buf));
 }
 
+TEST(Vpacker64, SetUint64LE) {
+  char  buf[32];
+
+  SetUint64LE(buf, 90285902385930821ULL);
+  EXPECT_EQ('\x45', buf[0]);
+  EXPECT_EQ('\x62', buf[1]);
+  EXPECT_EQ('\xf0', buf[2]);
+  EXPECT_EQ('\xc3', buf[3]);
+  EXPECT_EQ('\x8c', buf[4]);
+  EXPECT_EQ('\xc2', buf[5]);
+  EXPECT_EQ('\x40', buf[6]);
+  EXPECT_EQ('\x01', buf[7]);
+  EXPECT_EQ(90285902385930821ULL, DecodeUint64LE(buf));
+  EXPECT_EQ(3287310917, DecodeUint32LE(buf));
+
+  /* Arrays of raw integers in each format */
+  const uint64_t v[] = {
+    90285902385930821ULL, 2546335145698555275ULL,
+    0, 0xffffffffffffffffULL
+  };
+  uint64_t  out[4];
+
+  SetUint64s(buf, v, 4, format_v1);
+  EXPECT_EQ(2546335145698555275ULL, DecodeUint64(buf + 8));
+
+  DecodeUint64s(buf, out, 4, format_v1);
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(v[i], out[i]);
+
+  SetUint64s(buf, v, 4, format_v2);
+  EXPECT_EQ(2546335145698555275ULL, DecodeUint64LE(buf + 8));
+
+  DecodeUint64s(buf, out, 4, format_v2);
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(v[i], out[i]);
+}
+
 TEST(Vpacker64, Unpack0) {
   const char     *src = "0x00"; /* Not used in Unpack0 */
   uint64_t        dst[32];
@@ -1790,6 +1867,95 @@ TEST(Vpacker64, Unpack64) {
           src, slimit, dst, dst, 2));
 }
 
+TEST(Vpacker64, UnpackWord) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  char      src[2048];
+  uint64_t  buf[256];
+
+  for (size_t i = 1;
+        i < ARRAYSIZE(bits_length); i++) {
+    int       nbits = bits_length[i];
+    uint64_t  max = (nbits == 64)?
+        0xffffffffffffffffULL : (1ULL << nbits);
+
+    const uint64_t *dv =
+        tmgr.generate(&tv, 128, max);
+
+    int nwrite = WriteBits(
+        dv, nbits, 128, src, src + sizeof(src));
+    ASSERT_TRUE(nwrite >= 0);
+
+    for (int n = 1; n <= 128; n++) {
+      int nread = VP64_DIV_ROUNDUP(nbits * n, 8);
+
+      /* Check both word and one-by-one paths */
+      const char *slimit[2] = {
+        src + nread, src + sizeof(src)
+      };
+
+      for (int j = 0; j < 2; j++) {
+        memset(buf, 0x00, sizeof(buf));
+
+        EXPECT_EQ(nread, word_unpackers[i](
+                src, slimit[j], buf, buf + n, n));
+        for (int k = 0; k < n; k++)
+          EXPECT_EQ(dv[k], buf[k]);
+      }
+
+      /* Tests for error checks */
+      EXPECT_EQ(-1, word_unpackers[i](
+              src, src + nread - 1, buf, buf + n, n));
+      EXPECT_EQ(-1, word_unpackers[i](
+              src, slimit[1], buf, buf + n - 1, n));
+
+      /* Unchecked ones overrun up to 7 integers */
+      memset(buf, 0x00, sizeof(buf));
+
+      word_fast_unpackers[i](src, buf, n);
+      for (int k = 0; k < n; k++)
+        EXPECT_EQ(dv[k], buf[k]);
+      for (int k = n + 7; k < 256; k++)
+        EXPECT_EQ(0, buf[k]);
+    }
+  }
+}
+
+TEST(Vpacker64, UnpackWide) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  char      src[2048];
+  uint64_t  buf[256];
+
+  for (int nbits = 1; nbits <= 56; nbits++) {
+    EXPECT_EQ(nbits, roundup_wide_bits[nbits]);
+
+    const uint64_t *dv =
+        tmgr.generate(&tv, 128, 1ULL << nbits);
+
+    int nwrite = WriteBits(
+        dv, nbits, 128, src, src + sizeof(src));
+    ASSERT_EQ(nbits * 16, nwrite);
+
+    for (int n = 1; n <= 128; n += 9) {
+      memset(buf, 0x00, sizeof(buf));
+
+      wide_fast_unpackers[nbits](src, buf, n);
+      for (int k = 0; k < n; k++)
+        EXPECT_EQ(dv[k], buf[k]);
+      for (int k = n + 7; k < 256; k++)
+        EXPECT_EQ(0, buf[k]);
+    }
+  }
+
+  for (int nbits = 57; nbits < 64; nbits++) {
+    EXPECT_EQ(64, roundup_wide_bits[nbits]);
+    EXPECT_TRUE(wide_fast_unpackers[nbits] == NULL);
+  }
+}
+
 TEST(Vpacker64, WriteBits) {
   /* Write 0-bit integers */
   {
@@ -2493,6 +2659,66 @@ TEST(Vpacker64, WriteBits) {
   }
 }
 
+TEST(Vpacker64, PackWord) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  /* Upper bits over nbits are ignored */
+  const uint64_t *in =
+      tmgr.generate(&tv, 128, ~uint64_t(0));
+
+  char  ref[1024 + 8];
+  char  dst[1024 + 8];
+
+  for (int b = 0; b <= 64; b++) {
+    /* Not used for wide blocks */
+    if (word_packers[b] == NULL)
+      continue;
+
+    for (size_t n = 0; n <= 128; n++) {
+      memset(ref, 0x5a, sizeof(ref));
+      memset(dst, 0x5a, sizeof(dst));
+
+      int sz = WriteBits(in, b, n, ref, ref + sizeof(ref));
+      ASSERT_EQ(sz, word_packers[b](in, n, dst, dst + sz));
+
+      /* The same bytes, and nothing over them */
+      EXPECT_EQ(0, memcmp(ref, dst, sizeof(dst)));
+
+      if (sz > 0) {
+        EXPECT_EQ(-1, word_packers[b](in, n, dst, dst + sz - 1));
+      }
+    }
+  }
+}
+
+TEST(Vpacker64, BitWidths) {
+  uint64_t in[194];
+  uint8_t  widths[195];
+  size_t   num = 0;
+
+  /* Integers around every power of two */
+  in[num++] = 0;
+  for (int b = 0; b < 64; b++) {
+    in[num++] = (uint64_t(1) << b) - 1;
+    in[num++] = uint64_t(1) << b;
+    in[num++] = (uint64_t(1) << b) + 1;
+  }
+  in[num++] = ~uint64_t(0);
+
+  memset(widths, 0xff, sizeof(widths));
+  BitWidths(in, num, widths);
+
+  EXPECT_EQ(0, widths[0]);
+  for (int b = 0; b < 64; b++) {
+    EXPECT_EQ(b, widths[3 * b + 1]);
+    EXPECT_EQ(b + 1, widths[3 * b + 2]);
+    EXPECT_EQ((b == 0)? 2 : b + 1, widths[3 * b + 3]);
+  }
+  EXPECT_EQ(64, widths[num - 1]);
+  EXPECT_EQ(0xff, widths[num]);
+}
+
 TEST(Vpacker64, ComputePartition) {
   /* -1 is a separator for partitions */
   uint64_t  src[160] = {
@@ -2545,6 +2771,1110 @@ TEST(Vpacker64, ComputePartition) {
   EXPECT_EQ(2, parts[11] - parts[10]);
 }
 
+TEST(Vpacker64, BestCandidate) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 4096;
+  uint64_t *costs = new uint64_t[num + 1];
+  uint8_t  *widths = new uint8_t[num + 1];
+
+  vcandidate64_t best_candidate = SelectBestCandidate();
+
+  uint64_t ranges[] = {
+    1ULL << 4, 1ULL << 13, 1ULL << 40, ~0ULL
+  };
+
+  for (size_t k = 0; k < ARRAYSIZE(ranges); k++) {
+    const uint64_t *dv = tmgr.generate(&tv, num, ranges[k]);
+
+    BitWidths(dv, num, widths);
+
+    costs[0] = 0;
+    for (size_t i = 1; i <= num; i++)
+      costs[i] = costs[i - 1] + dv[i - 1] % 9;
+
+    for (size_t i = 128; i <= num; i++) {
+      uint64_t c1 = 0;
+      uint64_t c2 = 0;
+      EXPECT_EQ(BestCandidate(widths, roundup_bits, costs, i, &c1),
+                best_candidate(widths, roundup_bits, costs, i, &c2));
+      EXPECT_EQ(c1, c2);
+
+      EXPECT_EQ(
+          BestCandidate(widths, roundup_wide_bits, costs, i, &c1),
+          best_candidate(widths, roundup_wide_bits, costs, i, &c2));
+      EXPECT_EQ(c1, c2);
+    }
+  }
+
+  delete[] costs;
+  delete[] widths;
+}
+
+TEST(Vpacker64, PruneCandidate) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+  std::vector<uint64_t> th;
+
+  size_t    num = 4096;
+  size_t   *parts = new size_t[num + 1];
+  uint64_t *in = new uint64_t[num];
+
+  vcandidate64_t funcs[] = {BestCandidate, SelectBestCandidate()};
+
+  /* Small and middle integers, and hashes among them */
+  const uint64_t *dv = tmgr.generate(&tv, num, 1ULL << 12);
+  const uint64_t *hv = tmgr.generate(&th, num, ~0ULL);
+
+  for (size_t i = 0; i < num; i++)
+    in[i] = ((i / 256) % 2 == 0 || i % 3 == 0)? hv[i] :
+        (i % 5 == 0)? dv[i] << 16 : dv[i];
+
+  /*
+   * Candidates ending at 1024 see 32-bit integers
+   * only, and the hashes between them make longer
+   * candidates cheaper.
+   */
+  for (size_t i = 1024 - 128; i < 1024; i++)
+    in[i] = hv[i] | (1ULL << 63);
+  for (size_t j = 0; j < ARRAYSIZE(partition_length); j++)
+    in[1024 - partition_length[j]] = dv[j] << 16;
+
+  Workspace ws;
+  ASSERT_TRUE(ws.Reserve(num));
+
+  BitWidths(in, num, ws.widths());
+
+  /* Check both round-up bit lengths */
+  const int *roundups[] = {roundup_bits, roundup_wide_bits};
+
+  for (size_t r = 0; r < ARRAYSIZE(roundups); r++) {
+    ComputePartition(in, num, parts, ws, roundups[r], r + 1);
+
+    /* The same choices as all the candidates on the DP costs */
+    const uint64_t *costs = ws.costs();
+    const uint8_t *widths = ws.widths();
+    size_t npruned = 0;
+
+    for (size_t i = 128; i <= num; i++) {
+      int       maxb = 0;
+      uint64_t  best = ~uint64_t(0);
+      size_t    start = 0;
+
+      for (size_t j = 0; j < ARRAYSIZE(partition_length); j++) {
+        size_t bp = i - partition_length[j];
+
+        maxb = std::max(maxb, roundups[r][widths[bp]]);
+        uint64_t c = costs[bp] + VP64_DIV_ROUNDUP((i - bp) * maxb, 8);
+        if (c <= best) {
+          best = c;
+          start = bp;
+        }
+      }
+
+      if (maxb == 64)
+        npruned++;
+
+      for (size_t k = 0; k < ARRAYSIZE(funcs); k++) {
+        uint64_t c = 0;
+        EXPECT_EQ(start, funcs[k](widths, roundups[r], costs, i, &c));
+        EXPECT_EQ(best, c);
+      }
+    }
+
+    EXPECT_LT(num / 4, npruned);
+  }
+
+  delete[] parts;
+  delete[] in;
+}
+
+TEST(Vpacker64, ComputeFastPartition) {
+  uint64_t  src[397];
+  size_t    parts[16];
+
+  /* 16 wide integers followed by small ones */
+  for (size_t i = 0; i < 128; i++)
+    src[i] = 0;
+  for (size_t i = 128; i < 144; i++)
+    src[i] = 1ULL << 40;
+  for (size_t i = 144; i < 397; i++)
+    src[i] = 1;
+
+  EXPECT_EQ(8, ComputeFastPartition(src, 397, parts));
+  EXPECT_EQ(0, parts[0]);
+  EXPECT_EQ(128, parts[1]);
+  EXPECT_EQ(144, parts[2]);
+  EXPECT_EQ(160, parts[3]);
+  EXPECT_EQ(192, parts[4]);
+  EXPECT_EQ(256, parts[5]);
+  EXPECT_EQ(384, parts[6]);
+  EXPECT_EQ(396, parts[7]);
+  EXPECT_EQ(397, parts[8]);
+}
+
+TEST(Vpacker64, UncompressBlockCorrupt) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 4096;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *tmp = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1ULL << 12);
+
+  uint32_t wsz =
+      CompressBlock(dv, num, dst, dst + dbound);
+  ASSERT_TRUE(wsz > 8);
+
+  uint32_t offset = DecodeUint32LE(dst + 4);
+
+  /* Broken offsets */
+  memcpy(tmp, dst, wsz);
+  SetUint32LE(tmp + 4, 4);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  SetUint32LE(tmp + 4, wsz + 1);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  /* A broken block size */
+  memcpy(tmp, dst, wsz);
+  SetUint32LE(tmp, wsz + 1);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  /* Partitions do not cover integers */
+  memcpy(tmp, dst, wsz);
+  tmp[8] = (tmp[8] & 0x0f) |
+      (((tmp[8] & 0xf0) == 0x00)? 0x10 : 0x00);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  /* Bit lengths do not match with packed bytes */
+  memcpy(tmp, dst, wsz);
+  tmp[offset - 1] = (tmp[offset - 1] & 0xf0) |
+      (((tmp[offset - 1] & 0x0f) == 0x0f)? 0x00 : 0x0f);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, num));
+
+  /* An original one works */
+  EXPECT_EQ(wsz, UncompressBlock(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(dv[i], buf[i]);
+
+  delete[] dst;
+  delete[] tmp;
+  delete[] buf;
+}
+
+TEST(Vpacker64, Compressor) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 3 * block_num + 100;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *ref = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+
+  /* One object is reused for various sizes */
+  Compressor c;
+
+  const size_t sizes[] = {
+    num, 1, 100, block_num, block_num + 1, 1000, num
+  };
+
+  for (size_t i = 0; i < ARRAYSIZE(sizes); i++) {
+    const uint64_t *dv =
+        tmgr.generate(&tv, sizes[i], 1ULL << 40);
+
+    size_t wsz = c.Compress(dv, dst, sizes[i]);
+    ASSERT_TRUE(wsz != 0);
+
+    /* The output is the same with Compress() */
+    EXPECT_EQ(wsz, Compress(dv, ref, sizes[i]));
+    EXPECT_EQ(0, memcmp(dst, ref, wsz));
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, sizes[i]));
+    for (size_t j = 0; j < sizes[i]; j++)
+      EXPECT_EQ(dv[j], buf[j]);
+  }
+
+  delete[] dst;
+  delete[] ref;
+  delete[] buf;
+}
+
+TEST(Vpacker64, CompressParallel) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 5 * block_num + 100;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *ref = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1ULL << 40);
+
+  const size_t sizes[] = {
+    1, block_num, block_num + 1, 3 * block_num, num
+  };
+
+  const int nthreads[] = {2, 3, 8};
+
+  for (size_t i = 0; i < ARRAYSIZE(sizes); i++) {
+    size_t wsz = Compress(dv, ref, sizes[i]);
+    ASSERT_TRUE(wsz != 0);
+
+    /* The output is byte-identical to a serial one */
+    for (size_t j = 0; j < ARRAYSIZE(nthreads); j++) {
+      memset(dst, 0x00, dbound);
+
+      EXPECT_EQ(wsz, Compress(dv, dst, sizes[i], nthreads[j]));
+      EXPECT_EQ(0, memcmp(dst, ref, wsz));
+
+      EXPECT_EQ(wsz, Uncompress(dst, buf, sizes[i]));
+      for (size_t k = 0; k < sizes[i]; k++)
+        EXPECT_EQ(dv[k], buf[k]);
+    }
+  }
+
+  /* One object is reused */
+  Compressor c(4);
+
+  for (int i = 0; i < 2; i++) {
+    size_t wsz = c.Compress(dv, dst, num);
+
+    EXPECT_EQ(wsz, Compress(dv, ref, num));
+    EXPECT_EQ(0, memcmp(dst, ref, wsz));
+  }
+
+  delete[] dst;
+  delete[] ref;
+  delete[] buf;
+}
+
+TEST(Vpacker64, UncompressParallel) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 5 * block_num + 100;
+  size_t    nblock = 6;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1ULL << 40);
+
+  size_t wsz_nodir = Compress(dv, dst, num);
+
+  for (int dir = 0; dir < 2; dir++) {
+    for (int nth = 1; nth <= 3; nth += 2) {
+      Compressor c(nth);
+      c.set_directory(dir != 0);
+
+      size_t wsz = c.Compress(dv, dst, num);
+
+      if (dir) {
+        EXPECT_EQ(wsz_nodir + 8 * nblock, wsz);
+        EXPECT_EQ(VP64_MAGICNUM_V2_DIR, DecodeUint64(dst));
+
+        /* The directory points to each block */
+        EXPECT_EQ(8 + 8 * nblock, DecodeUint64LE(dst + 8));
+
+        for (size_t i = 0; i + 1 < nblock; i++) {
+          size_t off = DecodeUint64LE(dst + 8 + 8 * i);
+          EXPECT_EQ(off + BlockSize(dst + off, block_num, format_v2),
+                    DecodeUint64LE(dst + 16 + 8 * i));
+        }
+      } else {
+        EXPECT_EQ(wsz_nodir, wsz);
+      }
+
+      const int nthreads[] = {1, 2, 4, 16};
+
+      for (size_t i = 0; i < ARRAYSIZE(nthreads); i++) {
+        memset(buf, 0x00, num * sizeof(uint64_t));
+
+        EXPECT_EQ(wsz, Uncompress(dst, buf, num, nthreads[i]));
+        for (size_t j = 0; j < num; j++)
+          EXPECT_EQ(dv[j], buf[j]);
+      }
+    }
+  }
+
+  /* A broken directory is detected */
+  size_t off = DecodeUint64LE(dst + 16);
+  SetUint64LE(dst + 16, off + 1);
+  EXPECT_EQ(0, Uncompress(dst, buf, num, 4));
+
+  /*
+   * Offsets out of the blocks are not followed,
+   * and the blocks are walked one by one.
+   */
+  const uint64_t broken[] = {
+    0, 1ULL << 40, ~0ULL - 7
+  };
+
+  for (size_t i = 0; i < ARRAYSIZE(broken); i++) {
+    for (size_t k = 0; k < 2; k++) {
+      SetUint64LE(dst + 8 + 8 * k, broken[i]);
+      memset(buf, 0x00, num * sizeof(uint64_t));
+
+      EXPECT_EQ(wsz_nodir + 8 * nblock, Uncompress(dst, buf, num, 4));
+      for (size_t j = 0; j < num; j++)
+        EXPECT_EQ(dv[j], buf[j]);
+    }
+  }
+
+  delete[] dst;
+  delete[] buf;
+}
+
+TEST(Vpacker64, DecodeRange) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 2 * block_num + 100;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint64_t *buf = new uint64_t[num + 1];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1ULL << 40);
+
+  const size_t ranges[][2] = {
+    {0, 1}, {0, 200}, {5, 6}, {100, 300}, {1000, 1001},
+    {block_num - 40, block_num - 1}, {block_num - 1, block_num + 1},
+    {block_num - 3, 2 * block_num + 50}, {2 * block_num + 99, num},
+    {0, num}
+  };
+
+  for (int dir = 0; dir < 2; dir++) {
+    Compressor c;
+    c.set_directory(dir != 0);
+
+    ASSERT_TRUE(c.Compress(dv, dst, num) != 0);
+
+    for (size_t i = 0; i < ARRAYSIZE(ranges); i++) {
+      size_t begin = ranges[i][0];
+      size_t end = ranges[i][1];
+
+      /* A sentinel next to the range is kept */
+      buf[end - begin] = 0x5a;
+
+      EXPECT_EQ(end - begin, DecodeRange(dst, num, begin, end, buf));
+      for (size_t j = begin; j < end; j++)
+        EXPECT_EQ(dv[j], buf[j - begin]);
+
+      EXPECT_EQ(0x5a, buf[end - begin]);
+    }
+
+    for (size_t i = 0; i < num; i += 997)
+      EXPECT_EQ(dv[i], Get(dst, num, i));
+
+    EXPECT_EQ(dv[num - 1], Get(dst, num, num - 1));
+
+    /* Ranges out of the stream are invalid */
+    EXPECT_EQ(0, DecodeRange(dst, num, 10, 10, buf));
+    EXPECT_EQ(0, DecodeRange(dst, num, num - 1, num + 1, buf));
+
+    if (dir) {
+      /*
+       * Offsets out of the blocks are not followed,
+       * and the blocks are walked one by one.
+       */
+      const uint64_t broken[] = {
+        0, 1ULL << 40, ~0ULL - 7
+      };
+
+      for (size_t i = 0; i < ARRAYSIZE(broken); i++) {
+        for (size_t k = 0; k < 3; k++) {
+          SetUint64LE(dst + 8 + 8 * k, broken[i]);
+
+          EXPECT_EQ(200, DecodeRange(dst, num, 100, 300, buf));
+          for (size_t j = 100; j < 300; j++)
+            EXPECT_EQ(dv[j], buf[j - 100]);
+
+          EXPECT_EQ(50, DecodeRange(
+              dst, num, 2 * block_num + 50, num, buf));
+          for (size_t j = 2 * block_num + 50; j < num; j++)
+            EXPECT_EQ(dv[j], buf[j - 2 * block_num - 50]);
+        }
+      }
+    } else {
+      /* Broken sizes of blocks are not followed */
+      dst[8 + 3] ^= 0x40;
+      EXPECT_EQ(0, DecodeRange(dst, num, 2 * block_num, num, buf));
+      EXPECT_EQ(0, Get(dst, num, block_num));
+
+      dst[8 + 3] ^= 0x40;
+      SetUint32LE(dst + 8, 0);
+      EXPECT_EQ(0, DecodeRange(dst, num, 2 * block_num, num, buf));
+    }
+  }
+
+  delete[] dst;
+  delete[] buf;
+}
+
+TEST(Vpacker64, CompressDelta) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 3 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+  uint64_t *sorted = new uint64_t[num];
+
+  /* Sorted integers from random gaps */
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1ULL << 10);
+
+  sorted[0] = dv[0];
+  for (size_t i = 1; i < num; i++)
+    sorted[i] = sorted[i - 1] + dv[i];
+
+  const uint64_t *inputs[] = {sorted, dv};
+
+  for (size_t k = 0; k < ARRAYSIZE(inputs); k++) {
+    const uint64_t *in = inputs[k];
+    size_t plain = Compress(in, dst, num);
+
+    for (int nth = 1; nth <= 3; nth += 2) {
+      Compressor c(nth);
+      c.set_delta(true);
+
+      size_t wsz = c.Compress(in, dst, num);
+      ASSERT_TRUE(wsz != 0);
+
+      /* Gaps are much smaller than sorted integers */
+      if (in == sorted) {
+        EXPECT_GT(plain, 2 * wsz);
+      }
+
+      memset(buf, 0x00, num * sizeof(uint64_t));
+
+      EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+      for (size_t i = 0; i < num; i++)
+        EXPECT_EQ(in[i], buf[i]);
+
+      memset(buf, 0x00, num * sizeof(uint64_t));
+
+      EXPECT_EQ(wsz, Uncompress(dst, buf, num, 4));
+      for (size_t i = 0; i < num; i++)
+        EXPECT_EQ(in[i], buf[i]);
+
+      /* Random access sums up gaps in a block */
+      for (size_t i = 0; i < num; i += 4999)
+        EXPECT_EQ(in[i], Get(dst, num, i));
+
+      EXPECT_EQ(300, DecodeRange(
+          dst, num, block_num + 200, block_num + 500, buf));
+      for (size_t i = 0; i < 300; i++)
+        EXPECT_EQ(in[block_num + 200 + i], buf[i]);
+    }
+  }
+
+  /* Integers wrap around in a delta block */
+  for (size_t i = 0; i < 1000; i++)
+    sorted[i] = 0xffffffffffffff00ULL + uint64_t(i);
+
+  Compressor c;
+  c.set_delta(true);
+
+  size_t wsz = c.Compress(sorted, dst, 1000);
+  EXPECT_EQ(wsz, Uncompress(dst, buf, 1000));
+  for (size_t i = 0; i < 1000; i++)
+    EXPECT_EQ(sorted[i], buf[i]);
+
+  delete[] dst;
+  delete[] buf;
+  delete[] sorted;
+}
+
+TEST(Vpacker64, Zigzag) {
+  const int64_t in[] = {
+    0, -1, 1, -2, 2, 0x7fffffffffffffffLL, -0x7fffffffffffffffLL - 1
+  };
+  const uint64_t ref[] = {
+    0, 1, 2, 3, 4, 0xfffffffffffffffeULL, 0xffffffffffffffffULL
+  };
+
+  uint64_t buf[ARRAYSIZE(ref)];
+
+  for (size_t i = 0; i < ARRAYSIZE(in); i++) {
+    EXPECT_EQ(ref[i], ZigzagEncode(static_cast<uint64_t>(in[i])));
+    buf[i] = ref[i];
+  }
+
+  ZigzagDecode(buf, ARRAYSIZE(buf));
+
+  for (size_t i = 0; i < ARRAYSIZE(in); i++)
+    EXPECT_EQ(static_cast<uint64_t>(in[i]), buf[i]);
+}
+
+TEST(Vpacker64, CompressSigned) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 2 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  int64_t  *buf = new int64_t[num];
+  int64_t  *in = new int64_t[num];
+
+  /* Small integers around zero */
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1U << 12);
+
+  for (size_t i = 0; i < num; i++)
+    in[i] = static_cast<int64_t>(dv[i]) - (1 << 11);
+
+  size_t usize = Compress(
+      reinterpret_cast<const uint64_t *>(in), dst, num);
+
+  for (int nth = 1; nth <= 3; nth += 2) {
+    size_t wsz = Compress(in, dst, num, nth);
+    ASSERT_TRUE(wsz != 0);
+    EXPECT_GT(usize, 2 * wsz);
+
+    memset(buf, 0x00, num * sizeof(int64_t));
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    memset(buf, 0x00, num * sizeof(int64_t));
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num, 4));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(100, DecodeRange(dst, num, 5000, 5100, buf));
+    for (size_t i = 0; i < 100; i++)
+      EXPECT_EQ(in[5000 + i], buf[i]);
+  }
+
+  /* Signed gaps with block_delta */
+  for (size_t i = 1; i < num; i++)
+    in[i] += in[i - 1];
+
+  Compressor c;
+  c.set_delta(true);
+
+  size_t wsz = c.Compress(in, dst, num);
+  ASSERT_TRUE(wsz != 0);
+  EXPECT_GT(usize, 2 * wsz);
+
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  for (size_t i = 0; i < num; i += 3331)
+    EXPECT_EQ(static_cast<uint64_t>(in[i]), Get(dst, num, i));
+
+  delete[] dst;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker64, CompressDict) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 2 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *tmp = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+  uint64_t *in = new uint64_t[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1U << 5);
+
+  /* 32 distinct 48-bit integers */
+  for (size_t i = 0; i < num; i++)
+    in[i] = (1ULL << 47) + 999999937ULL * dv[i];
+
+  uint64_t dict[dict_max];
+  size_t ndict;
+
+  ASSERT_TRUE(BuildDict(in, 4096, dict, &ndict, buf));
+  EXPECT_GE(32, ndict);
+  for (size_t i = 0; i < 4096; i++)
+    EXPECT_EQ(in[i], dict[buf[i]]);
+
+  EXPECT_FALSE(BuildDict(dv, 4096, dict, &ndict, buf));
+
+  for (int k = 0; k < 2; k++) {
+    size_t wsz = (k == 0)?
+        Compress(in, dst, num) :
+        Compress(reinterpret_cast<int64_t *>(in), dst, num);
+    EXPECT_LT(wsz, num * 6 / 8);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(500, DecodeRange(dst, num, 1000, 1500, buf));
+    for (size_t i = 0; i < 500; i++)
+      EXPECT_EQ(in[1000 + i], buf[i]);
+  }
+
+  /* Broken dictionaries */
+  uint32_t wsz = CompressBlock(in, 4096, dst, dst + dbound);
+  ASSERT_EQ(block_dict, DecodeUint32LE(dst + 4) >> 24);
+  EXPECT_EQ(wsz, UncompressBlock(dst, buf, 4096));
+
+  const uint32_t ndicts[] = {0, dict_max + 1, 1U << 20};
+
+  for (size_t i = 0; i < ARRAYSIZE(ndicts); i++) {
+    memcpy(tmp, dst, wsz);
+    SetUint32LE(tmp + 8, ndicts[i]);
+    EXPECT_EQ(0, UncompressBlock(tmp, buf, 4096));
+    EXPECT_FALSE(UncompressBlockRange(
+        tmp, 4096, format_v2, 0, 1, buf));
+  }
+
+  delete[] dst;
+  delete[] tmp;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker64, CompressAuto) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 3 * block_num;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+  uint64_t *in = new uint64_t[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1U << 10);
+
+  /* Sorted, small, and signed small integers */
+  in[0] = 0;
+  for (size_t i = 1; i < block_num; i++)
+    in[i] = in[i - 1] + dv[i];
+  for (size_t i = block_num; i < 2 * block_num; i++)
+    in[i] = dv[i];
+  for (size_t i = 2 * block_num; i < num; i++)
+    in[i] = dv[i] - (1ULL << 9);
+
+  EXPECT_EQ(block_delta, ChooseBlockFlags(in, block_num));
+  EXPECT_EQ(0, ChooseBlockFlags(in + block_num, block_num));
+  EXPECT_EQ(block_zigzag,
+            ChooseBlockFlags(in + 2 * block_num, block_num));
+  EXPECT_EQ(0, ChooseBlockFlags(in + block_num, 300));
+
+  size_t plain = Compress(in, dst, num);
+
+  for (int nth = 1; nth <= 3; nth += 2) {
+    Compressor c(nth);
+    c.set_auto(true);
+
+    size_t wsz = c.Compress(in, dst, num);
+    ASSERT_TRUE(wsz != 0);
+    EXPECT_LT(wsz, plain * 3 / 4);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(1000, DecodeRange(
+        dst, num, block_num - 500, block_num + 500, buf));
+    for (size_t i = 0; i < 1000; i++)
+      EXPECT_EQ(in[block_num - 500 + i], buf[i]);
+  }
+
+  delete[] dst;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker64, CompressTimeSeries) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 2 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+  uint64_t *in = new uint64_t[num];
+  double   *din = new double[num];
+  double   *dbuf = new double[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1U << 4);
+
+  /* Nanosecond timestamps every 1ms with jitters */
+  in[0] = 1400000000ULL * 1000000000ULL;
+  for (size_t i = 1; i < num; i++)
+    in[i] = in[i - 1] + 1000000ULL + dv[i] - 8;
+
+  EXPECT_EQ(block_dod | block_zigzag,
+            ChooseBlockFlags(in, block_num));
+
+  Compressor delta;
+  delta.set_delta(true);
+  size_t dsz = delta.Compress(in, dst, num);
+
+  for (int nth = 1; nth <= 3; nth += 2) {
+    Compressor c(nth);
+    c.set_delta_of_delta(true);
+
+    size_t wsz = c.Compress(in, dst, num);
+    ASSERT_TRUE(wsz != 0);
+    EXPECT_LT(wsz, dsz / 3);
+    EXPECT_EQ(block_dod | block_zigzag,
+              DecodeUint32LE(dst + 12) >> 24);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num, nth));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(1000, DecodeRange(
+        dst, num, block_num - 500, block_num + 500, buf));
+    for (size_t i = 0; i < 1000; i++)
+      EXPECT_EQ(in[block_num - 500 + i], buf[i]);
+  }
+
+  Compressor c;
+  c.set_auto(true);
+  size_t wsz = c.Compress(in, dst, num);
+  EXPECT_LT(wsz, dsz / 3);
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  /* Sensor readings repeated a few times */
+  for (size_t i = 0; i < num; i++)
+    din[i] = 20.0 + 0.5 * static_cast<double>((i / 4) % 16);
+  din[7] = -0.0;
+  din[8] = 1e300;
+
+  wsz = Compress(din, dst, num);
+  ASSERT_TRUE(wsz != 0);
+  EXPECT_LT(wsz, num * 3);
+  EXPECT_EQ(block_xor,
+            (DecodeUint32LE(dst + 12) >> 24) & ~block_wide);
+
+  EXPECT_EQ(wsz, Uncompress(dst, dbuf, num));
+  EXPECT_EQ(0, memcmp(din, dbuf, num * sizeof(double)));
+
+  EXPECT_EQ(wsz, Uncompress(dst, dbuf, num, 3));
+  EXPECT_EQ(0, memcmp(din, dbuf, num * sizeof(double)));
+
+  EXPECT_EQ(1000, DecodeRange(
+      dst, num, block_num - 500, block_num + 500, dbuf));
+  EXPECT_EQ(0, memcmp(din + block_num - 500, dbuf,
+                      1000 * sizeof(double)));
+
+  /* Two of the flags with a base are broken */
+  Workspace ws;
+  uint32_t bsz = CompressBlock(in, 4096, dst, dst + dbound,
+                               format_v2, &ws,
+                               block_dod | block_zigzag);
+  ASSERT_TRUE(bsz != 0);
+  EXPECT_EQ(bsz, UncompressBlock(dst, buf, 4096));
+  dst[7] |= block_xor;
+  EXPECT_EQ(0, UncompressBlock(dst, buf, 4096));
+  EXPECT_FALSE(UncompressBlockRange(
+      dst, 4096, format_v2, 0, 1, buf));
+
+  delete[] dst;
+  delete[] buf;
+  delete[] in;
+  delete[] din;
+  delete[] dbuf;
+}
+
+TEST(Vpacker64, CompressWide) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 2 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *tmp = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+
+  const int widths[] = {20, 24, 40, 48, 56};
+
+  for (size_t w = 0; w < ARRAYSIZE(widths); w++) {
+    const uint64_t *in =
+        tmgr.generate(&tv, num, 1ULL << widths[w]);
+
+    size_t wsz = Compress(in, dst, num);
+    ASSERT_TRUE(wsz != 0);
+    EXPECT_LT(wsz, num * (widths[w] + 2) / 8);
+    EXPECT_EQ(block_wide, DecodeUint32LE(dst + 12) >> 24);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num, 3));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(1000, DecodeRange(
+        dst, num, block_num - 500, block_num + 500, buf));
+    for (size_t i = 0; i < 1000; i++)
+      EXPECT_EQ(in[block_num - 500 + i], buf[i]);
+  }
+
+  /* Integers in the 16 bit lengths are not wide */
+  const uint64_t *in = tmgr.generate(&tv, num, 1U << 12);
+
+  Compress(in, dst, num);
+  EXPECT_EQ(0, DecodeUint32LE(dst + 12) >> 24);
+
+  /* The v1 format has no wide blocks */
+  in = tmgr.generate(&tv, num, 1ULL << 40);
+
+  uint32_t wsz = CompressBlock(in, 4096, dst, dst + dbound,
+                               format_v1);
+  EXPECT_EQ(wsz, UncompressBlock(dst, buf, 4096, format_v1));
+  for (size_t i = 0; i < 4096; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  /* Broken control bytes */
+  wsz = CompressBlock(in, 4096, dst, dst + dbound);
+  ASSERT_EQ(block_wide, DecodeUint32LE(dst + 4) >> 24);
+  EXPECT_EQ(wsz, UncompressBlock(dst, buf, 4096));
+
+  const char broken[][2] = {{57, 0}, {65, 0}, {40, 16}};
+
+  for (size_t i = 0; i < ARRAYSIZE(broken); i++) {
+    memcpy(tmp, dst, wsz);
+    memcpy(tmp + 8, broken[i], 2);
+    EXPECT_EQ(0, UncompressBlock(tmp, buf, 4096));
+    EXPECT_FALSE(UncompressBlockRange(
+        tmp, 4096, format_v2, 0, 1, buf));
+  }
+
+  /* An odd # of bytes for 2-byte control bytes */
+  memcpy(tmp, dst, wsz);
+  SetUint32LE(tmp + 4, DecodeUint32LE(dst + 4) + 1);
+  EXPECT_EQ(0, UncompressBlock(tmp, buf, 4096));
+  EXPECT_FALSE(UncompressBlockRange(
+      tmp, 4096, format_v2, 0, 1, buf));
+
+  delete[] dst;
+  delete[] tmp;
+  delete[] buf;
+}
+
+TEST(Vpacker64, CompressWideBound) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = block_num;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+  uint64_t *in = new uint64_t[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1ULL << 20);
+
+  /*
+   * 56-bit and 64-bit integers alternate except in
+   * the windows that UseWideBlock() samples, so
+   * a wide block has a partition for each integer
+   * unless control bytes are charged.
+   */
+  for (size_t i = 0; i < num; i++)
+    in[i] = dv[i] | ((i & 1)? 1ULL << 63 : 1ULL << 55);
+
+  for (size_t w = 0; w < 8; w++) {
+    size_t start = (num - 512) * w / 7;
+    for (size_t i = start; i < start + 512; i++)
+      in[i] = dv[i];
+  }
+
+  size_t wsz = Compress(in, dst, num);
+  ASSERT_TRUE(wsz != 0);
+  EXPECT_EQ(block_wide, DecodeUint32LE(dst + 12) >> 24);
+
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  delete[] dst;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker64, CompressLevel) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 3 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *tmp = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+  uint64_t *in = new uint64_t[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1U << 20);
+
+  /* Skewed integers with wide outliers */
+  for (size_t i = 0; i < num; i++) {
+    in[i] = (i % 10 == 0)? dv[i] : dv[i] & 0xff;
+    if (i % 997 == 0)
+      in[i] = dv[i] << 30;
+  }
+
+  size_t best = Compress(in, dst, num);
+
+  for (int nth = 1; nth <= 3; nth += 2) {
+    Compressor c(nth);
+    c.set_level(level_fast);
+
+    size_t wsz = c.Compress(in, dst, num);
+    ASSERT_TRUE(wsz != 0);
+    EXPECT_LT(wsz, best * 5 / 4);
+
+    EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+    for (size_t i = 0; i < num; i++)
+      EXPECT_EQ(in[i], buf[i]);
+
+    EXPECT_EQ(1000, DecodeRange(
+        dst, num, block_num - 500, block_num + 500, buf));
+    for (size_t i = 0; i < 1000; i++)
+      EXPECT_EQ(in[block_num - 500 + i], buf[i]);
+  }
+
+  /* Levels are clamped */
+  Compressor c;
+  c.set_level(level_fast);
+  size_t wsz = c.Compress(in, tmp, num);
+
+  c.set_level(0);
+  EXPECT_EQ(wsz, c.Compress(in, dst, num));
+  EXPECT_EQ(0, memcmp(dst, tmp, wsz));
+
+  c.set_level(level_max + 1);
+  EXPECT_EQ(best, c.Compress(in, dst, num));
+
+  /* Wide blocks */
+  c.set_level(level_fast);
+
+  for (size_t i = 0; i < num; i++)
+    in[i] = dv[i] << 20;
+
+  wsz = c.Compress(in, dst, num);
+  EXPECT_LT(wsz, num * 6);
+  EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+  for (size_t i = 0; i < num; i++)
+    EXPECT_EQ(in[i], buf[i]);
+
+  delete[] dst;
+  delete[] tmp;
+  delete[] buf;
+  delete[] in;
+}
+
+TEST(Vpacker64, CompressPenalty) {
+  TestDataMgr<uint64_t> tmgr;
+  std::vector<uint64_t> tv;
+
+  size_t    num = 3 * block_num + 1000;
+  size_t    dbound = CompressBound(num);
+  char     *dst = new char[dbound];
+  char     *tmp = new char[dbound];
+  uint64_t *buf = new uint64_t[num];
+  uint64_t *in = new uint64_t[num];
+  size_t   *parts = new size_t[num];
+
+  const uint64_t *dv =
+      tmgr.generate(&tv, num, 1U << 20);
+
+  /* Skewed integers with outliers */
+  for (size_t i = 0; i < num; i++) {
+    in[i] = (i % 10 == 0)? dv[i] : dv[i] & 0xff;
+    if (i % 997 == 0)
+      in[i] = dv[i] << 30;
+  }
+
+  /* Larger penalties give less partitions */
+  Workspace ws;
+  ASSERT_TRUE(ws.Reserve(block_num));
+  BitWidths(in, block_num, ws.widths());
+
+  int np = ComputePartition(in, block_num, parts, ws);
+  int fnp = ComputeFastPartition(in, block_num, parts);
+
+  for (int penalty = 1; penalty <= penalty_max; penalty *= 4) {
+    int pnp = ComputePartition(in, block_num, parts, ws,
+                               roundup_bits, 1, penalty);
+    EXPECT_GE(np, pnp);
+    np = pnp;
+
+    EXPECT_EQ(0, parts[0]);
+    EXPECT_EQ(block_num, parts[pnp]);
+
+    pnp = ComputeFastPartition(in, block_num, parts,
+                               roundup_bits, 1, penalty);
+    EXPECT_GE(fnp, pnp);
+    fnp = pnp;
+  }
+
+  size_t best = Compress(in, dst, num);
+
+  for (int level = level_fast; level <= level_max; level++) {
+    Compressor c(3);
+    c.set_level(level);
+
+    for (int penalty = 0;
+          penalty <= penalty_max; penalty += penalty_max / 4) {
+      c.set_penalty(penalty);
+
+      size_t wsz = c.Compress(in, dst, num);
+      ASSERT_TRUE(wsz != 0);
+      EXPECT_LT(wsz, best * 2);
+
+      EXPECT_EQ(wsz, Uncompress(dst, buf, num));
+      for (size_t i = 0; i < num; i++)
+        EXPECT_EQ(in[i], buf[i]);
+    }
+  }
+
+  /* Penalties are clamped */
+  Compressor c;
+  EXPECT_EQ(best, c.Compress(in, tmp, num));
+
+  c.set_penalty(-1);
+  EXPECT_EQ(best, c.Compress(in, dst, num));
+  EXPECT_EQ(0, memcmp(dst, tmp, best));
+
+  c.set_penalty(penalty_max);
+  size_t wsz = c.Compress(in, tmp, num);
+  EXPECT_LE(best, wsz);
+
+  c.set_penalty(penalty_max + 1);
+  EXPECT_EQ(wsz, c.Compress(in, dst, num));
+  EXPECT_EQ(0, memcmp(dst, tmp, wsz));
+
+  delete[] dst;
+  delete[] tmp;
+  delete[] buf;
+  delete[] in;
+  delete[] parts;
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();